@@ -32,6 +32,8 @@ typedef Vec(char) StringBuffer;
 void sum_vec_reserve(void *vec, int32_t count, size_t size);
 void *vec_grow(void *vec, int32_t count, size_t size);
 ptrdiff_t push_str(StringBuffer *buffer, String s);
+// Returns an empty string if the file cannot be read. The caller frees `ptr`.
+String read_file(char const *path);
 
 
 
@@ -0,0 +1,380 @@
+#include "call-graph.h"
+
+#include "adt.h"
+#include "arena.h"
+#include "data/mir.h"
+#include "data/tir.h"
+#include "fwd.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every loop level is assumed to run this many iterations.
+#define LOOP_WEIGHT 8.0
+#define MAX_LOOP_DEPTH 4
+#define MAX_FREQUENCY 1e12
+#define PROPAGATION_ROUNDS 8
+// Without a profile, functions that are estimated to run less often than this
+// are cold. Every call that can be reached counts at least once, so these are
+// only the functions that main never reaches.
+#define COLD_FREQUENCY 0.5
+
+static int32_t function_index(CallGraph *graph, CallGraphInput *input, ValueId value) {
+    if (value.id >= input->global_deps->values.values.len) {
+        return -1;
+    }
+
+    TirContext ctx = {input->global_deps, NULL};
+
+    if (get_value_tag(ctx, value) != VAL_FUNCTION) {
+        return -1;
+    }
+
+    return graph->function_indices[value.id];
+}
+
+// The clones of a function, linked from the global value of the function.
+typedef struct {
+    int32_t *first;
+    int32_t *next;
+} CloneLists;
+
+static int32_t clone_index(CallGraphInput *input, CloneLists *clones, ValueId value, int32_t clone) {
+    if (value.id >= input->global_deps->values.values.len) {
+        return -1;
+    }
+
+    for (int32_t i = clones->first[value.id]; i >= 0; i = clones->next[i]) {
+        if (input->mir_result->functions[i].clone == clone) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+CallGraph build_call_graph(CallGraphInput *input, Arena *permanent, Arena scratch) {
+    MirResult *mir_result = input->mir_result;
+    Mir *mir = &mir_result->mir;
+    int32_t value_count = input->global_deps->values.values.len;
+
+    CallGraph graph = {0};
+    graph.function_indices = arena_alloc(permanent, int32_t, value_count);
+    graph.address_taken = arena_alloc(permanent, bool, mir_result->function_count);
+    graph.root = -1;
+
+    for (int32_t i = 0; i < value_count; i++) {
+        graph.function_indices[i] = -1;
+    }
+
+    CloneLists clones = {
+        .first = arena_alloc(&scratch, int32_t, value_count),
+        .next = arena_alloc(&scratch, int32_t, mir_result->function_count),
+    };
+
+    for (int32_t i = 0; i < value_count; i++) {
+        clones.first[i] = -1;
+    }
+
+    for (int32_t i = 0; i < mir_result->function_count; i++) {
+        ValueId value = input->functions[mir_result->functions[i].tir];
+
+        if (mir_result->functions[i].clone) {
+            clones.next[i] = clones.first[value.id];
+            clones.first[value.id] = i;
+            continue;
+        }
+
+        graph.function_indices[value.id] = i;
+
+        if (value.id == input->main.id) {
+            graph.root = i;
+        }
+    }
+
+    Vec(CallSite) calls = {0};
+    bool *is_callee = arena_alloc(&scratch, bool, mir->mir.len);
+
+    for (int32_t f = 0; f < mir_result->function_count; f++) {
+        MirFunction function = mir_result->functions[f];
+
+        // Functions of other shards have no MIR.
+        if (function.start == function.end) {
+            continue;
+        }
+
+        Arena function_scratch = scratch;
+        int32_t *depths = get_mir_loop_depths(mir, function.start, function.end, &function_scratch);
+        int32_t *dominators = get_mir_dominators(mir, function.start, function.end, &function_scratch);
+        int32_t block = 0;
+
+        for (int32_t i = function.start; i < function.end; i++) {
+            MirId mir_id = {i};
+
+            if (i > function.start && is_mir_terminator(get_mir_tag(mir, (MirId) {i - 1}))) {
+                block++;
+            }
+
+            if (get_mir_tag(mir, mir_id) != MIR_CALL) {
+                continue;
+            }
+
+            MirId operand = get_mir_access(mir, mir_id).operand;
+            int32_t callee;
+
+            if (get_mir_tag(mir, operand) == MIR_TIR_VALUE) {
+                callee = function_index(&graph, input, get_mir_tir_value(mir, operand));
+            } else if (get_mir_tag(mir, operand) == MIR_CLONE) {
+                callee = clone_index(input, &clones, get_mir_tir_value(mir, operand), get_mir_clone(mir, operand));
+            } else {
+                continue;
+            }
+
+            if (callee < 0) {
+                continue;
+            }
+
+            is_callee[operand.private_field_id] = true;
+
+            // Calls in blocks that cannot be reached never run.
+            if (block == 0 || dominators[block] >= 0) {
+                vec_push(&calls, (CallSite) {f, callee, mir_id, depths[i - function.start]});
+            }
+        }
+
+        for (int32_t i = function.start; i < function.end; i++) {
+            MirId mir_id = {i};
+
+            if (get_mir_tag(mir, mir_id) == MIR_TIR_VALUE && !is_callee[i]) {
+                int32_t referenced = function_index(&graph, input, get_mir_tir_value(mir, mir_id));
+
+                if (referenced >= 0) {
+                    graph.address_taken[referenced] = true;
+                }
+            }
+        }
+    }
+
+    for (int32_t i = 0; i < mir_result->function_count; i++) {
+        mir_result->functions[i].is_address_taken = graph.address_taken[i];
+    }
+
+    graph.calls = arena_alloc(permanent, CallSite, calls.len);
+    graph.call_count = calls.len;
+    if (calls.len) {
+        memcpy(graph.calls, calls.ptr, calls.len * sizeof(CallSite));
+    }
+    free(calls.ptr);
+    return graph;
+}
+
+static double call_site_weight(CallSite const *call) {
+    double weight = 1.0;
+    int32_t depth = call->loop_depth < MAX_LOOP_DEPTH ? call->loop_depth : MAX_LOOP_DEPTH;
+
+    for (int32_t i = 0; i < depth; i++) {
+        weight *= LOOP_WEIGHT;
+    }
+
+    return weight;
+}
+
+// Call frequencies relative to one execution of main. Functions whose address
+// escapes are assumed to be called from a loop in foreign code.
+static void estimate_frequencies(CallGraph *graph, int32_t function_count, double *frequencies, Arena scratch) {
+    double *base = arena_alloc(&scratch, double, function_count);
+    double *next = arena_alloc(&scratch, double, function_count);
+
+    for (int32_t i = 0; i < function_count; i++) {
+        if (i == graph->root || graph->root < 0) {
+            base[i] = 1.0;
+        }
+
+        if (graph->address_taken[i]) {
+            base[i] += LOOP_WEIGHT;
+        }
+
+        frequencies[i] = base[i];
+    }
+
+    for (int32_t round = 0; round < PROPAGATION_ROUNDS; round++) {
+        memcpy(next, base, function_count * sizeof(double));
+
+        for (int32_t i = 0; i < graph->call_count; i++) {
+            CallSite const *call = &graph->calls[i];
+            next[call->callee] += frequencies[call->caller] * call_site_weight(call);
+        }
+
+        for (int32_t i = 0; i < function_count; i++) {
+            frequencies[i] = next[i] < MAX_FREQUENCY ? next[i] : MAX_FREQUENCY;
+        }
+    }
+}
+
+static bool name_matches(char const *function_name, char const *name) {
+    if (strcmp(function_name, name) == 0) {
+        return true;
+    }
+
+    // Function symbols are prefixed with "file<N>_", where N is the index of
+    // the file they are defined in.
+    if (strncmp(function_name, "file", 4) != 0 || !isdigit((unsigned char) function_name[4])) {
+        return false;
+    }
+
+    char const *unprefixed = &function_name[4];
+
+    while (isdigit((unsigned char) *unprefixed)) {
+        unprefixed++;
+    }
+
+    return *unprefixed == '_' && strcmp(unprefixed + 1, name) == 0;
+}
+
+static bool read_profile(CallGraphInput *input, char const *path, double *frequencies) {
+    FILE *file = fopen(path, "r");
+
+    if (!file) {
+        fprintf(stderr, "failed to read profile \"%s\"\n", path);
+        return false;
+    }
+
+    MirResult *mir_result = input->mir_result;
+    TirContext ctx = {input->global_deps, NULL};
+    char line[512];
+    char name[256];
+    double count;
+
+    for (int32_t i = 0; i < mir_result->function_count; i++) {
+        frequencies[i] = 0.0;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || sscanf(line, "%255s %lf", name, &count) != 2) {
+            continue;
+        }
+
+        for (int32_t i = 0; i < mir_result->function_count; i++) {
+            ValueId value = input->functions[mir_result->functions[i].tir];
+            char const *function_name = &ctx.global->strtab.ptr[get_value_data(ctx, value)->index];
+
+            if (name_matches(function_name, name)) {
+                frequencies[i] += count;
+            }
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+typedef struct {
+    CallGraph *graph;
+    double *frequencies;
+    bool *placed;
+    MirFunction *order;
+    int32_t count;
+    MirFunction *functions;
+} Placement;
+
+// Places a function directly followed by its hot callees, heaviest call first.
+static void place_function(Placement *p, int32_t function, Arena scratch) {
+    p->placed[function] = true;
+    p->order[p->count++] = p->functions[function];
+
+    int32_t call_count = 0;
+
+    for (int32_t i = 0; i < p->graph->call_count; i++) {
+        if (p->graph->calls[i].caller == function) {
+            call_count++;
+        }
+    }
+
+    int32_t *callees = arena_alloc(&scratch, int32_t, call_count);
+    double *weights = arena_alloc(&scratch, double, call_count);
+    int32_t callee_count = 0;
+
+    for (int32_t i = 0; i < p->graph->call_count; i++) {
+        CallSite const *call = &p->graph->calls[i];
+
+        if (call->caller != function || p->functions[call->callee].is_cold) {
+            continue;
+        }
+
+        double weight = p->frequencies[function] * call_site_weight(call);
+        int32_t j = callee_count++;
+
+        while (j > 0 && (weights[j - 1] < weight || (weights[j - 1] == weight && callees[j - 1] > call->callee))) {
+            callees[j] = callees[j - 1];
+            weights[j] = weights[j - 1];
+            j--;
+        }
+
+        callees[j] = call->callee;
+        weights[j] = weight;
+    }
+
+    for (int32_t i = 0; i < callee_count; i++) {
+        if (!p->placed[callees[i]]) {
+            place_function(p, callees[i], scratch);
+        }
+    }
+}
+
+void order_functions(CallGraphInput *input, CallGraph *graph, char const *profile_path, Arena scratch) {
+    MirResult *mir_result = input->mir_result;
+    int32_t function_count = mir_result->function_count;
+    double *frequencies = arena_alloc(&scratch, double, function_count);
+    double cold_frequency = COLD_FREQUENCY;
+
+    if (profile_path && read_profile(input, profile_path, frequencies)) {
+        double max_frequency = 0.0;
+        for (int32_t i = 0; i < function_count; i++) {
+            if (frequencies[i] > max_frequency) {
+                max_frequency = frequencies[i];
+            }
+        }
+        cold_frequency = max_frequency / 1000.0;
+    } else {
+        estimate_frequencies(graph, function_count, frequencies, scratch);
+    }
+
+    for (int32_t i = 0; i < function_count; i++) {
+        MirFunction *function = &mir_result->functions[i];
+        function->is_cold = i != graph->root && frequencies[i] < cold_frequency;
+    }
+
+    Placement p = {
+        .graph = graph,
+        .frequencies = frequencies,
+        .placed = arena_alloc(&scratch, bool, function_count),
+        .order = arena_alloc(&scratch, MirFunction, function_count),
+        .functions = mir_result->functions,
+    };
+
+    while (true) {
+        int32_t hottest = -1;
+
+        for (int32_t i = 0; i < function_count; i++) {
+            if (!p.placed[i] && !p.functions[i].is_cold && (hottest < 0 || frequencies[i] > frequencies[hottest])) {
+                hottest = i;
+            }
+        }
+
+        if (hottest < 0) {
+            break;
+        }
+
+        place_function(&p, hottest, scratch);
+    }
+
+    for (int32_t i = 0; i < function_count; i++) {
+        if (!p.placed[i]) {
+            p.order[p.count++] = p.functions[i];
+        }
+    }
+
+    memcpy(mir_result->functions, p.order, function_count * sizeof(MirFunction));
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "arena.h"
+#include "data/tir.h"
+#include "tir2mir.h"
+
+// Functions are referred to by their index into `MirResult.functions` at the
+// time the graph was built.
+
+typedef struct {
+    int32_t caller;
+    int32_t callee;
+    MirId call;
+    int32_t loop_depth;
+} CallSite;
+
+typedef struct {
+    CallSite *calls;
+    int32_t call_count;
+    // Per function, true if it is referenced other than as the callee of a direct call.
+    bool *address_taken;
+    // Indexed by global value id, -1 for values that are not a lowered function.
+    int32_t *function_indices;
+    // Index of main, or -1.
+    int32_t root;
+} CallGraph;
+
+typedef struct {
+    MirResult *mir_result;
+    ValueId *functions;
+    ValueId main;
+    TirDependencies *global_deps;
+    LocalTir *insts;
+} CallGraphInput;
+
+CallGraph build_call_graph(CallGraphInput *input, Arena *permanent, Arena scratch);
+void order_functions(CallGraphInput *input, CallGraph *graph, char const *profile_path, Arena scratch);
@@ -0,0 +1,399 @@
+#include "data/mir.h"
+
+#include "adt.h"
+#include "arena.h"
+
+#include <stdint.h>
+
+int32_t *get_mir_block_starts(Mir *mir, int32_t start, int32_t end, int32_t *block_count, Arena *arena) {
+    int32_t count = 1;
+
+    for (int32_t i = start; i < end - 1; i++) {
+        if (is_mir_terminator(get_mir_tag(mir, (MirId) {i}))) {
+            count++;
+        }
+    }
+
+    int32_t *starts = arena_alloc(arena, int32_t, count + 1);
+    int32_t block = 0;
+    starts[block++] = start;
+
+    for (int32_t i = start; i < end - 1; i++) {
+        if (is_mir_terminator(get_mir_tag(mir, (MirId) {i}))) {
+            starts[block++] = i + 1;
+        }
+    }
+
+    starts[count] = end;
+    *block_count = count;
+    return starts;
+}
+
+int32_t *get_mir_loop_depths(Mir *mir, int32_t start, int32_t end, Arena *arena) {
+    int32_t block_count;
+    int32_t *block_starts = get_mir_block_starts(mir, start, end, &block_count, arena);
+    int32_t *loop_ends = arena_alloc(arena, int32_t, block_count);
+    int32_t *depths = arena_alloc(arena, int32_t, end - start + 1);
+    int32_t block = 0;
+
+    for (int32_t i = start; i < end; i++) {
+        MirTag tag = get_mir_tag(mir, (MirId) {i});
+
+        if (tag == MIR_BR || tag == MIR_BR_IF || tag == MIR_BR_IF_NOT) {
+            int32_t target = get_mir_access(mir, (MirId) {i}).index;
+
+            if (target <= block && i + 1 > loop_ends[target]) {
+                loop_ends[target] = i + 1;
+            }
+        }
+
+        if (is_mir_terminator(tag)) {
+            block++;
+        }
+    }
+
+    for (int32_t i = 0; i < block_count; i++) {
+        if (loop_ends[i]) {
+            depths[block_starts[i] - start]++;
+            depths[loop_ends[i] - start]--;
+        }
+    }
+
+    for (int32_t i = 1; i < end - start; i++) {
+        depths[i] += depths[i - 1];
+    }
+
+    return depths;
+}
+
+// Successors of a block, which are at most the branch target and the next block.
+static int32_t get_block_successors(Mir *mir, int32_t *block_starts, int32_t block_count, int32_t block, int32_t *successors) {
+    MirId last = {block_starts[block + 1] - 1};
+    MirTag tag = get_mir_tag(mir, last);
+
+    switch (tag) {
+        case MIR_BR: {
+            successors[0] = get_mir_access(mir, last).index;
+            return 1;
+        }
+        case MIR_BR_IF:
+        case MIR_BR_IF_NOT: {
+            successors[0] = get_mir_access(mir, last).index;
+            successors[1] = block + 1;
+            return 2;
+        }
+        case MIR_RET:
+        case MIR_RET_VOID: {
+            return 0;
+        }
+        default: {
+            successors[0] = block + 1;
+            return block + 1 < block_count;
+        }
+    }
+}
+
+static int32_t intersect_dominators(int32_t *dominators, int32_t *order, int32_t a, int32_t b) {
+    while (a != b) {
+        while (order[a] > order[b]) {
+            a = dominators[a];
+        }
+        while (order[b] > order[a]) {
+            b = dominators[b];
+        }
+    }
+    return a;
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm".
+int32_t *get_mir_dominators(Mir *mir, int32_t start, int32_t end, Arena *arena) {
+    int32_t block_count;
+    int32_t *block_starts = get_mir_block_starts(mir, start, end, &block_count, arena);
+    int32_t *dominators = arena_alloc(arena, int32_t, block_count);
+    Arena scratch = *arena;
+
+    // Reverse postorder of the reachable blocks.
+    int32_t *postorder = arena_alloc(&scratch, int32_t, block_count);
+    int32_t *order = arena_alloc(&scratch, int32_t, block_count);
+    int32_t *stack = arena_alloc(&scratch, int32_t, block_count);
+    int32_t *next_successor = arena_alloc(&scratch, int32_t, block_count);
+    bool *visited = arena_alloc(&scratch, bool, block_count);
+    int32_t postorder_count = 0;
+    int32_t stack_count = 0;
+    int32_t successors[2];
+
+    stack[stack_count++] = 0;
+    visited[0] = true;
+
+    while (stack_count) {
+        int32_t block = stack[stack_count - 1];
+        int32_t successor_count = get_block_successors(mir, block_starts, block_count, block, successors);
+
+        if (next_successor[block] < successor_count) {
+            int32_t successor = successors[next_successor[block]++];
+
+            if (!visited[successor]) {
+                visited[successor] = true;
+                stack[stack_count++] = successor;
+            }
+        } else {
+            order[block] = block_count - postorder_count;
+            postorder[postorder_count++] = block;
+            stack_count--;
+        }
+    }
+
+    int32_t *predecessor_counts = arena_alloc(&scratch, int32_t, block_count + 1);
+
+    for (int32_t block = 0; block < block_count; block++) {
+        dominators[block] = -1;
+        int32_t successor_count = get_block_successors(mir, block_starts, block_count, block, successors);
+
+        for (int32_t i = 0; i < successor_count; i++) {
+            predecessor_counts[successors[i] + 1]++;
+        }
+    }
+
+    for (int32_t block = 0; block < block_count; block++) {
+        predecessor_counts[block + 1] += predecessor_counts[block];
+    }
+
+    int32_t *predecessors = arena_alloc(&scratch, int32_t, predecessor_counts[block_count]);
+    int32_t *filled = arena_alloc(&scratch, int32_t, block_count);
+
+    for (int32_t block = 0; block < block_count; block++) {
+        int32_t successor_count = get_block_successors(mir, block_starts, block_count, block, successors);
+
+        for (int32_t i = 0; i < successor_count; i++) {
+            predecessors[predecessor_counts[successors[i]] + filled[successors[i]]++] = block;
+        }
+    }
+
+    dominators[0] = 0;
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (int32_t i = postorder_count - 2; i >= 0; i--) {
+            int32_t block = postorder[i];
+            int32_t dominator = -1;
+
+            for (int32_t j = predecessor_counts[block]; j < predecessor_counts[block + 1]; j++) {
+                int32_t predecessor = predecessors[j];
+
+                if (!visited[predecessor] || dominators[predecessor] < 0) {
+                    continue;
+                }
+
+                if (dominator < 0) {
+                    dominator = predecessor;
+                } else {
+                    dominator = intersect_dominators(dominators, order, predecessor, dominator);
+                }
+            }
+
+            if (dominators[block] != dominator) {
+                dominators[block] = dominator;
+                changed = true;
+            }
+        }
+    }
+
+    dominators[0] = -1;
+    return dominators;
+}
+
+static void use_operand(MirRange *ranges, int32_t *roots, int32_t start, MirId operand, int32_t user) {
+    int32_t root = roots[operand.private_field_id - start];
+
+    if (root >= 0 && user > ranges[root - start].end) {
+        ranges[root - start].end = user;
+    }
+}
+
+static void escape_operand(int32_t *roots, bool *escaped, int32_t start, MirId operand) {
+    int32_t root = roots[operand.private_field_id - start];
+
+    if (root >= 0) {
+        escaped[root - start] = true;
+    }
+}
+
+MirRange *get_mir_alloc_ranges(Mir *mir, TirContext ctx, int32_t start, int32_t end, Arena *arena) {
+    MirRange *ranges = arena_alloc(arena, MirRange, end - start);
+    Arena scratch = *arena;
+    int32_t *roots = arena_alloc(&scratch, int32_t, end - start);
+    bool *escaped = arena_alloc(&scratch, bool, end - start);
+
+    for (int32_t i = start; i < end; i++) {
+        MirId mir_id = {i};
+        MirTag tag = get_mir_tag(mir, mir_id);
+        roots[i - start] = -1;
+        ranges[i - start] = (MirRange) {i, i};
+
+        switch (tag) {
+            case MIR_ALLOC: {
+                roots[i - start] = i;
+                break;
+            }
+            case MIR_ACCESS:
+            case MIR_CONST_INDEX: {
+                MirId base = get_mir_access(mir, mir_id).operand;
+                roots[i - start] = roots[base.private_field_id - start];
+                use_operand(ranges, roots, start, base, i);
+                break;
+            }
+            case MIR_INDEX: {
+                MirBinary index = get_mir_binary(mir, mir_id);
+                roots[i - start] = roots[index.left.private_field_id - start];
+                use_operand(ranges, roots, start, index.left, i);
+                use_operand(ranges, roots, start, index.right, i);
+                break;
+            }
+            case MIR_ADDRESS: {
+                escape_operand(roots, escaped, start, get_mir_unary(mir, mir_id));
+                break;
+            }
+            case MIR_NEW_SLICE: {
+                MirBinary binary = get_mir_binary(mir, mir_id);
+                use_operand(ranges, roots, start, binary.left, i);
+                escape_operand(roots, escaped, start, binary.right);
+                break;
+            }
+            case MIR_DEREF:
+            case MIR_LOAD:
+            case MIR_MINUS:
+            case MIR_NOT:
+            case MIR_RET: {
+                use_operand(ranges, roots, start, get_mir_unary(mir, mir_id), i);
+                break;
+            }
+            case MIR_ASSIGN:
+            case MIR_ADD:
+            case MIR_SUB:
+            case MIR_MUL:
+            case MIR_MULHI:
+            case MIR_DIV:
+            case MIR_MOD:
+            case MIR_AND:
+            case MIR_OR:
+            case MIR_XOR:
+            case MIR_SHL:
+            case MIR_SHR:
+            case MIR_EQ:
+            case MIR_NE:
+            case MIR_LT:
+            case MIR_GT:
+            case MIR_LE:
+            case MIR_GE:
+            case MIR_SLICE_INDEX:
+            case MIR_BOUNDS_CHECK: {
+                MirBinary binary = get_mir_binary(mir, mir_id);
+                use_operand(ranges, roots, start, binary.left, i);
+                use_operand(ranges, roots, start, binary.right, i);
+                break;
+            }
+            case MIR_ITOF:
+            case MIR_ITRUNC:
+            case MIR_SEXT:
+            case MIR_ZEXT:
+            case MIR_FTOI:
+            case MIR_FTRUNC:
+            case MIR_FEXT:
+            case MIR_PTR_CAST:
+            case MIR_BR_IF:
+            case MIR_BR_IF_NOT: {
+                use_operand(ranges, roots, start, get_mir_access(mir, mir_id).operand, i);
+                break;
+            }
+            case MIR_SELECT: {
+                MirAccess select = get_mir_access(mir, mir_id);
+                use_operand(ranges, roots, start, select.operand, i);
+                use_operand(ranges, roots, start, (MirId) {get_mir_extra(mir, select.index)}, i);
+                use_operand(ranges, roots, start, (MirId) {get_mir_extra(mir, select.index + 1)}, i);
+                break;
+            }
+            case MIR_CALL: {
+                MirAccess call = get_mir_access(mir, mir_id);
+                int32_t arg_count = get_function_type(ctx, get_mir_type(mir, mir_id)).param_count;
+                use_operand(ranges, roots, start, call.operand, i);
+
+                for (int32_t j = 0; j < arg_count; j++) {
+                    use_operand(ranges, roots, start, (MirId) {get_mir_extra(mir, call.index + j)}, i);
+                }
+
+                int32_t destination = get_mir_extra(mir, call.index + arg_count);
+
+                if (destination >= 0) {
+                    use_operand(ranges, roots, start, (MirId) {destination}, i);
+                }
+                break;
+            }
+            case MIR_NOP:
+            case MIR_PARAM:
+            case MIR_RET_SLOT:
+            case MIR_INT:
+            case MIR_FLOAT:
+            case MIR_STRING:
+            case MIR_NULL:
+            case MIR_TIR_VALUE:
+            case MIR_CONSTANT:
+            case MIR_CLONE:
+            case MIR_BR:
+            case MIR_RET_VOID: {
+                break;
+            }
+        }
+    }
+
+    // A range that enters or leaves a loop has to cover the whole loop, since
+    // the value is live across its back edge.
+    int32_t block_count;
+    int32_t *block_starts = get_mir_block_starts(mir, start, end, &block_count, &scratch);
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+        int32_t block = 0;
+
+        for (int32_t i = start; i < end; i++) {
+            MirTag tag = get_mir_tag(mir, (MirId) {i});
+
+            if (tag == MIR_BR || tag == MIR_BR_IF || tag == MIR_BR_IF_NOT) {
+                int32_t target = get_mir_access(mir, (MirId) {i}).index;
+
+                if (target <= block) {
+                    int32_t header = block_starts[target];
+
+                    for (int32_t j = start; j < end; j++) {
+                        MirRange *range = &ranges[j - start];
+
+                        if (get_mir_tag(mir, (MirId) {j}) != MIR_ALLOC || range->end < header || range->start > i) {
+                            continue;
+                        }
+
+                        if (range->start < header && range->end < i) {
+                            range->end = i;
+                            changed = true;
+                        } else if (range->start >= header && range->end > i) {
+                            escaped[j - start] = true;
+                        }
+                    }
+                }
+            }
+
+            if (is_mir_terminator(tag)) {
+                block++;
+            }
+        }
+    }
+
+    for (int32_t i = start; i < end; i++) {
+        if (escaped[i - start]) {
+            ranges[i - start] = (MirRange) {start, end};
+        }
+    }
+
+    return ranges;
+}
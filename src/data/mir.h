@@ -1,6 +1,7 @@
 #pragma once
 
-#include "data/mir.h"
+#include "arena.h"
+#include "data/tir.h"
 #include "fwd.h"
 
 #include <stdint.h>
@@ -78,6 +79,33 @@ static inline ValueId get_mir_tir_value(Mir *mir, MirId mir_id) {
     return mir->mir.datas[mir_id.private_field_id].tir_value;
 }
 
+// The copy of the function that a MIR_CLONE refers to.
+static inline int32_t get_mir_clone(Mir *mir, MirId mir_id) {
+    return mir->mir.datas[mir_id.private_field_id].raw.right;
+}
+
 static inline int32_t get_mir_extra(Mir *mir, int32_t index) {
     return mir->extra.ptr[index];
 }
+
+// Basic blocks are implicit: a new one starts after every terminator. Returns
+// the first instruction of every block of [start, end), followed by `end`.
+int32_t *get_mir_block_starts(Mir *mir, int32_t start, int32_t end, int32_t *block_count, Arena *arena);
+
+// Loop nesting depth of every instruction of [start, end), found from the
+// branches that jump backwards.
+int32_t *get_mir_loop_depths(Mir *mir, int32_t start, int32_t end, Arena *arena);
+
+// Immediate dominator of every block of [start, end). The entry block and
+// unreachable blocks have none and get -1.
+int32_t *get_mir_dominators(Mir *mir, int32_t start, int32_t end, Arena *arena);
+
+typedef struct {
+    int32_t start;
+    // Last instruction at which the allocation may still be used.
+    int32_t end;
+} MirRange;
+
+// Live range of every MIR_ALLOC of [start, end), indexed by `id - start`.
+// Allocations whose address escapes get the range [start, end].
+MirRange *get_mir_alloc_ranges(Mir *mir, TirContext ctx, int32_t start, int32_t end, Arena *arena);
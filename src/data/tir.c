@@ -655,6 +655,72 @@ bool is_relative_type(TirContext ctx, TypeId a) {
     }
 }
 
+static bool is_local_type(TirContext ctx, TypeId type) {
+    return type.id >= TYPE_COUNT + ctx.global->types.types.len;
+}
+
+bool types_equal(TirContext a_ctx, TypeId a, TirContext b_ctx, TypeId b) {
+    if (!is_local_type(a_ctx, a) || !is_local_type(b_ctx, b)) {
+        return a.id == b.id;
+    }
+
+    StructuralType x = get_type_from_id(a_ctx, a);
+    StructuralType y = get_type_from_id(b_ctx, b);
+
+    if (x.tag != y.tag) {
+        return false;
+    }
+    switch (x.tag) {
+        case TYPE_PRIMITIVE:
+        case TYPE_NEWTYPE:
+        case TYPE_STRUCT:
+        case TYPE_ENUM:
+        case TYPE_TYPE_PARAMETER: return false;
+
+        case TYPE_ARRAY: {
+            return types_equal(a_ctx, x.binary.first, b_ctx, y.binary.first)
+                && types_equal(a_ctx, x.binary.second, b_ctx, y.binary.second);
+        }
+        case TYPE_ARRAY_LENGTH: return x.array_length == y.array_length;
+
+        case TYPE_PTR:
+        case TYPE_PTR_MUT:
+        case TYPE_MULTIPTR:
+        case TYPE_MULTIPTR_MUT:
+        case TYPE_LINEAR: return types_equal(a_ctx, x.unary, b_ctx, y.unary);
+
+        case TYPE_FUNCTION: {
+            if (x.function.type_param_count || y.function.type_param_count) {
+                return false;
+            }
+            if (x.function.param_count != y.function.param_count) {
+                return false;
+            }
+            for (int32_t i = 0; i < x.function.param_count; i++) {
+                if (!types_equal(a_ctx, x.function.params[i], b_ctx, y.function.params[i])) {
+                    return false;
+                }
+            }
+            return types_equal(a_ctx, x.function.ret, b_ctx, y.function.ret);
+        }
+        case TYPE_TAGGED: {
+            if (!types_equal(a_ctx, x.tagged.newtype, b_ctx, y.tagged.newtype)) {
+                return false;
+            }
+            if (x.tagged.arg_count != y.tagged.arg_count) {
+                return false;
+            }
+            for (int32_t i = 0; i < x.tagged.arg_count; i++) {
+                if (!types_equal(a_ctx, x.tagged.args[i], b_ctx, y.tagged.args[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+    abort();
+}
+
 bool int_fits_in_bytes(int64_t i, int bytes) {
     switch (bytes) {
         case 1: return i >= INT8_MIN && i <= INT8_MAX;
@@ -1358,6 +1424,16 @@ void init_tir_deps(TirDependencies *deps) {
     sum_vec_push(&deps->values.values, data, VAL_ERROR);
 }
 
+void free_tir_deps(TirDependencies *deps) {
+    free(deps->strtab.ptr);
+    free(deps->types.types.datas);
+    free(deps->types.extra.ptr);
+    free(deps->types.set.ptr);
+    free(deps->values.values.datas);
+    free(deps->values.extra.ptr);
+    *deps = (TirDependencies) {0};
+}
+
 ValueId new_int_constant(TirContext ctx, TypeId type, int64_t x) {
     ValueList *values = ctx_values(ctx);
     vec_push(&values->extra, x);
@@ -1577,3 +1653,9 @@ TirInstData get_tir_data(TirInstList *insts, TirId inst) {
 int32_t get_tir_extra(TirInstList *insts, int32_t index) {
     return insts->extra.ptr[index];
 }
+
+void free_tir_insts(TirInstList *insts) {
+    free(insts->insts.datas);
+    free(insts->extra.ptr);
+    *insts = (TirInstList) {0};
+}
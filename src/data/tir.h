@@ -97,6 +97,8 @@ bool type_is_linear(TirContext ctx, TypeId type);
 bool type_is_unknown_size(TirContext ctx, TypeId type);
 bool is_equality_type(TirContext ctx, TypeId a);
 bool is_relative_type(TirContext ctx, TypeId a);
+// Compares types of two functions, which may each have their own local types.
+bool types_equal(TirContext a_ctx, TypeId a, TirContext b_ctx, TypeId b);
 bool int_fits_in_type(int64_t i, TypeId type, Target target);
 TypeId bigger_primitive_type(TypeId a, TypeId b, Target target);
 
@@ -192,6 +194,7 @@ TypeId replace_type_parameters(TirContext ctx, TypeId *args, TypeId generic, Are
 // Values
 
 void init_tir_deps(TirDependencies *deps);
+void free_tir_deps(TirDependencies *deps);
 ValueId new_int_constant(TirContext ctx, TypeId type, int64_t x);
 ValueId new_float_constant(TirContext ctx, TypeId type, double x);
 ValueId new_null_constant(TirContext ctx, TypeId type);
@@ -215,3 +218,4 @@ double get_value_float(TirContext ctx, ValueId value);
 TirTag get_tir_tag(TirInstList *insts, TirId inst);
 TirInstData get_tir_data(TirInstList *insts, TirId inst);
 int32_t get_tir_extra(TirInstList *insts, int32_t index);
+void free_tir_insts(TirInstList *insts);
@@ -13,12 +13,20 @@
 static omp_lock_t print_lock;
 #endif
 
+static _Thread_local FILE *thread_stream;
+static DiagnosticHandler diagnostic_handler;
+static void *diagnostic_handler_data;
+
 void init_diagnostic_module(void) {
 #ifdef _OPENMP
     omp_init_lock(&print_lock);
 #endif
 }
 
+void redirect_diagnostics(FILE *stream) {
+    thread_stream = stream;
+}
+
 static int find_line_num(String source, SourceIndex where) {
     int line_num = 1;
 
@@ -31,185 +39,156 @@ static int find_line_num(String source, SourceIndex where) {
     return line_num;
 }
 
-void print_diagnostic(SourceLoc const *loc, Diagnostic const *diagnostic) {
-    SourceIndex line_start = loc->where;
-
-    while (line_start.index > 0 && loc->source.ptr[line_start.index - 1] != '\n') {
-        line_start.index--;
-    }
-
-    SourceIndex line_end = loc->where;
-
-    while (line_end.index < loc->source.len && loc->source.ptr[line_end.index] != '\n') {
-        line_end.index++;
-    }
-
-    int line_num = find_line_num(loc->source, line_start);
-    char const *color = "";
-
-    if (diagnostic->kind < ERROR_END) {
-        color = "\033[31;1m";
-    } else {
-        color = "\033[96;1m";
-    }
-
-#ifdef _OPENMP
-    omp_set_lock(&print_lock);
-#endif
-
-    fprintf(stderr, "\033[0;1m%s:%d:%d: ", loc->path, line_num, (int) (loc->where.index - line_start.index + 1));
-    fprintf(stderr, "\033[0m%s", color);
-
-    if (diagnostic->kind < ERROR_END) {
-        fprintf(stderr, "error[E%04d]\033[0m: ", diagnostic->kind);
-    } else {
-        fprintf(stderr, "note\033[0m: ");
-    }
+void set_diagnostic_handler(DiagnosticHandler handler, void *data) {
+    diagnostic_handler = handler;
+    diagnostic_handler_data = data;
+}
 
+void print_diagnostic_message(FILE *stream, Diagnostic const *diagnostic) {
     switch (diagnostic->kind) {
         case ERROR_END:
         case NOTE_END: {
             abort();
         }
         case ERROR_INVALID_TOKEN: {
-            fprintf(stderr, "invalid token");
+            fprintf(stream, "invalid token");
             break;
         }
         case ERROR_EXPECTED_TOKEN: {
-            fprintf(stderr, "expected %s", token_tag_to_string(diagnostic->expected_token));
+            fprintf(stream, "expected %s", token_tag_to_string(diagnostic->expected_token));
             break;
         }
         case ERROR_EXPECTED_EXPRESSION: {
-            fprintf(stderr, "expected expression");
+            fprintf(stream, "expected expression");
             break;
         }
         case ERROR_EXPECTED_DEFINITION: {
-            fprintf(stderr, "expected definition");
+            fprintf(stream, "expected definition");
             break;
         }
         case ERROR_INVALID_TOKEN_AFTER_EXTERN: {
-            fprintf(stderr, "expected function or mut, but found %s", token_tag_to_string(diagnostic->expected_token));
+            fprintf(stream, "expected function or mut, but found %s", token_tag_to_string(diagnostic->expected_token));
             break;
         }
         case ERROR_EMPTY_CHAR: {
-            fprintf(stderr, "empty character literal");
+            fprintf(stream, "empty character literal");
             break;
         }
         case ERROR_MULTIPLE_CHAR: {
-            fprintf(stderr, "multiple character literal");
+            fprintf(stream, "multiple character literal");
             break;
         }
         case ERROR_ESCAPE_SEQUENCE: {
-            fprintf(stderr, "unknown escape sequence");
+            fprintf(stream, "unknown escape sequence");
             break;
         }
         case ERROR_UNTERMINATED_STRING: {
-            fprintf(stderr, "unterminated double quote string");
+            fprintf(stream, "unterminated double quote string");
             break;
         }
         case ERROR_RECURSIVE_DEPENDENCY: {
-            fprintf(stderr, "recursive dependency");
+            fprintf(stream, "recursive dependency");
             break;
         }
         case ERROR_EXPECTED_VALUE: {
-            fprintf(stderr, "expected value");
+            fprintf(stream, "expected value");
             break;
         }
         case ERROR_EXPECTED_TYPE: {
-            fprintf(stderr, "expected type");
+            fprintf(stream, "expected type");
             break;
         }
         case ERROR_MULTIPLE_DEFINITION: {
-            fprintf(stderr, "name is defined multiple times");
+            fprintf(stream, "name is defined multiple times");
             break;
         }
         case ERROR_MULTIPLE_EXTERN_DEFINITION: {
-            fprintf(stderr, "extern symbol is defined multiple times");
+            fprintf(stream, "extern symbol is defined multiple times");
             break;
         }
         case ERROR_UNDEFINED_MODULE: {
-            fprintf(stderr, "unknown module");
+            fprintf(stream, "unknown module");
             break;
         }
         case ERROR_UNDEFINED_NAME: {
-            fprintf(stderr, "use of undefined name");
+            fprintf(stream, "use of undefined name");
             break;
         }
         case ERROR_UNDEFINED_NAME_FROM_MODULE: {
-            fprintf(stderr, "module does not contain such an item");
+            fprintf(stream, "module does not contain such an item");
             break;
         }
         case ERROR_DEREF_OPERAND_ROLE: {
-            fprintf(stderr, "expected value or type");
+            fprintf(stream, "expected value or type");
             break;
         }
         case ERROR_ACCESS_OPERAND_ROLE: {
-            fprintf(stderr, "expected value, type or module");
+            fprintf(stream, "expected value, type or module");
             break;
         }
         case ERROR_CALL_OPERAND_ROLE: {
-            fprintf(stderr, "expected value or type");
+            fprintf(stream, "expected value or type");
             break;
         }
         case ERROR_INDEX_OPERAND_ROLE: {
-            fprintf(stderr, "expected value, type or macro");
+            fprintf(stream, "expected value, type or macro");
             break;
         }
         case ERROR_ENUM_EXPECTS_INT_TYPE: {
-            fprintf(stderr, "enum layout type must be an integer type, but found ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, "enum layout type must be an integer type, but found ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
             break;
         }
         case ERROR_ARRAY_TYPE_EXPECTS_LENGTH_TYPE: {
-            fprintf(stderr, "array index type must be `ArrayLength, but found ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, "array index type must be `ArrayLength, but found ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
             break;
         }
         case ERROR_UNARY_UNEXPECTED_OPERAND: {
-            fprintf(stderr, "cannot apply unary operator to type ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, "cannot apply unary operator to type ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
             break;
         }
         case ERROR_BINARY_UNEXPECTED_OPERANDS: {
-            fprintf(stderr, "cannot apply binary operator to types ");
-            print_type(stderr, diagnostic->double_type_error.ctx, diagnostic->double_type_error.type1);
-            fprintf(stderr, " and ");
-            print_type(stderr, diagnostic->double_type_error.ctx, diagnostic->double_type_error.type2);
+            fprintf(stream, "cannot apply binary operator to types ");
+            print_type(stream, diagnostic->double_type_error.ctx, diagnostic->double_type_error.type1);
+            fprintf(stream, " and ");
+            print_type(stream, diagnostic->double_type_error.ctx, diagnostic->double_type_error.type2);
             break;
         }
         case ERROR_DEREF_UNEXPECTED_OPERAND: {
-            fprintf(stderr, "type ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
-            fprintf(stderr, " cannot be dereferenced");
+            fprintf(stream, "type ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, " cannot be dereferenced");
             break;
         }
         case ERROR_CAST: {
-            fprintf(stderr, "cannot cast from ");
-            print_type(stderr, diagnostic->double_type_error.ctx, diagnostic->double_type_error.type1);
-            fprintf(stderr, " to ");
-            print_type(stderr, diagnostic->double_type_error.ctx, diagnostic->double_type_error.type2);
+            fprintf(stream, "cannot cast from ");
+            print_type(stream, diagnostic->double_type_error.ctx, diagnostic->double_type_error.type1);
+            fprintf(stream, " to ");
+            print_type(stream, diagnostic->double_type_error.ctx, diagnostic->double_type_error.type2);
             break;
         }
         case ERROR_SLICE_CTOR_EXPECTS_POINTER: {
-            fprintf(stderr, "slice data field must be a pointer, but found ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, "slice data field must be a pointer, but found ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
             break;
         }
         case ERROR_TYPE_CONSTRUCTOR_TYPE: {
-            fprintf(stderr, "type ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
-            fprintf(stderr, " does not have a constructor");
+            fprintf(stream, "type ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, " does not have a constructor");
             break;
         }
         case ERROR_CALLEE: {
-            fprintf(stderr, "expected function, but found ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, "expected function, but found ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
             break;
         }
         case ERROR_ARGUMENT_COUNT: {
             int32_t param_count = get_function_type(diagnostic->type_error.ctx, diagnostic->type_error.type).param_count;
             fprintf(
-                stderr,
+                stream,
                 "expected %"PRIi32" %s, but provided %"PRIi32,
                 param_count,
                 param_count == 1 ? "argument" : "arguments",
@@ -218,13 +197,13 @@ void print_diagnostic(SourceLoc const *loc, Diagnostic const *diagnostic) {
             break;
         }
         case ERROR_TYPE_ARGUMENT_INFERENCE: {
-            fprintf(stderr, "couldn't infer type arguments");
+            fprintf(stream, "couldn't infer type arguments");
             break;
         }
         case ERROR_FIELD_COUNT: {
             int32_t field_count = get_struct_type(diagnostic->type_error.ctx, diagnostic->type_error.type).field_count;
             fprintf(
-                stderr,
+                stream,
                 "expected %"PRIi32" %s, but provided %"PRIi32,
                 field_count,
                 field_count == 1 ? "field" : "fields",
@@ -233,16 +212,16 @@ void print_diagnostic(SourceLoc const *loc, Diagnostic const *diagnostic) {
             break;
         }
         case ERROR_LINEAR_CTOR_COUNT: {
-            fprintf(stderr, "expected 1 field");
+            fprintf(stream, "expected 1 field");
             break;
         }
         case ERROR_INDEX_COUNT: {
-            fprintf(stderr, "expected 1 index, but provided %"PRIi32, diagnostic->type_error.extra);
+            fprintf(stream, "expected 1 index, but provided %"PRIi32, diagnostic->type_error.extra);
             break;
         }
         case ERROR_WRONG_COUNT: {
             fprintf(
-                stderr,
+                stream,
                 "expected %"PRIi32" %s, but provided %"PRIi32,
                 diagnostic->count_error.expected,
                 diagnostic->count_error.expected == 1 ? "argument" : "arguments",
@@ -253,7 +232,7 @@ void print_diagnostic(SourceLoc const *loc, Diagnostic const *diagnostic) {
         case ERROR_TAGGED_TYPE_WRONG_COUNT: {
             int32_t param_count = get_newtype_type(diagnostic->type_error.ctx, diagnostic->type_error.type).tags;
             fprintf(
-                stderr,
+                stream,
                 "expected %"PRIi32" %s, but provided %"PRIi32,
                 param_count,
                 param_count == 1 ? "type argument" : "type arguments",
@@ -262,171 +241,220 @@ void print_diagnostic(SourceLoc const *loc, Diagnostic const *diagnostic) {
             break;
         }
         case ERROR_INDEX_OPERAND: {
-            fprintf(stderr, "expected array or slice, but found ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, "expected array or slice, but found ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
             break;
         }
         case ERROR_UNDEFINED_TYPE_SCOPE: {
-            fprintf(stderr, "type ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
-            fprintf(stderr, " does not have such an item");
+            fprintf(stream, "type ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, " does not have such an item");
             break;
         }
         case ERROR_UNDEFINED_TYPE_FIELD: {
-            fprintf(stderr, "type ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
-            fprintf(stderr, " does not have such a field");
+            fprintf(stream, "type ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, " does not have such a field");
             break;
         }
         case ERROR_EXPECTED_VALUE_TYPE: {
-            fprintf(stderr, "expected ");
-            print_type(stderr, diagnostic->double_type_error.ctx, diagnostic->double_type_error.type1);
-            fprintf(stderr, ", but found ");
-            print_type(stderr, diagnostic->double_type_error.ctx, diagnostic->double_type_error.type2);
+            fprintf(stream, "expected ");
+            print_type(stream, diagnostic->double_type_error.ctx, diagnostic->double_type_error.type1);
+            fprintf(stream, ", but found ");
+            print_type(stream, diagnostic->double_type_error.ctx, diagnostic->double_type_error.type2);
             break;
         }
         case ERROR_EXPECTED_MUTABLE_PLACE: {
-            fprintf(stderr, "cannot assign to this expression");
+            fprintf(stream, "cannot assign to this expression");
             break;
         }
         case ERROR_CONST_INIT: {
-            fprintf(stderr, "initializer is not a constant expression");
+            fprintf(stream, "initializer is not a constant expression");
             break;
         }
         case ERROR_CONST_INT_OVERFLOW: {
-            fprintf(stderr, "integer overflow");
+            fprintf(stream, "integer overflow");
             break;
         }
         case ERROR_CONST_NEGATIVE_SHIFT: {
-            fprintf(stderr, "can't shift by a negative integer");
+            fprintf(stream, "can't shift by a negative integer");
             break;
         }
         case ERROR_TYPE_INFERENCE: {
-            fprintf(stderr, "can't infer type");
+            fprintf(stream, "can't infer type");
             break;
         }
         case ERROR_TYPE_UNKNOWN_TYPE_SIZE: {
-            fprintf(stderr, "type ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
-            fprintf(stderr, " has unknown size");
+            fprintf(stream, "type ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, " has unknown size");
             break;
         }
         case ERROR_TYPE_UNKNOWN_TYPE_ALIGNMENT: {
-            fprintf(stderr, "type ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
-            fprintf(stderr, " has unknown alignment requirements");
+            fprintf(stream, "type ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, " has unknown alignment requirements");
             break;
         }
         case ERROR_INDEX_UNKNOWN_TYPE_SIZE: {
-            fprintf(stderr, "cannot index array of type ");
-            print_type(stderr, diagnostic->type_error.ctx, diagnostic->type_error.type);
-            fprintf(stderr, " because it has unknown size at compile time");
+            fprintf(stream, "cannot index array of type ");
+            print_type(stream, diagnostic->type_error.ctx, diagnostic->type_error.type);
+            fprintf(stream, " because it has unknown size at compile time");
             break;
         }
         case ERROR_EMPTY_ARRAY: {
-            fprintf(stderr, "empty array");
+            fprintf(stream, "empty array");
             break;
         }
         case ERROR_EMPTY_STRUCT: {
-            fprintf(stderr, "empty struct");
+            fprintf(stream, "empty struct");
             break;
         }
         case ERROR_SWITCH_INCOMPATIBLE_CASES: {
-            fprintf(stderr, "switch arms have incompatible types");
+            fprintf(stream, "switch arms have incompatible types");
             break;
         }
         case ERROR_MISPLACED_BREAK: {
-            fprintf(stderr, "break outside of loop");
+            fprintf(stream, "break outside of loop");
             break;
         }
         case ERROR_MISPLACED_CONTINUE: {
-            fprintf(stderr, "continue outside of loop");
+            fprintf(stream, "continue outside of loop");
             break;
         }
         case ERROR_RETURN_MISSING_VALUE: {
-            fprintf(stderr, "returning no value from a function with return type");
+            fprintf(stream, "returning no value from a function with return type");
             break;
         }
         case ERROR_RETURN_EXPECTED_VALUE: {
-            fprintf(stderr, "returning value from a function with no return type");
+            fprintf(stream, "returning value from a function with no return type");
             break;
         }
         case ERROR_MISSING_RETURN: {
-            fprintf(stderr, "no value returned from function with return type");
+            fprintf(stream, "no value returned from function with return type");
             break;
         }
         case ERROR_MAIN_SIGNATURE: {
-            fprintf(stderr, "main function must take no arguments and return nothing");
+            fprintf(stream, "main function must take no arguments and return nothing");
             break;
         }
         case ERROR_LINEAR_ASSIGNMENT: {
-            fprintf(stderr, "cannot assign to linear type");
+            fprintf(stream, "cannot assign to linear type");
             break;
         }
         case ERROR_CONSUMED_VALUE_USED: {
-            fprintf(stderr, "use of consumed variable");
+            fprintf(stream, "use of consumed variable");
             break;
         }
         case ERROR_CONSUMED_IN_LOOP: {
-            fprintf(stderr, "variable is consumed in a loop");
+            fprintf(stream, "variable is consumed in a loop");
             break;
         }
         case ERROR_MOVE_BORROWED: {
-            fprintf(stderr, "cannot move a variable while it is borrowed");
+            fprintf(stream, "cannot move a variable while it is borrowed");
             break;
         }
         case ERROR_BORROWED_MUTABLE_SHARED: {
-            fprintf(stderr, "cannot have a mutable and shared reference at the same time");
+            fprintf(stream, "cannot have a mutable and shared reference at the same time");
             break;
         }
         case ERROR_MULTIBLE_MUTABLE_BORROWS: {
-            fprintf(stderr, "can only have one mutable reference at any given time");
+            fprintf(stream, "can only have one mutable reference at any given time");
             break;
         }
         case ERROR_DUPLICATE_SWITCH_CASE: {
-            fprintf(stderr, "duplicate switch case");
+            fprintf(stream, "duplicate switch case");
             break;
         }
         case ERROR_ELSE_CASE_UNREACHABLE: {
-            fprintf(stderr, "else case is unreachable");
+            fprintf(stream, "else case is unreachable");
             break;
         }
         case ERROR_SWITCH_NOT_EXHAUSTIVE: {
-            fprintf(stderr, "switch must cover all possible values");
+            fprintf(stream, "switch must cover all possible values");
             break;
         }
         case NOTE_REPLACE_LET_WITH_MUT: {
-            fprintf(stderr, "consider replacing `let` with `mut`");
+            fprintf(stream, "consider replacing `let` with `mut`");
             break;
         }
         case NOTE_PREVIOUS_DEFINITION: {
-            fprintf(stderr, "previous definition");
+            fprintf(stream, "previous definition");
             break;
         }
         case NOTE_PREVIOUS_BUILTIN_DEFINITION: {
-            fprintf(stderr, "a built-in with the name already exists");
+            fprintf(stream, "a built-in with the name already exists");
             break;
         }
         case NOTE_PRIVATE_DEFINITION: {
-            fprintf(stderr, "definition is private");
+            fprintf(stream, "definition is private");
             break;
         }
         case NOTE_FORGOT_IMPORT: {
-            fprintf(stderr, "did you forget to import module?");
+            fprintf(stream, "did you forget to import module?");
             break;
         }
         case NOTE_RECURSION: {
-            fprintf(stderr, "recursion happens here");
+            fprintf(stream, "recursion happens here");
             break;
         }
     }
+}
+
+void print_diagnostic(SourceLoc const *loc, Diagnostic const *diagnostic) {
+    if (diagnostic_handler) {
+#ifdef _OPENMP
+        omp_set_lock(&print_lock);
+#endif
+        diagnostic_handler(diagnostic_handler_data, loc, diagnostic);
+#ifdef _OPENMP
+        omp_unset_lock(&print_lock);
+#endif
+        return;
+    }
+
+    FILE *stream = thread_stream ? thread_stream : stderr;
+    SourceIndex line_start = loc->where;
+
+    while (line_start.index > 0 && loc->source.ptr[line_start.index - 1] != '\n') {
+        line_start.index--;
+    }
+
+    SourceIndex line_end = loc->where;
+
+    while (line_end.index < loc->source.len && loc->source.ptr[line_end.index] != '\n') {
+        line_end.index++;
+    }
+
+    int line_num = find_line_num(loc->source, line_start);
+    char const *color = "";
+
+    if (diagnostic->kind < ERROR_END) {
+        color = "\033[31;1m";
+    } else {
+        color = "\033[96;1m";
+    }
+
+#ifdef _OPENMP
+    omp_set_lock(&print_lock);
+#endif
+
+    fprintf(stream, "\033[0;1m%s:%d:%d: ", loc->path, line_num, (int) (loc->where.index - line_start.index + 1));
+    fprintf(stream, "\033[0m%s", color);
+
+    if (diagnostic->kind < ERROR_END) {
+        fprintf(stream, "error[E%04d]\033[0m: ", diagnostic->kind);
+    } else {
+        fprintf(stream, "note\033[0m: ");
+    }
 
-    fprintf(stderr, "\n");
-    int indent = fprintf(stderr, "%d | ", line_num);
-    fprintf(stderr, "%.*s\n%s", (int) (line_end.index - line_start.index), &loc->source.ptr[line_start.index], color);
+    print_diagnostic_message(stream, diagnostic);
+    fprintf(stream, "\n");
+    int indent = fprintf(stream, "%d | ", line_num);
+    fprintf(stream, "%.*s\n%s", (int) (line_end.index - line_start.index), &loc->source.ptr[line_start.index], color);
 
     for (int i = 0; i < indent; i++) {
-        fputc(' ', stderr);
+        fputc(' ', stream);
     }
 
     for (SourceIndex i = line_start; i.index < line_end.index; i.index++) {
@@ -438,10 +466,10 @@ void print_diagnostic(SourceLoc const *loc, Diagnostic const *diagnostic) {
             c = '~';
         }
 
-        fputc(c, stderr);
+        fputc(c, stream);
     }
 
-    fputs("\033[0m\n", stderr);
+    fputs("\033[0m\n", stream);
 
 #ifdef _OPENMP
     omp_unset_lock(&print_lock);
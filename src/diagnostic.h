@@ -4,6 +4,8 @@
 #include "fwd.h"
 #include "lex.h"
 
+#include <stdio.h>
+
 typedef struct {
     char const *path;
     String source;
@@ -33,5 +35,15 @@ typedef struct {
     };
 } Diagnostic;
 
+// Receives diagnostics from every thread, one at a time.
+typedef void (*DiagnosticHandler)(void *data, SourceLoc const *loc, Diagnostic const *diagnostic);
+
 void init_diagnostic_module(void);
+// Diagnostics printed by the calling thread go to `stream` instead of stderr,
+// or to stderr again if it is NULL.
+void redirect_diagnostics(FILE *stream);
+// While a handler is set, diagnostics are passed to it instead of being printed.
+void set_diagnostic_handler(DiagnosticHandler handler, void *data);
 void print_diagnostic(SourceLoc const *loc, Diagnostic const *diagnostic);
+// Prints the message of a diagnostic without its location or source line.
+void print_diagnostic_message(FILE *stream, Diagnostic const *diagnostic);
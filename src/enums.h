@@ -510,7 +510,10 @@ typedef enum {
 
     MIR_PARAM,
     MIR_ALLOC,
+    MIR_RET_SLOT,
     MIR_ASSIGN,
+    // removed by an optimization, generates nothing
+    MIR_NOP,
 
     // Value
 
@@ -519,11 +522,16 @@ typedef enum {
     MIR_STRING,
     MIR_NULL,
     MIR_TIR_VALUE,
+    MIR_CONSTANT,
+    // tir_value is a function, called through its copy numbered raw.right
+    MIR_CLONE,
 
     // Pointer operator
 
     MIR_ADDRESS,
     MIR_DEREF,
+    // unary is the place to read from
+    MIR_LOAD,
 
     // Arithmetic operator
 
@@ -531,6 +539,8 @@ typedef enum {
     MIR_ADD,
     MIR_SUB,
     MIR_MUL,
+    // high half of the double-width product
+    MIR_MULHI,
     MIR_DIV,
     MIR_MOD,
 
@@ -552,6 +562,11 @@ typedef enum {
     MIR_LE,
     MIR_GE,
 
+    // Conditional
+
+    // operand is the condition, index points to the true and false values in extra
+    MIR_SELECT,
+
     // Cast
 
     MIR_ITOF,
@@ -570,6 +585,8 @@ typedef enum {
     MIR_CONST_INDEX,
     MIR_SLICE_INDEX,
     MIR_ACCESS,
+    // traps unless 0 <= left < right
+    MIR_BOUNDS_CHECK,
 
     // Control flow
 
@@ -0,0 +1,370 @@
+#include "front-end.h"
+
+#include "adt.h"
+#include "arena.h"
+#include "diagnostic.h"
+#include "fwd.h"
+#include "hash.h"
+#include "lex.h"
+#include "print.h"
+#include "role-analysis.h"
+#include "tir-analysis.h"
+#include "type-analysis.h"
+#include "data/ast.h"
+#include "data/tir.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct {
+    char **paths;
+    String *sources;
+    Ast *asts;
+    File *files;
+    Module *modules;
+    HashTable *global_scope;
+    HashTable *extern_symbols;
+    AstRefVec *ast_refs;
+    DefVec *functions;
+} GlobalScopeBuilder;
+
+static SourceLoc get_ast_location(GlobalScopeBuilder *b, AstRef def) {
+    SourceIndex token = get_ast_token(def.node, &b->asts[def.file]);
+    String name = id_token_to_string(b->sources[def.file], token);
+    return (SourceLoc) {
+        .path = b->paths[def.file],
+        .source = b->sources[def.file],
+        .where = token,
+        .len = name.len,
+        .mark = token,
+    };
+}
+
+static String get_string_from_location(SourceLoc const *loc) {
+    return substring(loc->source, loc->where.index, loc->where.index + loc->len);
+}
+
+static Symbol lookup(GlobalScopeBuilder *b, int32_t file, String name) {
+    uint32_t *file_def = htable_lookup(&b->files[file].scope, name);
+    if (file_def) {
+        return (Symbol) {.kind = SYM_GLOBAL, .global = {*file_def}};
+    }
+
+    int32_t module = b->files[file].module;
+
+    uint32_t *private_def = htable_lookup(&b->modules[module].private_scope, name);
+    if (private_def) {
+        return (Symbol) {.kind = SYM_GLOBAL, .global = {*private_def}};
+    }
+
+    uint32_t *public_def = htable_lookup(&b->modules[module].public_scope, name);
+    if (public_def) {
+        return (Symbol) {.kind = SYM_GLOBAL, .global = {*public_def}};
+    }
+
+    uint32_t *builtin_def = htable_lookup(b->global_scope, name);
+    if (builtin_def) {
+        return (Symbol) {.kind = SYM_BUILTIN, .global = {*builtin_def}};
+    }
+
+    return (Symbol) {0};
+}
+
+static int add_global(GlobalScopeBuilder *b, AstRef def) {
+    int32_t module = b->files[def.file].module;
+    Ast *ast = &b->asts[def.file];
+    HashTable *scope = &b->modules[module].private_scope;
+    if (get_ast_tag(def.node, ast) == AST_PUBLIC) {
+        scope = &b->modules[module].public_scope;
+        def.node = get_ast_unary(def.node, ast);
+    }
+
+    bool is_extern = false;
+    bool is_function = false;
+    switch (get_ast_tag(def.node, ast)) {
+        case AST_IMPORT: {
+            scope = &b->files[def.file].scope;
+            break;
+        }
+        case AST_FUNCTION: {
+            is_function = true;
+            break;
+        }
+        case AST_STRUCT:
+        case AST_ENUM:
+        case AST_NEWTYPE:
+        case AST_CONST: {
+            break;
+        }
+        case AST_EXTERN_FUNCTION:
+        case AST_EXTERN_MUT: {
+            is_extern = true;
+            break;
+        }
+        default: {
+            return 0;
+        }
+    }
+
+    SourceLoc loc = get_ast_location(b, def);
+    String name = get_string_from_location(&loc);
+
+    uint32_t *prev_extern_sym = is_extern ? htable_lookup(b->extern_symbols, name) : NULL;
+    if (prev_extern_sym) {
+        print_diagnostic(&loc, &(Diagnostic) {.kind = ERROR_MULTIPLE_EXTERN_DEFINITION});
+        AstRef prev_ref = b->ast_refs->ptr[*prev_extern_sym];
+        SourceLoc prev_loc = get_ast_location(b, prev_ref);
+        print_diagnostic(&prev_loc, &(Diagnostic) {.kind = NOTE_PREVIOUS_DEFINITION});
+        return 1;
+    }
+
+    Symbol prev_sym = lookup(b, def.file, name);
+    if (prev_sym.kind != SYM_UNDEFINED) {
+        print_diagnostic(&loc, &(Diagnostic) {.kind = ERROR_MULTIPLE_DEFINITION});
+        if (prev_sym.kind == SYM_GLOBAL) {
+            AstRef prev_ref = b->ast_refs->ptr[prev_sym.global.id];
+            SourceLoc prev_loc = get_ast_location(b, prev_ref);
+            print_diagnostic(&prev_loc, &(Diagnostic) {.kind = NOTE_PREVIOUS_DEFINITION});
+        } else {
+            print_diagnostic(&loc, &(Diagnostic) {.kind = NOTE_PREVIOUS_BUILTIN_DEFINITION});
+        }
+        return 1;
+    }
+
+    int32_t entry = b->ast_refs->len;
+    vec_push(b->ast_refs, def);
+    htable_try_insert(scope, name, entry);
+    if (is_extern) {
+        htable_try_insert(b->extern_symbols, name, entry);
+    }
+    if (is_function) {
+        vec_push(b->functions, (DefId) {entry});
+    }
+    return 0;
+}
+
+int analyze_front_end(FrontEnd *front, Options *options, Arena *permanent, Arena scratch) {
+    int file_count = front->file_count;
+    Ast *asts = front->asts;
+
+    front->files = arena_alloc(permanent, File, file_count);
+    front->module_table = htable_init();
+    for (int32_t i = 0; i < file_count; i++) {
+        SourceIndex module_token = get_ast_token(null_ast, &asts[i]);
+        String module_name = id_token_to_string(front->sources[i], module_token);
+        int32_t new_module = front->module_table.count;
+        int64_t module = htable_try_insert(&front->module_table, module_name, new_module);
+        if (module < 0) {
+            module = new_module;
+        }
+        front->files[i].module = module;
+        front->files[i].scope = htable_init();
+    }
+
+    front->modules = arena_alloc(permanent, Module, front->module_table.count);
+    for (int32_t i = 0; i < (int32_t) front->module_table.count; i++) {
+        front->modules[i].public_scope = htable_init();
+        front->modules[i].private_scope = htable_init();
+    }
+
+    HashTable *global_scope = &front->global_scope;
+    *global_scope = htable_init();
+    #define TYPE(type) htable_try_insert(global_scope, (String) Str(#type), BUILTIN_##type);
+    #include "simple-types"
+    htable_try_insert(global_scope, (String) Str("`Size"), BUILTIN_SIZE_TAG);
+    htable_try_insert(global_scope, (String) Str("`Alignment"), BUILTIN_ALIGNMENT_TAG);
+    htable_try_insert(global_scope, (String) Str("`align_of"), BUILTIN_ALIGNOF);
+    htable_try_insert(global_scope, (String) Str("`size_of"), BUILTIN_SIZEOF);
+    htable_try_insert(global_scope, (String) Str("`zero_extend"), BUILTIN_ZERO_EXTEND);
+    htable_try_insert(global_scope, (String) Str("`slice"), BUILTIN_SLICE);
+    htable_try_insert(global_scope, (String) Str("`Affine"), BUILTIN_AFFINE);
+    htable_try_insert(global_scope, (String) Str("`ArrayLength"), BUILTIN_ARRAY_LENGTH_TYPE);
+
+    front->ast_refs = (AstRefVec) {0};
+    front->functions = (DefVec) {0};
+    {
+        HashTable extern_symbols = htable_init();
+        GlobalScopeBuilder b = {0};
+        b.paths = front->paths;
+        b.sources = front->sources;
+        b.asts = asts;
+        b.files = front->files;
+        b.modules = front->modules;
+        b.global_scope = global_scope;
+        b.extern_symbols = &extern_symbols;
+        b.ast_refs = &front->ast_refs;
+        b.functions = &front->functions;
+        for (int32_t i = 0; i < file_count; i++) {
+            AstList list = get_ast_list(null_ast, &asts[i]);
+            for (int32_t j = 0; j < list.count; j++) {
+                add_global(&b, (AstRef) {list.nodes[j], i});
+            }
+        }
+        htable_free(&extern_symbols);
+    }
+
+    // The RIR and the output of role analysis are only read by type analysis.
+    front->rir_memory = new_arena(64 << 20);
+    Arena rir_arena = front->rir_memory;
+    front->rirs = arena_alloc(&rir_arena, Rir, file_count);
+    for (int32_t i = 0; i < file_count; i++) {
+        front->rirs[i].tags = arena_alloc(&rir_arena, unsigned char, asts[i].nodes.len);
+        front->rirs[i].data = arena_alloc(&rir_arena, int32_t, asts[i].nodes.len);
+    }
+
+    RirTopInput rir_input = {0};
+    rir_input.file_count = file_count;
+    rir_input.paths = front->paths;
+    rir_input.sources = front->sources;
+    rir_input.asts = asts;
+    rir_input.files = front->files;
+    rir_input.module_table = &front->module_table;
+    rir_input.modules = front->modules;
+    rir_input.global_scope = global_scope;
+    rir_input.rirs = front->rirs;
+    rir_input.ast_refs = front->ast_refs.ptr;
+    rir_input.def_count = front->ast_refs.len;
+    rir_input.functions = front->functions.ptr;
+    rir_input.function_count = front->functions.len;
+    front->rir_output = analyze_roles(&rir_input, &rir_arena, scratch);
+
+    TirInput tir_input = {0};
+    tir_input.options = options;
+    tir_input.paths = front->paths;
+    tir_input.sources = front->sources;
+    tir_input.asts = asts;
+    tir_input.files = front->files;
+    tir_input.module_table = &front->module_table;
+    tir_input.modules = front->modules;
+    tir_input.global_scope = global_scope;
+    tir_input.ast_refs = front->ast_refs.ptr;
+    tir_input.def_count = front->ast_refs.len;
+    tir_input.order_count = front->rir_output.count;
+    tir_input.local_ast_refs = front->rir_output.local_ast_refs;
+    tir_input.order = front->rir_output.order;
+    tir_input.rirs = front->rirs;
+    tir_input.functions = front->functions.ptr;
+    tir_input.function_count = front->functions.len;
+    front->tir_output = analyze_types(&tir_input, permanent, scratch);
+    TirOutput *tir_output = &front->tir_output;
+    if (front->rir_output.error || tir_output->error) {
+        return -1;
+    }
+    if (options->print_debug) {
+        for (int32_t i = 0; i < tir_output->declarations.functions.len; i++) {
+            if (!tir_output->insts[i].first.id) {
+                continue;
+            }
+            TirContext ctx = {
+                .global = &tir_output->global_deps,
+                .thread = &tir_output->insts[i],
+            };
+            int32_t name = get_value_data(ctx, tir_output->declarations.functions.ptr[i])->index;
+            print_tir(ctx, &ctx.global->strtab.ptr[name], &tir_output->insts[i].insts, tir_output->insts[i].first);
+        }
+    }
+    return check_substructural_types(
+        &(SubstructuralAnalysisInput) {
+            .paths = front->paths,
+            .sources = front->sources,
+            .asts = asts,
+            .ast_refs = front->ast_refs.ptr,
+            .global_deps = &tir_output->global_deps,
+            .insts = tir_output->insts,
+            .functions = front->functions.ptr,
+            .function_count = front->functions.len,
+        },
+        scratch
+    );
+}
+
+bool *find_used_files(FrontEnd *front, Arena *arena, Arena scratch) {
+    int32_t module_count = front->module_table.count;
+    bool *used_files = arena_alloc(arena, bool, front->file_count);
+    bool *used_modules = arena_alloc(&scratch, bool, module_count);
+    int32_t *worklist = arena_alloc(&scratch, int32_t, module_count);
+    int32_t count = 0;
+
+    Declarations *declarations = &front->tir_output.declarations;
+    for (int32_t i = 0; i < declarations->functions.len; i++) {
+        if (declarations->main.id && declarations->functions.ptr[i].id == declarations->main.id) {
+            int32_t file = front->ast_refs.ptr[front->functions.ptr[i].id].file;
+            used_modules[front->files[file].module] = true;
+            worklist[count++] = front->files[file].module;
+        }
+    }
+
+    if (!count) {
+        for (int32_t i = 0; i < module_count; i++) {
+            used_modules[i] = true;
+            worklist[count++] = i;
+        }
+    }
+
+    for (int32_t next = 0; next < count; next++) {
+        int32_t module = worklist[next];
+
+        for (int32_t i = 0; i < front->file_count; i++) {
+            if (front->files[i].module != module) {
+                continue;
+            }
+
+            used_files[i] = true;
+            Ast *ast = &front->asts[i];
+            AstList list = get_ast_list(null_ast, ast);
+
+            for (int32_t j = 0; j < list.count; j++) {
+                AstId node = list.nodes[j];
+                if (get_ast_tag(node, ast) == AST_PUBLIC) {
+                    node = get_ast_unary(node, ast);
+                }
+                if (get_ast_tag(node, ast) != AST_IMPORT) {
+                    continue;
+                }
+
+                String name = id_token_to_string(front->sources[i], get_ast_token(node, ast));
+                uint32_t *imported = htable_lookup(&front->module_table, name);
+                if (imported && !used_modules[*imported]) {
+                    used_modules[*imported] = true;
+                    worklist[count++] = *imported;
+                }
+            }
+        }
+    }
+
+    return used_files;
+}
+
+void free_scopes(FrontEnd *front) {
+    for (int32_t i = 0; i < front->file_count; i++) {
+        if (front->rir_output.local_ast_refs) {
+            free(front->rir_output.local_ast_refs[i].ptr);
+        }
+        htable_free(&front->files[i].scope);
+    }
+    for (int32_t i = 0; i < (int32_t) front->module_table.count; i++) {
+        htable_free(&front->modules[i].public_scope);
+        htable_free(&front->modules[i].private_scope);
+    }
+    htable_free(&front->module_table);
+    htable_free(&front->global_scope);
+    free(front->ast_refs.ptr);
+    free(front->functions.ptr);
+    delete_arena(&front->rir_memory);
+    front->rirs = NULL;
+    front->rir_output = (RirTopOutput) {0};
+}
+
+void free_types(FrontEnd *front) {
+    TirOutput *tir_output = &front->tir_output;
+    for (int32_t i = 0; i < tir_output->declarations.functions.len; i++) {
+        free_tir_insts(&tir_output->insts[i].insts);
+        free_tir_deps(&tir_output->insts[i].deps);
+    }
+    free_tir_deps(&tir_output->global_deps);
+    free(tir_output->declarations.structs.ptr);
+    free(tir_output->declarations.extern_vars.ptr);
+    free(tir_output->declarations.extern_functions.ptr);
+    free(tir_output->declarations.functions.ptr);
+    *tir_output = (TirOutput) {0};
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "arena.h"
+#include "fwd.h"
+#include "hash.h"
+#include "role-analysis.h"
+#include "type-analysis.h"
+#include "data/ast.h"
+#include "data/rir.h"
+
+// Everything name resolution and type checking produce for a set of parsed
+// files. The RIR and the scopes are only needed until type checking is done.
+typedef struct {
+    int file_count;
+    char **paths;
+    String *sources;
+    Ast *asts;
+
+    File *files;
+    HashTable module_table;
+    Module *modules;
+    HashTable global_scope;
+    AstRefVec ast_refs;
+    DefVec functions;
+
+    Arena rir_memory;
+    Rir *rirs;
+    RirTopOutput rir_output;
+    TirOutput tir_output;
+} FrontEnd;
+
+// Builds the scopes and runs role, type and substructural analysis on the
+// parsed files in `front`. Returns nonzero if an error was reported.
+int analyze_front_end(FrontEnd *front, Options *options, Arena *permanent, Arena scratch);
+// Marks the files whose definitions can reach the output: those of the module
+// that defines main and of every module it imports, transitively. Without a
+// main, every file is used. Must be called before free_scopes.
+bool *find_used_files(FrontEnd *front, Arena *arena, Arena scratch);
+// Frees the scopes, the RIR and the output of role analysis.
+void free_scopes(FrontEnd *front);
+// Frees the TIR of every function and the global TIR dependencies.
+void free_types(FrontEnd *front);
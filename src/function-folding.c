@@ -0,0 +1,438 @@
+#include "function-folding.h"
+
+#include "adt.h"
+#include "arena.h"
+#include "data/mir.h"
+#include "data/tir.h"
+#include "fwd.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Functions are referred to by their index into `functions`, which is sorted
+// so that the copies of a function follow it.
+
+#define SELF -2
+
+typedef struct {
+    MirAnalysisInput *input;
+    Mir *mir;
+    MirFunction *functions;
+    int32_t function_count;
+    // Indexed by global value id, the function itself rather than a copy, or -1.
+    int32_t *positions;
+    // Per function, the function it was merged into, or -1.
+    int32_t *merged_into;
+    bool *address_taken;
+    bool *is_callee;
+    uint64_t *hashes;
+} Folding;
+
+static TirContext get_function_ctx(Folding *f, int32_t function) {
+    return (TirContext) {f->input->global_deps, &f->input->insts[f->functions[function].tir]};
+}
+
+static ValueId get_function_value(Folding *f, int32_t function) {
+    return f->input->functions[f->functions[function].tir];
+}
+
+static bool is_main(Folding *f, int32_t function) {
+    return get_function_value(f, function).id == f->input->main.id;
+}
+
+// The function an operand refers to, or -1.
+static int32_t get_referenced_function(Folding *f, MirId mir_id) {
+    MirTag tag = get_mir_tag(f->mir, mir_id);
+
+    if (tag != MIR_TIR_VALUE && tag != MIR_CLONE) {
+        return -1;
+    }
+
+    ValueId value = get_mir_tir_value(f->mir, mir_id);
+    TirContext ctx = {f->input->global_deps, NULL};
+
+    if (value.id >= f->input->global_deps->values.values.len || get_value_tag(ctx, value) != VAL_FUNCTION) {
+        return -1;
+    }
+
+    int32_t function = f->positions[value.id];
+    int32_t clone = tag == MIR_CLONE ? get_mir_clone(f->mir, mir_id) : 0;
+
+    for (int32_t i = function; i < f->function_count && f->functions[i].tir == f->functions[function].tir; i++) {
+        if (f->functions[i].clone == clone) {
+            return i;
+        }
+    }
+
+    abort();
+}
+
+static void find_address_taken(Folding *f) {
+    memset(f->address_taken, 0, f->function_count * sizeof(bool));
+
+    for (int32_t function = 0; function < f->function_count; function++) {
+        if (f->merged_into[function] >= 0) {
+            continue;
+        }
+
+        for (int32_t i = f->functions[function].start; i < f->functions[function].end; i++) {
+            if (get_mir_tag(f->mir, (MirId) {i}) == MIR_CALL) {
+                f->is_callee[get_mir_access(f->mir, (MirId) {i}).operand.private_field_id] = true;
+            }
+        }
+
+        for (int32_t i = f->functions[function].start; i < f->functions[function].end; i++) {
+            int32_t referenced = get_referenced_function(f, (MirId) {i});
+
+            if (referenced >= 0 && !f->is_callee[i]) {
+                f->address_taken[referenced] = true;
+            }
+        }
+    }
+}
+
+static uint64_t hash_function(Folding *f, int32_t function) {
+    MirFunction mir_function = f->functions[function];
+    uint64_t hash = 14695981039346656037ull;
+
+    for (int32_t i = mir_function.start; i < mir_function.end; i++) {
+        hash = (hash ^ get_mir_tag(f->mir, (MirId) {i})) * 1099511628211ull;
+    }
+
+    return (hash ^ (uint64_t) (mir_function.end - mir_function.start)) * 1099511628211ull;
+}
+
+static bool same_operand(Folding *f, int32_t a, MirId x, int32_t b, MirId y) {
+    return x.private_field_id - f->functions[a].start == y.private_field_id - f->functions[b].start;
+}
+
+static bool same_extra(Folding *f, int32_t a, int32_t x_index, int32_t b, int32_t y_index) {
+    int32_t x = get_mir_extra(f->mir, x_index);
+    int32_t y = get_mir_extra(f->mir, y_index);
+
+    if (x < 0 || y < 0) {
+        return x == y;
+    }
+
+    return same_operand(f, a, (MirId) {x}, b, (MirId) {y});
+}
+
+// Strings are prefixed with their length in four bytes.
+static bool same_string(char const *a, char const *b) {
+    uint32_t length = 0;
+
+    for (int32_t i = 0; i < 4; i++) {
+        length |= (uint32_t) (unsigned char) a[i] << (8 * i);
+    }
+
+    return memcmp(a, b, 4) == 0 && memcmp(a + 4, b + 4, length) == 0;
+}
+
+// Values local to a function are compared by their contents.
+static bool same_value(Folding *f, int32_t a, ValueId x, int32_t b, ValueId y) {
+    int32_t global_count = f->input->global_deps->values.values.len;
+
+    if (x.id < global_count || y.id < global_count) {
+        return x.id == y.id;
+    }
+
+    TirContext a_ctx = get_function_ctx(f, a);
+    TirContext b_ctx = get_function_ctx(f, b);
+    ValueTag tag = get_value_tag(a_ctx, x);
+
+    if (tag != get_value_tag(b_ctx, y) || !types_equal(a_ctx, get_value_type(a_ctx, x), b_ctx, get_value_type(b_ctx, y))) {
+        return false;
+    }
+
+    switch (tag) {
+        case VAL_CONST_INT: return get_value_int(a_ctx, x) == get_value_int(b_ctx, y);
+        case VAL_CONST_NULL: return true;
+        case VAL_STRING: return same_string(get_value_str(a_ctx, x), get_value_str(b_ctx, y));
+        case VAL_CONST_FLOAT: {
+            double x_float = get_value_float(a_ctx, x);
+            double y_float = get_value_float(b_ctx, y);
+            return memcmp(&x_float, &y_float, sizeof(double)) == 0;
+        }
+        default: return false;
+    }
+}
+
+// A recursive call matches a recursive call of the other function.
+static bool same_tir_value(Folding *f, int32_t a, MirId x, int32_t b, MirId y) {
+    int32_t x_function = get_referenced_function(f, x);
+    int32_t y_function = get_referenced_function(f, y);
+
+    if (x_function < 0 && y_function < 0) {
+        return get_mir_tag(f->mir, x) == MIR_TIR_VALUE
+            && same_value(f, a, get_mir_tir_value(f->mir, x), b, get_mir_tir_value(f->mir, y));
+    }
+
+    x_function = x_function == a ? SELF : x_function;
+    y_function = y_function == b ? SELF : y_function;
+    return x_function == y_function;
+}
+
+static bool same_instruction(Folding *f, int32_t a, int32_t b, int32_t offset) {
+    Mir *mir = f->mir;
+    MirId x = {f->functions[a].start + offset};
+    MirId y = {f->functions[b].start + offset};
+    MirTag tag = get_mir_tag(mir, x);
+    TirContext a_ctx = get_function_ctx(f, a);
+    TirContext b_ctx = get_function_ctx(f, b);
+
+    if (tag != get_mir_tag(mir, y) || !types_equal(a_ctx, get_mir_type(mir, x), b_ctx, get_mir_type(mir, y))) {
+        return false;
+    }
+
+    MirData *x_data = &mir->mir.datas[x.private_field_id];
+    MirData *y_data = &mir->mir.datas[y.private_field_id];
+
+    switch (tag) {
+        case MIR_ASSIGN:
+        case MIR_ADD:
+        case MIR_SUB:
+        case MIR_MUL:
+        case MIR_MULHI:
+        case MIR_DIV:
+        case MIR_MOD:
+        case MIR_AND:
+        case MIR_OR:
+        case MIR_XOR:
+        case MIR_SHL:
+        case MIR_SHR:
+        case MIR_EQ:
+        case MIR_NE:
+        case MIR_LT:
+        case MIR_GT:
+        case MIR_LE:
+        case MIR_GE:
+        case MIR_NEW_SLICE:
+        case MIR_INDEX:
+        case MIR_SLICE_INDEX:
+        case MIR_BOUNDS_CHECK: {
+            return same_operand(f, a, x_data->binary.left, b, y_data->binary.left)
+                && same_operand(f, a, x_data->binary.right, b, y_data->binary.right);
+        }
+        case MIR_ADDRESS:
+        case MIR_DEREF:
+        case MIR_LOAD:
+        case MIR_MINUS:
+        case MIR_NOT:
+        case MIR_RET: {
+            return same_operand(f, a, x_data->unary, b, y_data->unary);
+        }
+        case MIR_ITOF:
+        case MIR_ITRUNC:
+        case MIR_SEXT:
+        case MIR_ZEXT:
+        case MIR_FTOI:
+        case MIR_FTRUNC:
+        case MIR_FEXT:
+        case MIR_PTR_CAST: {
+            TypeId x_type = {x_data->mir_const.index};
+            TypeId y_type = {y_data->mir_const.index};
+            return same_operand(f, a, x_data->mir_const.operand, b, y_data->mir_const.operand)
+                && types_equal(a_ctx, x_type, b_ctx, y_type);
+        }
+        case MIR_CONST_INDEX:
+        case MIR_ACCESS:
+        case MIR_BR_IF:
+        case MIR_BR_IF_NOT: {
+            return same_operand(f, a, x_data->mir_const.operand, b, y_data->mir_const.operand)
+                && x_data->mir_const.index == y_data->mir_const.index;
+        }
+        case MIR_BR: {
+            return x_data->mir_const.index == y_data->mir_const.index;
+        }
+        case MIR_SELECT: {
+            return same_operand(f, a, x_data->mir_const.operand, b, y_data->mir_const.operand)
+                && same_extra(f, a, x_data->mir_const.index, b, y_data->mir_const.index)
+                && same_extra(f, a, x_data->mir_const.index + 1, b, y_data->mir_const.index + 1);
+        }
+        case MIR_CALL: {
+            int32_t arg_count = get_function_type(a_ctx, x_data->type).param_count;
+
+            if (!same_operand(f, a, x_data->mir_const.operand, b, y_data->mir_const.operand)) {
+                return false;
+            }
+
+            // The arguments are followed by the destination.
+            for (int32_t i = 0; i <= arg_count; i++) {
+                if (!same_extra(f, a, x_data->mir_const.index + i, b, y_data->mir_const.index + i)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case MIR_INT:
+        case MIR_FLOAT: {
+            return x_data->raw.left == y_data->raw.left && x_data->raw.right == y_data->raw.right;
+        }
+        case MIR_STRING: {
+            return same_value(f, a, x_data->tir_value, b, y_data->tir_value);
+        }
+        case MIR_TIR_VALUE:
+        case MIR_CLONE: {
+            return same_tir_value(f, a, x, b, y);
+        }
+        case MIR_NOP:
+        case MIR_PARAM:
+        case MIR_ALLOC:
+        case MIR_RET_SLOT:
+        case MIR_NULL:
+        case MIR_RET_VOID: {
+            return true;
+        }
+        case MIR_CONSTANT: {
+            return false;
+        }
+    }
+    abort();
+}
+
+static bool same_function(Folding *f, int32_t a, int32_t b) {
+    MirFunction x = f->functions[a];
+    MirFunction y = f->functions[b];
+
+    if (f->hashes[a] != f->hashes[b] || x.end - x.start != y.end - y.start) {
+        return false;
+    }
+
+    TirContext a_ctx = get_function_ctx(f, a);
+    TirContext b_ctx = get_function_ctx(f, b);
+    TypeId x_type = get_value_type(a_ctx, get_function_value(f, a));
+    TypeId y_type = get_value_type(b_ctx, get_function_value(f, b));
+
+    if (!types_equal(a_ctx, x_type, b_ctx, y_type)) {
+        return false;
+    }
+
+    for (int32_t i = 0; i < x.end - x.start; i++) {
+        if (!same_instruction(f, a, b, i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Points every reference to a merged function at the function it was merged
+// into, in one pass over the functions that are kept.
+static void redirect_calls(Folding *f) {
+    for (int32_t function = 0; function < f->function_count; function++) {
+        if (f->merged_into[function] >= 0) {
+            continue;
+        }
+
+        for (int32_t i = f->functions[function].start; i < f->functions[function].end; i++) {
+            int32_t referenced = get_referenced_function(f, (MirId) {i});
+
+            if (referenced < 0 || f->merged_into[referenced] < 0) {
+                continue;
+            }
+
+            int32_t to = f->merged_into[referenced];
+            int32_t clone = f->functions[to].clone;
+            f->mir->mir.tags[i] = clone ? MIR_CLONE : MIR_TIR_VALUE;
+            f->mir->mir.datas[i].raw.left = get_function_value(f, to).id;
+            f->mir->mir.datas[i].raw.right = clone;
+        }
+    }
+}
+
+typedef struct {
+    uint64_t hash;
+    int32_t function;
+} HashedFunction;
+
+static int compare_hashed_functions(void const *a, void const *b) {
+    HashedFunction const *left = a;
+    HashedFunction const *right = b;
+
+    if (left->hash != right->hash) {
+        return left->hash < right->hash ? -1 : 1;
+    }
+
+    return left->function - right->function;
+}
+
+int32_t fold_identical_functions(MirAnalysisInput *input, Mir *mir, MirFunction *functions, int32_t function_count, Arena scratch) {
+    int32_t value_count = input->global_deps->values.values.len;
+    Folding f = {
+        .input = input,
+        .mir = mir,
+        .functions = functions,
+        .function_count = function_count,
+        .positions = arena_alloc(&scratch, int32_t, value_count),
+        .merged_into = arena_alloc(&scratch, int32_t, function_count),
+        .address_taken = arena_alloc(&scratch, bool, function_count),
+        .is_callee = arena_alloc(&scratch, bool, mir->mir.len),
+        .hashes = arena_alloc(&scratch, uint64_t, function_count),
+    };
+    HashedFunction *buckets = arena_alloc(&scratch, HashedFunction, function_count);
+
+    memset(f.positions, 0xff, value_count * sizeof(int32_t));
+    memset(f.merged_into, 0xff, function_count * sizeof(int32_t));
+
+    for (int32_t i = function_count - 1; i >= 0; i--) {
+        f.positions[get_function_value(&f, i).id] = i;
+    }
+
+    // Merging two functions can make their callers identical, so this repeats
+    // until a round merges nothing. Only functions with the same hash are
+    // compared, and within a bucket a function is merged into the first
+    // function before it that it matches.
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+        find_address_taken(&f);
+        int32_t live_count = 0;
+
+        for (int32_t i = 0; i < function_count; i++) {
+            if (f.merged_into[i] < 0) {
+                f.hashes[i] = hash_function(&f, i);
+                buckets[live_count++] = (HashedFunction) {f.hashes[i], i};
+            }
+        }
+
+        qsort(buckets, live_count, sizeof(HashedFunction), compare_hashed_functions);
+
+        for (int32_t start = 0, end; start < live_count; start = end) {
+            for (end = start + 1; end < live_count && buckets[end].hash == buckets[start].hash; end++) {}
+
+            for (int32_t k = start + 1; k < end; k++) {
+                int32_t i = buckets[k].function;
+
+                if (f.address_taken[i] || is_main(&f, i)) {
+                    continue;
+                }
+
+                for (int32_t l = start; l < k; l++) {
+                    int32_t j = buckets[l].function;
+
+                    if (f.merged_into[j] < 0 && !is_main(&f, j) && same_function(&f, j, i)) {
+                        f.merged_into[i] = j;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (changed) {
+            redirect_calls(&f);
+        }
+    }
+
+    int32_t count = 0;
+
+    for (int32_t i = 0; i < function_count; i++) {
+        if (f.merged_into[i] < 0) {
+            functions[count++] = functions[i];
+        }
+    }
+
+    return count;
+}
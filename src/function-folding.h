@@ -0,0 +1,11 @@
+#pragma once
+
+#include "arena.h"
+#include "data/mir.h"
+#include "tir2mir.h"
+
+// Merges functions whose MIR and signature are identical, redirecting the calls
+// of the removed copies to the function that is kept. Functions whose address
+// is taken are kept, since their pointers may be compared. Returns the new
+// function count.
+int32_t fold_identical_functions(MirAnalysisInput *input, Mir *mir, MirFunction *functions, int32_t function_count, Arena scratch);
@@ -6,10 +6,31 @@
 
 #include <stdint.h>
 
+// What the LLVM backend tells LLVM about the machine. NULL fields are left to
+// LLVM's defaults.
+typedef struct {
+    char const *triple;
+    char const *cpu;
+    char const *features;
+} TargetMachine;
+
 typedef struct {
     Backend backend;
     Target target;
+    TargetMachine machine;
     bool print_debug;
+    bool lazy;
+    bool bounds_check;
+    bool verify_determinism;
+    bool language_server;
+    bool ir_stats;
+    char const *profile;
+    // Where to write the source files of the output as a Makefile rule.
+    char const *depfile;
+    // Compile only the functions of shard `shard` of `shard_count`.
+    int32_t shard;
+    int32_t shard_count;
+    int32_t merge_shard_count;
 } Options;
 
 typedef struct {
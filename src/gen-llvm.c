@@ -7,17 +7,50 @@
 #include "fwd.h"
 
 #include <stdlib.h>
+#include <string.h>
+
+#define MAX_MEMORY_VALUES 64
+
+typedef struct {
+    MirId mir_id;
+    LocalTir *thread;
+} Constant;
+
+// A value known to be in memory at a place in the current block.
+typedef struct {
+    MirId place;
+    TypeId type;
+    int32_t root;
+    int32_t tmp;
+} MemoryValue;
 
 typedef struct {
     Mir *mir;
     int32_t mir_start;
+    int32_t mir_end;
     Arena scratch;
     int32_t *temporaries;
+    MirRange *alloc_ranges;
+    // Allocations whose lifetime ends before an instruction, as linked lists.
+    int32_t *lifetime_ends;
+    int32_t *next_lifetime_end;
+    // Local storage whose address is visible outside of its own places.
+    bool *escaped;
+    bool has_escaped_storage;
+    // Indexed by global value id, functions that can be called from outside
+    // or through a pointer, which keep the C calling convention.
+    bool *escaping_functions;
+    Vec(MemoryValue) memory_values;
     Vec(char const *) strings;
+    Vec(Constant) constants;
+    // Appended to the names of strings and constants, so that shards can be
+    // merged.
+    char const *global_suffix;
     int32_t tmp_count;
     int32_t blocks;
     TypeId return_type;
     bool is_main;
+    bool has_attributes;
     Target target;
     TirContext tir;
     FILE *stream;
@@ -99,11 +132,21 @@ static void gen_type(GenContext *ctx, TypeId type) {
     abort();
 }
 
+// Slices are two registers wide and are passed and returned by value.
+static bool is_passed_by_ptr(GenContext *ctx, TypeId type) {
+    if (!is_aggregate_type(ctx->tir, type)) {
+        return false;
+    }
+
+    TypeTag tag = get_type_tag(ctx->tir, remove_tags(ctx->tir, type));
+    return tag != TYPE_MULTIPTR && tag != TYPE_MULTIPTR_MUT;
+}
+
 static void gen_params(GenContext *ctx, TypeId type) {
     fprintf(ctx->stream, "(");
     FunctionType func_type = get_function_type(ctx->tir, type);
 
-    if (func_type.ret.id != TYPE_VOID && is_aggregate_type(ctx->tir, func_type.ret)) {
+    if (func_type.ret.id != TYPE_VOID && is_passed_by_ptr(ctx, func_type.ret)) {
         fprintf(ctx->stream, "ptr");
         ctx->tmp_count++;
         if (func_type.param_count != 0) {
@@ -117,7 +160,7 @@ static void gen_params(GenContext *ctx, TypeId type) {
         }
 
         TypeId param_type = get_function_type_param(ctx->tir, type, i);
-        if (is_aggregate_type(ctx->tir, param_type)) {
+        if (is_passed_by_ptr(ctx, param_type)) {
             fprintf(ctx->stream, "ptr");
         } else {
             gen_type(ctx, param_type);
@@ -128,13 +171,24 @@ static void gen_params(GenContext *ctx, TypeId type) {
 }
 
 static void gen_ret_type(GenContext *ctx, TypeId type) {
-    if (is_aggregate_type(ctx->tir, type)) {
+    if (is_passed_by_ptr(ctx, type)) {
         fprintf(ctx->stream, "ptr");
         return;
     }
     gen_type(ctx, type);
 }
 
+// Copies of a function specialized for constant arguments are suffixed with
+// their number.
+static void gen_function_name(GenContext *ctx, ValueId value, int32_t clone) {
+    int32_t name = get_value_data(ctx->tir, value)->index;
+    fprintf(ctx->stream, "@%s", &ctx->tir.global->strtab.ptr[name]);
+
+    if (clone) {
+        fprintf(ctx->stream, ".spec%d", clone);
+    }
+}
+
 static void gen_extern_var(GenContext *ctx, ValueId value) {
     TypeId type = get_value_type(ctx->tir, value);
     int32_t name = get_value_data(ctx->tir, value)->index;
@@ -183,15 +237,20 @@ static bool is_lvalue(GenContext *ctx, MirId mir_id) {
             }
         }
         case MIR_ALLOC:
+        case MIR_RET_SLOT:
         case MIR_DEREF:
         case MIR_INDEX:
         case MIR_SLICE_INDEX:
         case MIR_CONST_INDEX:
         case MIR_ACCESS:
-        case MIR_NEW_SLICE: {
+        case MIR_NEW_SLICE:
+        case MIR_CONSTANT: {
             return true;
         }
+        case MIR_NOP:
+        case MIR_CLONE:
         case MIR_ADDRESS:
+        case MIR_LOAD:
         case MIR_ASSIGN:
         case MIR_INT:
         case MIR_FLOAT:
@@ -202,6 +261,7 @@ static bool is_lvalue(GenContext *ctx, MirId mir_id) {
         case MIR_ADD:
         case MIR_SUB:
         case MIR_MUL:
+        case MIR_MULHI:
         case MIR_DIV:
         case MIR_MOD:
         case MIR_AND:
@@ -215,6 +275,7 @@ static bool is_lvalue(GenContext *ctx, MirId mir_id) {
         case MIR_GT:
         case MIR_LE:
         case MIR_GE:
+        case MIR_SELECT:
         case MIR_ITOF:
         case MIR_ITRUNC:
         case MIR_SEXT:
@@ -223,6 +284,7 @@ static bool is_lvalue(GenContext *ctx, MirId mir_id) {
         case MIR_FTRUNC:
         case MIR_FEXT:
         case MIR_PTR_CAST:
+        case MIR_BOUNDS_CHECK:
         case MIR_BR:
         case MIR_BR_IF:
         case MIR_BR_IF_NOT:
@@ -239,7 +301,7 @@ static void gen_string(GenContext *ctx, int32_t index, char const *str) {
     len |= (uint64_t) str[1] << 8;
     len |= (uint64_t) str[2] << 16;
     len |= (uint64_t) str[3] << 24;
-    fprintf(ctx->stream, "@s%d = private unnamed_addr constant [%lu x i8] c\"", index, len + 1);
+    fprintf(ctx->stream, "@s%d%s = private unnamed_addr constant [%lu x i8] c\"", index, ctx->global_suffix, len + 1);
     for (uint64_t i = 0; i < len; i++) {
         if (str[i + 4] >= 32 && str[i + 4] <= 126) {
             fprintf(ctx->stream, "%c", str[i + 4]);
@@ -266,7 +328,7 @@ static void gen_value(GenContext *ctx, ValueId value) {
             break;
         }
         case VAL_STRING: {
-            fprintf(ctx->stream, "@s%d", ctx->strings.len);
+            fprintf(ctx->stream, "@s%d%s", ctx->strings.len, ctx->global_suffix);
             vec_push(&ctx->strings, get_value_str(ctx->tir, value));
             break;
         }
@@ -309,6 +371,74 @@ static void gen_value(GenContext *ctx, ValueId value) {
     }
 }
 
+static void gen_constant_elements(GenContext *ctx, TypeId type, int32_t *element) {
+    switch (get_type_tag(ctx->tir, type)) {
+        case TYPE_STRUCT: {
+            StructType s = get_struct_type(ctx->tir, type);
+            fprintf(ctx->stream, "{ ");
+
+            for (int32_t i = 0; i < s.field_count; i++) {
+                if (i != 0) {
+                    fprintf(ctx->stream, ", ");
+                }
+
+                TypeId field_type = get_struct_type_field(ctx->tir, type, i);
+                gen_type(ctx, field_type);
+                fprintf(ctx->stream, " ");
+                gen_constant_elements(ctx, field_type, element);
+            }
+
+            fprintf(ctx->stream, " }");
+            return;
+        }
+        case TYPE_ARRAY: {
+            ArrayType array = get_array_type(ctx->tir, type);
+            int64_t length = get_array_length_type(ctx->tir, array.index);
+            fprintf(ctx->stream, "[");
+
+            for (int64_t i = 0; i < length; i++) {
+                if (i != 0) {
+                    fprintf(ctx->stream, ", ");
+                }
+
+                gen_type(ctx, array.elem);
+                fprintf(ctx->stream, " ");
+                gen_constant_elements(ctx, array.elem, element);
+            }
+
+            fprintf(ctx->stream, "]");
+            return;
+        }
+        case TYPE_NEWTYPE: {
+            gen_constant_elements(ctx, get_newtype_type(ctx->tir, type).type, element);
+            return;
+        }
+        case TYPE_TAGGED: {
+            gen_constant_elements(ctx, get_tagged_type(ctx->tir, type).inner, element);
+            return;
+        }
+        case TYPE_LINEAR: {
+            gen_constant_elements(ctx, get_linear_elem_type(ctx->tir, type), element);
+            return;
+        }
+        default: {
+            gen_value(ctx, (ValueId) {get_mir_extra(ctx->mir, (*element)++)});
+            return;
+        }
+    }
+}
+
+static void gen_constant(GenContext *ctx, int32_t index, Constant constant) {
+    ctx->tir.thread = constant.thread;
+    TypeId type = get_mir_type(ctx->mir, constant.mir_id);
+    int32_t element = get_mir_access(ctx->mir, constant.mir_id).index;
+    fprintf(ctx->stream, "@c%d%s = private unnamed_addr constant ", index, ctx->global_suffix);
+    gen_type(ctx, type);
+    fprintf(ctx->stream, " ");
+    gen_constant_elements(ctx, type, &element);
+    fprintf(ctx->stream, "\n");
+}
+
 static int32_t new_tmp(GenContext *ctx, MirId mir_id) {
     ctx->temporaries[mir_id.private_field_id - ctx->mir_start] = ctx->tmp_count;
     return ctx->tmp_count++;
@@ -322,7 +452,7 @@ static void gen_operand_address(GenContext *ctx, MirId mir_id) {
         }
         case MIR_STRING: {
             ValueId value = get_mir_tir_value(ctx->mir, mir_id);
-            fprintf(ctx->stream, "@s%d", ctx->strings.len);
+            fprintf(ctx->stream, "@s%d%s", ctx->strings.len, ctx->global_suffix);
             vec_push(&ctx->strings, get_value_str(ctx->tir, value));
             break;
         }
@@ -331,6 +461,14 @@ static void gen_operand_address(GenContext *ctx, MirId mir_id) {
             gen_value(ctx, operand);
             break;
         }
+        case MIR_CONSTANT: {
+            fprintf(ctx->stream, "@c%d%s", ctx->temporaries[mir_id.private_field_id - ctx->mir_start], ctx->global_suffix);
+            break;
+        }
+        case MIR_CLONE: {
+            gen_function_name(ctx, get_mir_tir_value(ctx->mir, mir_id), get_mir_clone(ctx->mir, mir_id));
+            break;
+        }
         case MIR_ADDRESS: {
             MirId operand = get_mir_unary(ctx->mir, mir_id);
             gen_operand_address(ctx, operand);
@@ -344,14 +482,169 @@ static void gen_operand_address(GenContext *ctx, MirId mir_id) {
     }
 }
 
+// The storage a place is part of, or -1 if it is behind a pointer.
+static int32_t get_memory_root(GenContext *ctx, MirId place) {
+    switch (get_mir_tag(ctx->mir, place)) {
+        case MIR_ALLOC:
+        case MIR_RET_SLOT:
+        case MIR_NEW_SLICE:
+        case MIR_CONSTANT: {
+            return place.private_field_id;
+        }
+        case MIR_PARAM: {
+            return is_aggregate_type(ctx->tir, get_mir_type(ctx->mir, place)) ? place.private_field_id : -1;
+        }
+        case MIR_CALL: {
+            MirAccess call = get_mir_access(ctx->mir, place);
+            int32_t arg_count = get_function_type(ctx->tir, get_mir_type(ctx->mir, place)).param_count;
+            int32_t destination = get_mir_extra(ctx->mir, call.index + arg_count);
+            return destination >= 0 ? get_memory_root(ctx, (MirId) {destination}) : place.private_field_id;
+        }
+        case MIR_ACCESS:
+        case MIR_CONST_INDEX: {
+            return get_memory_root(ctx, get_mir_access(ctx->mir, place).operand);
+        }
+        case MIR_INDEX: {
+            TypeId type = remove_tags(ctx->tir, get_mir_type(ctx->mir, place));
+            if (get_type_tag(ctx->tir, type) != TYPE_ARRAY) {
+                return -1;
+            }
+            return get_memory_root(ctx, get_mir_binary(ctx->mir, place).left);
+        }
+        default: {
+            return -1;
+        }
+    }
+}
+
+// Private storage can only be written through its own places. Parameters and
+// the return slot point to the caller's memory.
+static bool is_private_memory(GenContext *ctx, int32_t root) {
+    if (root < 0 || ctx->escaped[root - ctx->mir_start]) {
+        return false;
+    }
+
+    switch (get_mir_tag(ctx->mir, (MirId) {root})) {
+        case MIR_ALLOC:
+        case MIR_NEW_SLICE:
+        case MIR_CALL:
+        case MIR_CONSTANT: return true;
+
+        default: return false;
+    }
+}
+
+static void mark_escaped(GenContext *ctx, MirId place) {
+    int32_t root = get_memory_root(ctx, place);
+    if (root >= 0) {
+        ctx->escaped[root - ctx->mir_start] = true;
+    }
+}
+
+static void find_escaped(GenContext *ctx) {
+    for (int32_t i = ctx->mir_start; i < ctx->mir_end; i++) {
+        MirId mir_id = {i};
+
+        switch (get_mir_tag(ctx->mir, mir_id)) {
+            case MIR_ADDRESS: {
+                mark_escaped(ctx, get_mir_unary(ctx->mir, mir_id));
+                break;
+            }
+            case MIR_NEW_SLICE: {
+                mark_escaped(ctx, get_mir_binary(ctx->mir, mir_id).right);
+                break;
+            }
+            case MIR_CALL: {
+                MirAccess call = get_mir_access(ctx->mir, mir_id);
+                TypeId type = get_mir_type(ctx->mir, mir_id);
+                int32_t arg_count = get_function_type(ctx->tir, type).param_count;
+
+                for (int32_t j = 0; j < arg_count; j++) {
+                    if (is_passed_by_ptr(ctx, get_function_type_param(ctx->tir, type, j))) {
+                        mark_escaped(ctx, (MirId) {get_mir_extra(ctx->mir, call.index + j)});
+                    }
+                }
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+}
+
+// Forgets the values of every place that a write to `root` may overlap.
+static void clobber_memory(GenContext *ctx, int32_t root) {
+    bool is_private = is_private_memory(ctx, root);
+    int32_t count = 0;
+
+    for (int32_t i = 0; i < ctx->memory_values.len; i++) {
+        MemoryValue value = ctx->memory_values.ptr[i];
+        bool clobbered = is_private ? value.root == root : !is_private_memory(ctx, value.root);
+
+        if (!clobbered) {
+            ctx->memory_values.ptr[count++] = value;
+        }
+    }
+
+    ctx->memory_values.len = count;
+}
+
+static void remember_memory_value(GenContext *ctx, MirId place, TypeId type, int32_t tmp) {
+    if (ctx->memory_values.len == MAX_MEMORY_VALUES) {
+        ctx->memory_values.len = 0;
+    }
+
+    vec_push(&ctx->memory_values, ((MemoryValue) {place, type, get_memory_root(ctx, place), tmp}));
+}
+
+static int32_t find_memory_value(GenContext *ctx, MirId place, TypeId type) {
+    for (int32_t i = ctx->memory_values.len - 1; i >= 0; i--) {
+        MemoryValue value = ctx->memory_values.ptr[i];
+
+        if (value.place.private_field_id == place.private_field_id && value.type.id == type.id) {
+            return value.tmp;
+        }
+    }
+
+    return -1;
+}
+
+// The register an operand is in, or -1 if it is printed as a constant.
+static int32_t get_register(GenContext *ctx, MirId mir_id, int32_t place) {
+    if (is_lvalue(ctx, mir_id)) {
+        return place;
+    }
+
+    switch (get_mir_tag(ctx->mir, mir_id)) {
+        case MIR_INT:
+        case MIR_FLOAT:
+        case MIR_STRING:
+        case MIR_NULL:
+        case MIR_TIR_VALUE:
+        case MIR_CLONE:
+        case MIR_ADDRESS: return -1;
+
+        default: return ctx->temporaries[mir_id.private_field_id - ctx->mir_start];
+    }
+}
+
+// Places that were loaded from or stored to earlier in the block, and not
+// written since, reuse the value instead of loading it again.
 static int32_t load_operand(GenContext *ctx, MirId mir_id, TypeId type) {
     if (is_lvalue(ctx, mir_id)) {
-        int32_t tmp = ctx->tmp_count++;
+        int32_t tmp = find_memory_value(ctx, mir_id, type);
+        if (tmp >= 0) {
+            return tmp;
+        }
+
+        tmp = ctx->tmp_count++;
         fprintf(ctx->stream, "  %%%d = load ", tmp);
         gen_type(ctx, type);
         fprintf(ctx->stream, ", ptr ");
         gen_operand_address(ctx, mir_id);
         fprintf(ctx->stream, "\n");
+        remember_memory_value(ctx, mir_id, type, tmp);
         return tmp;
     }
     return -1;
@@ -375,17 +668,91 @@ static void gen_alloc(GenContext *ctx, MirId mir_id) {
     fprintf(ctx->stream, "\n");
 }
 
+static bool has_lifetime(GenContext *ctx, MirId mir_id) {
+    TypeId type = get_mir_type(ctx->mir, mir_id);
+    MirRange range = ctx->alloc_ranges[mir_id.private_field_id - ctx->mir_start];
+    return type.id != TYPE_VOID && is_aggregate_type(ctx->tir, type) && range.end < ctx->mir_end;
+}
+
+static void gen_lifetime_marker(GenContext *ctx, MirId mir_id, char const *marker) {
+    TypeId type = get_mir_type(ctx->mir, mir_id);
+    fprintf(ctx->stream, "  call void @llvm.lifetime.%s.p0(i64 %ld, ptr %%%d)\n", marker,
+            sizeof_type(ctx->tir, type, ctx->target), ctx->temporaries[mir_id.private_field_id - ctx->mir_start]);
+}
+
+static void gen_lifetime_start(GenContext *ctx, MirId mir_id) {
+    if (has_lifetime(ctx, mir_id)) {
+        gen_lifetime_marker(ctx, mir_id, "start");
+    }
+}
+
+static void gen_lifetime_ends(GenContext *ctx, int32_t i) {
+    for (int32_t alloc = ctx->lifetime_ends[i - ctx->mir_start]; alloc >= 0; alloc = ctx->next_lifetime_end[alloc - ctx->mir_start]) {
+        gen_lifetime_marker(ctx, (MirId) {alloc}, "end");
+    }
+}
+
+// Allocations end right before the instruction after their last use. Ranges are
+// closed over loops, so no path from there reaches another use.
+static void add_lifetime_ends(GenContext *ctx, int32_t mir_end) {
+    for (int32_t i = ctx->mir_start; i < mir_end; i++) {
+        ctx->lifetime_ends[i - ctx->mir_start] = -1;
+    }
+
+    for (int32_t i = ctx->mir_start; i < mir_end; i++) {
+        MirId mir_id = {i};
+
+        if (get_mir_tag(ctx->mir, mir_id) != MIR_ALLOC || !has_lifetime(ctx, mir_id)) {
+            continue;
+        }
+
+        int32_t end = ctx->alloc_ranges[i - ctx->mir_start].end + 1;
+
+        if (end < mir_end) {
+            ctx->next_lifetime_end[i - ctx->mir_start] = ctx->lifetime_ends[end - ctx->mir_start];
+            ctx->lifetime_ends[end - ctx->mir_start] = i;
+        }
+    }
+}
+
 static void gen_call_alloc(GenContext *ctx, MirId mir_id) {
     TypeId type = get_mir_type(ctx->mir, mir_id);
     FunctionType function_type = get_function_type(ctx->tir, type);
     bool implicit_return = function_type.ret.id != TYPE_VOID && is_aggregate_type(ctx->tir, function_type.ret);
-    if (function_type.ret.id != TYPE_VOID && implicit_return) {
+    int32_t destination = get_mir_extra(ctx->mir, get_mir_access(ctx->mir, mir_id).index + function_type.param_count);
+    if (function_type.ret.id != TYPE_VOID && implicit_return && destination < 0) {
         fprintf(ctx->stream, "  %%%d = alloca ", new_tmp(ctx, mir_id));
         gen_type(ctx, function_type.ret);
         fprintf(ctx->stream, "\n");
     }
 }
 
+// Aggregates returned through a pointer are written straight to the caller's
+// storage; slices are returned in registers.
+static void gen_ret_slot_alloc(GenContext *ctx, MirId mir_id) {
+    if (is_passed_by_ptr(ctx, ctx->return_type)) {
+        ctx->temporaries[mir_id.private_field_id - ctx->mir_start] = 0;
+    } else {
+        gen_alloc(ctx, mir_id);
+    }
+}
+
+static void add_constant(GenContext *ctx, MirId mir_id) {
+    ctx->temporaries[mir_id.private_field_id - ctx->mir_start] = ctx->constants.len;
+    vec_push(&ctx->constants, ((Constant) {mir_id, ctx->tir.thread}));
+}
+
+// Aggregates passed by value are kept in memory like every other aggregate.
+static void gen_param_spill(GenContext *ctx, MirId mir_id, TypeId type) {
+    int32_t value = ctx->temporaries[mir_id.private_field_id - ctx->mir_start];
+    int32_t address = new_tmp(ctx, mir_id);
+    fprintf(ctx->stream, "  %%%d = alloca ", address);
+    gen_type(ctx, type);
+    fprintf(ctx->stream, "\n  store ");
+    gen_type(ctx, type);
+    fprintf(ctx->stream, " %%%d, ptr %%%d\n", value, address);
+}
+
 static void gen_new_slice_alloc(GenContext *ctx, MirId mir_id) {
     fprintf(ctx->stream, "  %%%d = alloca %%slice\n", new_tmp(ctx, mir_id));
 }
@@ -423,7 +790,7 @@ static void gen_binary(GenContext *ctx, MirId mir_id, char const *op) {
     TypeId type = get_mir_type(ctx->mir, mir_id);
     int32_t llvm_left = load_operand(ctx, binary.left, type);
     int32_t llvm_right = load_operand(ctx, binary.right, type);
-    fprintf(ctx->stream, "  %%t%d = %s ", mir_id.private_field_id, op);
+    fprintf(ctx->stream, "  %%%d = %s ", new_tmp(ctx, mir_id), op);
     gen_type(ctx, type);
     fprintf(ctx->stream, " ");
     gen_operand(ctx, binary.left, llvm_left);
@@ -449,6 +816,57 @@ static void gen_overloaded_binary(GenContext *ctx, MirId mir_id, char const *op,
     fprintf(ctx->stream, "\n");
 }
 
+static void gen_mulhi(GenContext *ctx, MirId mir_id) {
+    MirBinary binary = get_mir_binary(ctx->mir, mir_id);
+    TypeId type = get_mir_type(ctx->mir, mir_id);
+    int64_t bits = sizeof_type(ctx->tir, type, ctx->target) * 8;
+    int32_t llvm_left = load_operand(ctx, binary.left, type);
+    int32_t llvm_right = load_operand(ctx, binary.right, type);
+
+    int32_t wide_left = ctx->tmp_count++;
+    fprintf(ctx->stream, "  %%%d = sext ", wide_left);
+    gen_type(ctx, type);
+    fprintf(ctx->stream, " ");
+    gen_operand(ctx, binary.left, llvm_left);
+    fprintf(ctx->stream, " to i%ld\n", bits * 2);
+
+    int32_t wide_right = ctx->tmp_count++;
+    fprintf(ctx->stream, "  %%%d = sext ", wide_right);
+    gen_type(ctx, type);
+    fprintf(ctx->stream, " ");
+    gen_operand(ctx, binary.right, llvm_right);
+    fprintf(ctx->stream, " to i%ld\n", bits * 2);
+
+    int32_t product = ctx->tmp_count++;
+    fprintf(ctx->stream, "  %%%d = mul i%ld %%%d, %%%d\n", product, bits * 2, wide_left, wide_right);
+    int32_t high = ctx->tmp_count++;
+    fprintf(ctx->stream, "  %%%d = ashr i%ld %%%d, %ld\n", high, bits * 2, product, bits);
+    fprintf(ctx->stream, "  %%%d = trunc i%ld %%%d to ", new_tmp(ctx, mir_id), bits * 2, high);
+    gen_type(ctx, type);
+    fprintf(ctx->stream, "\n");
+}
+
+static void gen_select(GenContext *ctx, MirId mir_id) {
+    MirAccess select = get_mir_access(ctx->mir, mir_id);
+    TypeId type = get_mir_type(ctx->mir, mir_id);
+    MirId true_value = {get_mir_extra(ctx->mir, select.index)};
+    MirId false_value = {get_mir_extra(ctx->mir, select.index + 1)};
+    int32_t llvm_condition = load_operand(ctx, select.operand, type_bool);
+    int32_t llvm_true = load_operand(ctx, true_value, type);
+    int32_t llvm_false = load_operand(ctx, false_value, type);
+    fprintf(ctx->stream, "  %%%d = select i1 ", new_tmp(ctx, mir_id));
+    gen_operand(ctx, select.operand, llvm_condition);
+    fprintf(ctx->stream, ", ");
+    gen_type(ctx, type);
+    fprintf(ctx->stream, " ");
+    gen_operand(ctx, true_value, llvm_true);
+    fprintf(ctx->stream, ", ");
+    gen_type(ctx, type);
+    fprintf(ctx->stream, " ");
+    gen_operand(ctx, false_value, llvm_false);
+    fprintf(ctx->stream, "\n");
+}
+
 static bool should_deref(GenContext *ctx, MirId mir_id) {
     switch (get_mir_tag(ctx->mir, mir_id)) {
         case MIR_ALLOC: {
@@ -477,6 +895,12 @@ static void gen_deref(GenContext *ctx, MirId mir_id) {
     fprintf(ctx->stream, "  %%%d = load ptr, ptr %%%d\n", tmp, ctx->temporaries[operand.private_field_id - ctx->mir_start]);
 }
 
+static void gen_load(GenContext *ctx, MirId mir_id) {
+    MirId operand = get_mir_unary(ctx->mir, mir_id);
+    int32_t tmp = load_operand(ctx, operand, get_mir_type(ctx->mir, mir_id));
+    ctx->temporaries[mir_id.private_field_id - ctx->mir_start] = tmp;
+}
+
 static void gen_assign(GenContext *ctx, MirId mir_id) {
     MirBinary binary = get_mir_binary(ctx->mir, mir_id);
     TypeId type = get_mir_type(ctx->mir, mir_id);
@@ -488,6 +912,12 @@ static void gen_assign(GenContext *ctx, MirId mir_id) {
     fprintf(ctx->stream, ", ptr ");
     gen_operand_address(ctx, binary.left);
     fprintf(ctx->stream, "\n");
+
+    clobber_memory(ctx, get_memory_root(ctx, binary.left));
+    int32_t tmp = get_register(ctx, binary.right, llvm_right);
+    if (tmp >= 0) {
+        remember_memory_value(ctx, binary.left, type, tmp);
+    }
 }
 
 static void gen_new_slice(GenContext *ctx, MirId mir_id) {
@@ -514,6 +944,8 @@ static void gen_new_slice(GenContext *ctx, MirId mir_id) {
     fprintf(ctx->stream, "  store ptr ");
     gen_operand_address(ctx, binary.right);
     fprintf(ctx->stream, ", ptr %%%d\n", data_address);
+
+    clobber_memory(ctx, get_memory_root(ctx, mir_id));
 }
 
 static void gen_cast(GenContext *ctx, MirId mir_id, char const *op) {
@@ -530,33 +962,92 @@ static void gen_cast(GenContext *ctx, MirId mir_id, char const *op) {
     fprintf(ctx->stream, "\n");
 }
 
+static bool is_fastcc_function(GenContext *ctx, ValueId value, int32_t clone) {
+    return clone || (get_value_tag(ctx->tir, value) == VAL_FUNCTION && !ctx->escaping_functions[value.id]);
+}
+
+static bool is_fastcc_callee(GenContext *ctx, MirId callee) {
+    switch (get_mir_tag(ctx->mir, callee)) {
+        case MIR_TIR_VALUE: return is_fastcc_function(ctx, get_mir_tir_value(ctx->mir, callee), 0);
+        case MIR_CLONE: return true;
+
+        default: return false;
+    }
+}
+
+// A call whose result is returned right away, made by a function that gives
+// callees no access to its stack.
+static bool is_tail_call(GenContext *ctx, MirId mir_id, FunctionType function_type) {
+    TypeId type = get_mir_type(ctx->mir, mir_id);
+
+    if (ctx->has_escaped_storage || (function_type.ret.id != TYPE_VOID && is_aggregate_type(ctx->tir, function_type.ret))) {
+        return false;
+    }
+
+    for (int32_t i = 0; i < function_type.param_count; i++) {
+        if (is_passed_by_ptr(ctx, get_function_type_param(ctx->tir, type, i))) {
+            return false;
+        }
+    }
+
+    int32_t next = mir_id.private_field_id + 1;
+
+    while (next < ctx->mir_end && get_mir_tag(ctx->mir, (MirId) {next}) == MIR_NOP) {
+        next++;
+    }
+
+    if (next == ctx->mir_end) {
+        return false;
+    }
+
+    switch (get_mir_tag(ctx->mir, (MirId) {next})) {
+        case MIR_RET_VOID: return function_type.ret.id == TYPE_VOID;
+        case MIR_RET: return get_mir_unary(ctx->mir, (MirId) {next}).private_field_id == mir_id.private_field_id;
+
+        default: return false;
+    }
+}
+
 static void gen_call(GenContext *ctx, MirId mir_id) {
     MirAccess call = get_mir_access(ctx->mir, mir_id);
     TypeId type = get_mir_type(ctx->mir, mir_id);
     FunctionType function_type = get_function_type(ctx->tir, type);
     int32_t arg_count = function_type.param_count;
-    bool implicit_return = function_type.ret.id != TYPE_VOID && is_aggregate_type(ctx->tir, function_type.ret);
+    bool implicit_return = function_type.ret.id != TYPE_VOID && is_passed_by_ptr(ctx, function_type.ret);
+    bool aggregate_return = function_type.ret.id != TYPE_VOID && is_aggregate_type(ctx->tir, function_type.ret);
+    int32_t destination = get_mir_extra(ctx->mir, call.index + arg_count);
+
+    if (destination >= 0) {
+        ctx->temporaries[mir_id.private_field_id - ctx->mir_start] = ctx->temporaries[destination - ctx->mir_start];
+    }
 
     int32_t llvm_callee = load_operand(ctx, call.operand, type);
     int32_t *llvm_args = arena_alloc(&ctx->scratch, int32_t, arg_count);
     for (int32_t i = 0; i < arg_count; i++) {
         MirId arg = {get_mir_extra(ctx->mir, call.index + i)};
-        if (is_aggregate_type(ctx->tir, get_function_type_param(ctx->tir, type, i))) {
+        if (is_passed_by_ptr(ctx, get_function_type_param(ctx->tir, type, i))) {
             llvm_args[i] = -1;
         } else {
             llvm_args[i] = load_operand(ctx, arg, get_function_type_param(ctx->tir, type, i));
         }
     }
 
+    int32_t result = ctx->tmp_count;
     fprintf(ctx->stream, "  ");
     if (function_type.ret.id != TYPE_VOID) {
-        if (is_aggregate_type(ctx->tir, function_type.ret)) {
+        if (aggregate_return) {
             fprintf(ctx->stream, "%%%d = ", ctx->tmp_count++);
         } else {
             fprintf(ctx->stream, "%%%d = ", new_tmp(ctx, mir_id));
         }
     }
+    if (is_tail_call(ctx, mir_id, function_type)) {
+        fprintf(ctx->stream, "tail ");
+    }
     fprintf(ctx->stream, "call ");
+    if (is_fastcc_callee(ctx, call.operand)) {
+        fprintf(ctx->stream, "fastcc ");
+    }
     if (implicit_return) {
         fprintf(ctx->stream, "ptr");
     } else {
@@ -580,7 +1071,7 @@ static void gen_call(GenContext *ctx, MirId mir_id) {
         }
 
         MirId arg = {get_mir_extra(ctx->mir, call.index + i)};
-        if (is_aggregate_type(ctx->tir, get_function_type_param(ctx->tir, type, i))) {
+        if (is_passed_by_ptr(ctx, get_function_type_param(ctx->tir, type, i))) {
             fprintf(ctx->stream, "ptr");
             fprintf(ctx->stream, " ");
             gen_operand_address(ctx, arg);
@@ -592,6 +1083,20 @@ static void gen_call(GenContext *ctx, MirId mir_id) {
     }
 
     fprintf(ctx->stream, ")\n");
+
+    // The callee may write to any storage that is not private.
+    clobber_memory(ctx, -1);
+    if (aggregate_return) {
+        clobber_memory(ctx, get_memory_root(ctx, mir_id));
+    }
+
+    if (aggregate_return && !implicit_return) {
+        fprintf(ctx->stream, "  store ");
+        gen_type(ctx, function_type.ret);
+        fprintf(ctx->stream, " %%%d, ptr ", result);
+        gen_operand_address(ctx, mir_id);
+        fprintf(ctx->stream, "\n");
+    }
 }
 
 static void gen_index(GenContext *ctx, MirId mir_id) {
@@ -602,7 +1107,9 @@ static void gen_index(GenContext *ctx, MirId mir_id) {
     gen_type(ctx, type);
     fprintf(ctx->stream, ", ptr ");
     gen_operand_address(ctx, index.left);
-    fprintf(ctx->stream, ", i64 0, i64 ");
+    fprintf(ctx->stream, ", i64 0, ");
+    gen_type(ctx, type_isize);
+    fprintf(ctx->stream, " ");
     gen_operand(ctx, index.right, llvm_right);
     fprintf(ctx->stream, "\n");
 }
@@ -623,7 +1130,9 @@ static void gen_slice_index(GenContext *ctx, MirId mir_id) {
 
     fprintf(ctx->stream, "  %%%d = getelementptr inbounds ", new_tmp(ctx, mir_id));
     gen_type(ctx, remove_slice(ctx->tir, type));
-    fprintf(ctx->stream, ", ptr %%%d, i64 ", data);
+    fprintf(ctx->stream, ", ptr %%%d, ", data);
+    gen_type(ctx, type_isize);
+    fprintf(ctx->stream, " ");
     gen_operand(ctx, index.right, llvm_right);
     fprintf(ctx->stream, "\n");
 }
@@ -648,6 +1157,27 @@ static void gen_access(GenContext *ctx, MirId mir_id) {
     fprintf(ctx->stream, ", i64 0, i32 %d\n", access.index);
 }
 
+// The trap gets a block of its own, which is named after the check so that it
+// does not take a number.
+static void gen_bounds_check(GenContext *ctx, MirId mir_id) {
+    MirBinary check = get_mir_binary(ctx->mir, mir_id);
+    int32_t llvm_left = load_operand(ctx, check.left, type_isize);
+    int32_t llvm_right = load_operand(ctx, check.right, type_isize);
+    int32_t out_of_bounds = ctx->tmp_count++;
+    fprintf(ctx->stream, "  %%%d = icmp uge ", out_of_bounds);
+    gen_type(ctx, type_isize);
+    fprintf(ctx->stream, " ");
+    gen_operand(ctx, check.left, llvm_left);
+    fprintf(ctx->stream, ", ");
+    gen_operand(ctx, check.right, llvm_right);
+    fprintf(ctx->stream, "\n");
+    fprintf(ctx->stream, "  br i1 %%%d, label %%T.%d, label %%C.%d\n", out_of_bounds, mir_id.private_field_id, mir_id.private_field_id);
+    fprintf(ctx->stream, "T.%d:\n", mir_id.private_field_id);
+    fprintf(ctx->stream, "  call void @llvm.trap()\n");
+    fprintf(ctx->stream, "  unreachable\n");
+    fprintf(ctx->stream, "C.%d:\n", mir_id.private_field_id);
+}
+
 static void gen_br(GenContext *ctx, MirId mir_id) {
     MirAccess br = get_mir_access(ctx->mir, mir_id);
     fprintf(ctx->stream, "  br label %%L.%d\n", br.index);
@@ -679,9 +1209,15 @@ static void gen_ret_void(GenContext *ctx) {
 
 static void gen_ret(GenContext *ctx, MirId mir_id) {
     MirId operand = get_mir_unary(ctx->mir, mir_id);
+
+    if (get_mir_tag(ctx->mir, operand) == MIR_RET_SLOT && is_passed_by_ptr(ctx, ctx->return_type)) {
+        fprintf(ctx->stream, "  ret ptr %%0\n");
+        return;
+    }
+
     int32_t llvm_operand = load_operand(ctx, operand, ctx->return_type);
 
-    if (!is_aggregate_type(ctx->tir, ctx->return_type)) {
+    if (!is_passed_by_ptr(ctx, ctx->return_type)) {
         fprintf(ctx->stream, "  ret ");
         gen_type(ctx, ctx->return_type);
         fprintf(ctx->stream, " ");
@@ -701,14 +1237,19 @@ static void gen_ret(GenContext *ctx, MirId mir_id) {
 static void gen_instruction(GenContext *ctx, MirId mir_id) {
     switch (get_mir_tag(ctx->mir, mir_id)) {
         case MIR_PARAM: break;
-        case MIR_ALLOC: break;
+        case MIR_ALLOC: gen_lifetime_start(ctx, mir_id); break;
+        case MIR_RET_SLOT: break;
         case MIR_INT: break;
         case MIR_FLOAT: break;
         case MIR_STRING: break;
         case MIR_NULL: break;
         case MIR_TIR_VALUE: break;
+        case MIR_CONSTANT: break;
+        case MIR_CLONE: break;
         case MIR_ADDRESS: break;
+        case MIR_NOP: break;
         case MIR_DEREF: gen_deref(ctx, mir_id); break;
+        case MIR_LOAD: gen_load(ctx, mir_id); break;
         case MIR_ASSIGN: gen_assign(ctx, mir_id); break;
         case MIR_NEW_SLICE: gen_new_slice(ctx, mir_id); break;
         case MIR_MINUS: gen_negative(ctx, mir_id); break;
@@ -716,6 +1257,7 @@ static void gen_instruction(GenContext *ctx, MirId mir_id) {
         case MIR_ADD: gen_overloaded_binary(ctx, mir_id, "add", "fadd"); break;
         case MIR_SUB: gen_overloaded_binary(ctx, mir_id, "sub", "fsub"); break;
         case MIR_MUL: gen_overloaded_binary(ctx, mir_id, "mul", "fmul"); break;
+        case MIR_MULHI: gen_mulhi(ctx, mir_id); break;
         case MIR_DIV: gen_overloaded_binary(ctx, mir_id, "sdiv", "fdiv"); break;
         case MIR_MOD: gen_overloaded_binary(ctx, mir_id, "srem", "frem"); break;
         case MIR_AND: gen_binary(ctx, mir_id, "and"); break;
@@ -729,6 +1271,7 @@ static void gen_instruction(GenContext *ctx, MirId mir_id) {
         case MIR_GT: gen_overloaded_binary(ctx, mir_id, "icmp sgt", "fcmp gt"); break;
         case MIR_LE: gen_overloaded_binary(ctx, mir_id, "icmp sle", "fcmp le"); break;
         case MIR_GE: gen_overloaded_binary(ctx, mir_id, "icmp sge", "fcmp ge"); break;
+        case MIR_SELECT: gen_select(ctx, mir_id); break;
 
         case MIR_ITOF: gen_cast(ctx, mir_id, "sitofp"); break;
         case MIR_ITRUNC: gen_cast(ctx, mir_id, "trunc"); break;
@@ -744,6 +1287,7 @@ static void gen_instruction(GenContext *ctx, MirId mir_id) {
         case MIR_SLICE_INDEX: gen_slice_index(ctx, mir_id); break;
         case MIR_CONST_INDEX: gen_const_index(ctx, mir_id); break;
         case MIR_ACCESS: gen_access(ctx, mir_id); break;
+        case MIR_BOUNDS_CHECK: gen_bounds_check(ctx, mir_id); break;
         case MIR_BR: gen_br(ctx, mir_id); break;
         case MIR_BR_IF: gen_br_if(ctx, mir_id); break;
         case MIR_BR_IF_NOT: gen_br_if_not(ctx, mir_id); break;
@@ -752,9 +1296,21 @@ static void gen_instruction(GenContext *ctx, MirId mir_id) {
     }
 }
 
-static void gen_function(GenContext *ctx, int32_t mir_start, int32_t mir_end, ValueId value, bool is_main) {
+static void gen_function(GenContext *ctx, int32_t mir_start, int32_t mir_end, ValueId value, int32_t clone, bool is_main, bool is_cold) {
     ctx->mir_start = mir_start;
+    ctx->mir_end = mir_end;
     ctx->temporaries = arena_alloc(&ctx->scratch, int32_t, mir_end - mir_start);
+    ctx->alloc_ranges = get_mir_alloc_ranges(ctx->mir, ctx->tir, mir_start, mir_end, &ctx->scratch);
+    ctx->lifetime_ends = arena_alloc(&ctx->scratch, int32_t, mir_end - mir_start);
+    ctx->next_lifetime_end = arena_alloc(&ctx->scratch, int32_t, mir_end - mir_start);
+    add_lifetime_ends(ctx, mir_end);
+    ctx->escaped = arena_alloc(&ctx->scratch, bool, mir_end - mir_start);
+    find_escaped(ctx);
+    ctx->has_escaped_storage = false;
+    for (int32_t i = 0; i < mir_end - mir_start; i++) {
+        ctx->has_escaped_storage |= ctx->escaped[i];
+    }
+    ctx->memory_values.len = 0;
     ctx->tmp_count = 0;
     TypeId type = get_value_type(ctx->tir, value);
     TypeId ret_type = get_function_type(ctx->tir, type).ret;
@@ -764,11 +1320,23 @@ static void gen_function(GenContext *ctx, int32_t mir_start, int32_t mir_end, Va
         fprintf(ctx->stream, "define i32 @main");
     } else {
         fprintf(ctx->stream, "define private ");
+        if (is_fastcc_function(ctx, value, clone)) {
+            fprintf(ctx->stream, "fastcc ");
+        }
         gen_ret_type(ctx, ret_type);
-        int32_t name = get_value_data(ctx->tir, value)->index;
-        fprintf(ctx->stream, " @%s", &ctx->tir.global->strtab.ptr[name]);
+        fprintf(ctx->stream, " ");
+        gen_function_name(ctx, value, clone);
     }
     gen_params(ctx, type);
+    if (!is_main && is_fastcc_function(ctx, value, clone)) {
+        fprintf(ctx->stream, " unnamed_addr");
+    }
+    if (is_cold) {
+        fprintf(ctx->stream, " cold");
+    }
+    if (ctx->has_attributes) {
+        fprintf(ctx->stream, " #0");
+    }
     fprintf(ctx->stream, " {\n");
     for (int32_t i = 0; i < get_function_type(ctx->tir, type).param_count; i++) {
         MirId mir_id = {i + mir_start};
@@ -776,12 +1344,20 @@ static void gen_function(GenContext *ctx, int32_t mir_start, int32_t mir_end, Va
     }
     ctx->blocks = 1;
     ctx->tmp_count++;
+    for (int32_t i = 0; i < get_function_type(ctx->tir, type).param_count; i++) {
+        TypeId param_type = get_function_type_param(ctx->tir, type, i);
+        if (is_aggregate_type(ctx->tir, param_type) && !is_passed_by_ptr(ctx, param_type)) {
+            gen_param_spill(ctx, (MirId) {i + mir_start}, param_type);
+        }
+    }
     for (int32_t i = mir_start; i < mir_end; i++) {
         MirId mir_id = {i};
         switch (get_mir_tag(ctx->mir, (MirId) {i})) {
             case MIR_ALLOC: gen_alloc(ctx, mir_id); break;
             case MIR_CALL: gen_call_alloc(ctx, mir_id); break;
             case MIR_NEW_SLICE: gen_new_slice_alloc(ctx, mir_id); break;
+            case MIR_CONSTANT: add_constant(ctx, mir_id); break;
+            case MIR_RET_SLOT: gen_ret_slot_alloc(ctx, mir_id); break;
             default: break;
         }
     }
@@ -789,7 +1365,9 @@ static void gen_function(GenContext *ctx, int32_t mir_start, int32_t mir_end, Va
         MirId mir_id = {i};
         if (i != mir_start && is_mir_terminator(get_mir_tag(ctx->mir, (MirId) {i - 1}))) {
             fprintf(ctx->stream, "L.%d:\n", ctx->blocks++);
+            ctx->memory_values.len = 0;
         }
+        gen_lifetime_ends(ctx, i);
         gen_instruction(ctx, mir_id);
     }
 
@@ -811,15 +1389,126 @@ static void gen_struct(GenContext *ctx, TypeId type) {
     fprintf(ctx->stream, " }\n");
 }
 
-void gen_llvm(GenInput *input, Target target, Arena scratch) {
-    FILE *stream = fopen("a.ll", "w");
+typedef struct {
+    char const *arch;
+    // A part of the rest of the triple, or NULL to match any.
+    char const *os;
+    char const *layout;
+} DataLayout;
+
+static DataLayout const data_layouts[] = {
+    {"x86_64", "apple", "e-m:o-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"},
+    {"x86_64", "windows", "e-m:w-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"},
+    {"x86_64", NULL, "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"},
+    {"i386", "linux", "e-m:e-p:32:32-p270:32:32-p271:32:32-p272:64:64-f64:32:64-f80:32-n8:16:32-S128"},
+    {"i686", "linux", "e-m:e-p:32:32-p270:32:32-p271:32:32-p272:64:64-f64:32:64-f80:32-n8:16:32-S128"},
+    {"aarch64", "apple", "e-m:o-i64:64-i128:128-n32:64-S128"},
+    {"aarch64", "windows", "e-m:w-p:64:64-i32:32-i64:64-i128:128-n32:64-S128"},
+    {"aarch64", NULL, "e-m:e-i8:8:32-i16:16:32-i64:64-i128:128-n32:64-S128"},
+    {"arm64", "apple", "e-m:o-i64:64-i128:128-n32:64-S128"},
+    {"riscv64", NULL, "e-m:e-p:64:64-i64:64-i128:128-n64-S128"},
+    {"riscv32", NULL, "e-m:e-p:32:32-i64:64-n32-S128"},
+    {"wasm32", NULL, "e-m:e-p:32:32-p10:8:8-p20:8:8-i64:64-n32:64-S128-ni:1:10:20"},
+    {"wasm64", NULL, "e-m:e-p:64:64-p10:8:8-p20:8:8-i64:64-n32:64-S128-ni:1:10:20"},
+};
+
+static char const *const ilp32_archs[] = {
+    "i386", "i486", "i586", "i686", "arm", "armv6", "armv7", "armv7a", "thumbv7", "riscv32", "wasm32", "mips", "mipsel",
+    "powerpc", "sparc", "arm64_32", "aarch64_32",
+};
+
+static String get_triple_arch(char const *triple) {
+    return (String) {strcspn(triple, "-"), triple};
+}
+
+Target get_triple_target(char const *triple) {
+    String arch = get_triple_arch(triple);
+
+    for (int i = 0; i < ArrayLength(ilp32_archs); i++) {
+        if (equals(arch, (String) {strlen(ilp32_archs[i]), ilp32_archs[i]})) {
+            return TARGET_ISIZE_32;
+        }
+    }
+
+    return TARGET_ISIZE_64;
+}
+
+char const *get_host_triple(void) {
+#if defined(__x86_64__) && defined(__linux__)
+    return "x86_64-pc-linux-gnu";
+#elif defined(__aarch64__) && defined(__linux__)
+    return "aarch64-unknown-linux-gnu";
+#elif defined(__x86_64__) && defined(__APPLE__)
+    return "x86_64-apple-macosx";
+#elif defined(__aarch64__) && defined(__APPLE__)
+    return "arm64-apple-macosx";
+#elif defined(_WIN64)
+    return "x86_64-pc-windows-msvc";
+#else
+    return NULL;
+#endif
+}
+
+// Triples that are not in the table get no data layout, which llc fills in.
+static char const *get_data_layout(char const *triple) {
+    String arch = get_triple_arch(triple);
+
+    for (int i = 0; i < ArrayLength(data_layouts); i++) {
+        DataLayout const *layout = &data_layouts[i];
+
+        if (equals(arch, (String) {strlen(layout->arch), layout->arch})
+            && (!layout->os || strstr(triple + arch.len, layout->os))) {
+            return layout->layout;
+        }
+    }
+
+    return NULL;
+}
+
+static void gen_target(FILE *stream, TargetMachine const *machine) {
+    char const *triple = machine->triple ? machine->triple : get_host_triple();
+
+    if (!triple) {
+        return;
+    }
+
+    char const *layout = get_data_layout(triple);
+
+    if (layout) {
+        fprintf(stream, "target datalayout = \"%s\"\n", layout);
+    }
+
+    fprintf(stream, "target triple = \"%s\"\n", triple);
+}
+
+// Every function is compiled for the same CPU, so they share one attribute group.
+static void gen_attributes(FILE *stream, TargetMachine const *machine) {
+    fprintf(stream, "attributes #0 = {");
+
+    if (machine->cpu) {
+        fprintf(stream, " \"target-cpu\"=\"%s\"", machine->cpu);
+    }
+
+    if (machine->features) {
+        fprintf(stream, " \"target-features\"=\"%s\"", machine->features);
+    }
+
+    fprintf(stream, " }\n");
+}
+
+void gen_llvm(GenInput *input, Target target, TargetMachine const *machine, Arena scratch) {
+    FILE *stream = fopen(input->path, "w");
 
     if (!stream) {
         fprintf(stderr, "failed to write to file\n");
         exit(-1);
     }
 
+    gen_target(stream, machine);
     fprintf(stream, "%%slice = type { i%d, ptr }\n", (int) sizeof_pointer(target) * 8);
+    fprintf(stream, "declare void @llvm.lifetime.start.p0(i64 immarg, ptr nocapture)\n");
+    fprintf(stream, "declare void @llvm.lifetime.end.p0(i64 immarg, ptr nocapture)\n");
+    fprintf(stream, "declare void @llvm.trap()\n");
 
     GenContext ctx = {
         .target = target,
@@ -830,32 +1519,80 @@ void gen_llvm(GenInput *input, Target target, Arena scratch) {
         .mir = &input->mir_result->mir,
         .scratch = scratch,
         .stream = stream,
+        .has_attributes = machine->cpu || machine->features,
+        .global_suffix = "",
     };
 
+    char suffix[16];
+    if (input->shard_count) {
+        snprintf(suffix, sizeof(suffix), ".%d", input->shard);
+        ctx.global_suffix = suffix;
+    }
+
+    MirResult *mir_result = input->mir_result;
+    ctx.escaping_functions = arena_alloc(&ctx.scratch, bool, input->global_deps.values.values.len);
+    ctx.escaping_functions[input->declarations.main.id] = true;
+
+    // Shards do not know which functions other shards take the address of.
+    for (int32_t i = 0; i < mir_result->function_count; i++) {
+        MirFunction function = mir_result->functions[i];
+        if (!function.clone && (function.is_address_taken || input->shard_count)) {
+            ctx.escaping_functions[input->declarations.functions.ptr[function.tir].id] = true;
+        }
+    }
+
     for (int32_t i = 0; i < input->declarations.structs.len; i++) {
         TypeId type = input->declarations.structs.ptr[i];
-        gen_struct(&ctx, type);
+        if (mir_result->reachable_types[type.id] || input->shard_count) {
+            gen_struct(&ctx, type);
+        }
     }
 
     for (int32_t i = 0; i < input->declarations.extern_vars.len; i++) {
         ValueId value = input->declarations.extern_vars.ptr[i];
-        gen_extern_var(&ctx, value);
+        if (mir_result->reachable_values[value.id] || input->shard_count) {
+            gen_extern_var(&ctx, value);
+        }
     }
 
     for (int32_t i = 0; i < input->declarations.extern_functions.len; i++) {
         ValueId value = input->declarations.extern_functions.ptr[i];
-        gen_extern_function(&ctx, value);
+        if (mir_result->reachable_values[value.id] || input->shard_count) {
+            gen_extern_function(&ctx, value);
+        }
     }
 
-    for (int32_t i = 0; i < input->declarations.functions.len; i++) {
-        ctx.tir.thread = &input->insts[i];
-        ValueId value = input->declarations.functions.ptr[i];
-        gen_function(&ctx, input->mir_result->ends[i], input->mir_result->ends[i + 1], value, input->declarations.main.id == value.id);
+    if (input->shard_count) {
+        fprintf(stream, "; shard %d/%d\n", input->shard, input->shard_count);
+    }
+
+    for (int32_t i = 0; i < mir_result->function_count; i++) {
+        MirFunction function = mir_result->functions[i];
+        if (function.in_other_shard) {
+            continue;
+        }
+        ctx.tir.thread = &input->insts[function.tir];
+        ValueId value = input->declarations.functions.ptr[function.tir];
+        gen_function(&ctx, function.start, function.end, value, function.clone, input->declarations.main.id == value.id, function.is_cold);
     }
 
     for (int32_t i = 0; i < ctx.strings.len; i++) {
         gen_string(&ctx, i, ctx.strings.ptr[i]);
     }
 
+    for (int32_t i = 0; i < ctx.constants.len; i++) {
+        gen_constant(&ctx, i, ctx.constants.ptr[i]);
+    }
+
+    if (input->shard_count) {
+        fprintf(stream, "; end of shard\n");
+    }
+
+    if (ctx.has_attributes) {
+        gen_attributes(stream, machine);
+    }
+
+    free(ctx.memory_values.ptr);
+
     fclose(stream);
 }
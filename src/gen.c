@@ -1,5 +1,6 @@
 #include "gen.h"
 
+#include "arena.h"
 #include "data/mir.h"
 #include "data/tir.h"
 #include "fwd.h"
@@ -9,6 +10,8 @@
 typedef struct {
     Mir *mir;
     int32_t mir_start;
+    // The variable that holds each allocation, relative to `mir_start`.
+    int32_t *slots;
     TypeId return_type;
     bool is_main;
     Target target;
@@ -41,12 +44,23 @@ static void gen_ptr_type_after(GenContext *ctx, TypeId type) {
     gen_type_after(ctx, type);
 }
 
+// Structs that fit in two registers are returned by value, like the SysV ABI
+// does. C functions cannot return arrays, so those always go through `ret`.
 static bool is_type_passed_by_ptr(GenContext *ctx, TypeId type) {
-    if (is_aggregate_type(ctx->tir, type)) {
-        return true;
+    if (!is_aggregate_type(ctx->tir, type)) {
+        return false;
     }
 
-    return false;
+    switch (get_type_tag(ctx->tir, remove_tags(ctx->tir, type))) {
+        case TYPE_STRUCT:
+        case TYPE_MULTIPTR:
+        case TYPE_MULTIPTR_MUT: {
+            return sizeof_type(ctx->tir, type, ctx->target) > 2 * sizeof_pointer(ctx->target);
+        }
+        default: {
+            return true;
+        }
+    }
 }
 
 static void gen_params(GenContext *ctx, TypeId type) {
@@ -275,7 +289,18 @@ static void gen_extern_function(GenContext *ctx, ValueId value) {
     fprintf(ctx->stream, ";\n");
 }
 
-static void gen_function_decl(GenContext *ctx, ValueId value, bool is_main) {
+// Copies of a function specialized for constant arguments are prefixed with
+// their number.
+static void gen_function_name(GenContext *ctx, ValueId value, int32_t clone) {
+    if (clone) {
+        fprintf(ctx->stream, "spec%d_", clone);
+    }
+
+    int32_t name = get_value_data(ctx->tir, value)->index;
+    fprintf(ctx->stream, "%s", &ctx->tir.global->strtab.ptr[name]);
+}
+
+static void gen_function_decl(GenContext *ctx, ValueId value, int32_t clone, bool is_main, bool is_cold) {
     if (is_main) {
         fprintf(ctx->stream, "int main(void);\n");
         return;
@@ -285,6 +310,10 @@ static void gen_function_decl(GenContext *ctx, ValueId value, bool is_main) {
     TypeId ret_type = get_function_type(ctx->tir, type).ret;
     fprintf(ctx->stream, "static ");
 
+    if (is_cold) {
+        fprintf(ctx->stream, "__attribute__((cold)) ");
+    }
+
     if (ret_type.id != TYPE_VOID) {
         gen_type_before(ctx, ret_type);
         if (is_type_passed_by_ptr(ctx, ret_type)) {
@@ -298,8 +327,7 @@ static void gen_function_decl(GenContext *ctx, ValueId value, bool is_main) {
         fprintf(ctx->stream, "void ");
     }
 
-    int32_t name = get_value_data(ctx->tir, value)->index;
-    fprintf(ctx->stream, "%s", &ctx->tir.global->strtab.ptr[name]);
+    gen_function_name(ctx, value, clone);
     gen_params(ctx, type);
 
     if (ret_type.id != TYPE_VOID) {
@@ -316,13 +344,19 @@ static void gen_function_decl(GenContext *ctx, ValueId value, bool is_main) {
 
 static bool is_lvalue(GenContext *ctx, MirId mir_id) {
     switch (get_mir_tag(ctx->mir, mir_id)) {
+        case MIR_RET_SLOT: return is_type_passed_by_ptr(ctx, ctx->return_type);
+
         case MIR_DEREF:
         case MIR_INDEX:
         case MIR_SLICE_INDEX:
         case MIR_CONST_INDEX:
-        case MIR_ACCESS: return true;
+        case MIR_ACCESS:
+        case MIR_CONSTANT: return true;
 
+        case MIR_NOP:
+        case MIR_BOUNDS_CHECK:
         case MIR_ADDRESS:
+        case MIR_LOAD:
         case MIR_PARAM:
         case MIR_ALLOC:
         case MIR_ASSIGN:
@@ -332,11 +366,13 @@ static bool is_lvalue(GenContext *ctx, MirId mir_id) {
         case MIR_STRING:
         case MIR_NULL:
         case MIR_TIR_VALUE:
+        case MIR_CLONE:
         case MIR_MINUS:
         case MIR_NOT:
         case MIR_ADD:
         case MIR_SUB:
         case MIR_MUL:
+        case MIR_MULHI:
         case MIR_DIV:
         case MIR_MOD:
         case MIR_AND:
@@ -350,6 +386,7 @@ static bool is_lvalue(GenContext *ctx, MirId mir_id) {
         case MIR_GT:
         case MIR_LE:
         case MIR_GE:
+        case MIR_SELECT:
         case MIR_ITOF:
         case MIR_ITRUNC:
         case MIR_SEXT:
@@ -441,6 +478,10 @@ static void introduce_temporary(GenContext *ctx, MirId mir_id, TypeId type, bool
     fprintf(ctx->stream, " = ");
 }
 
+static int32_t get_slot(GenContext *ctx, MirId mir_id) {
+    return ctx->slots[mir_id.private_field_id - ctx->mir_start];
+}
+
 static void gen_operand(GenContext *ctx, MirId mir_id) {
     switch (get_mir_tag(ctx->mir, mir_id)) {
         case MIR_INT: {
@@ -457,9 +498,13 @@ static void gen_operand(GenContext *ctx, MirId mir_id) {
             gen_value(ctx, operand);
             return;
         }
+        case MIR_CLONE: {
+            gen_function_name(ctx, get_mir_tir_value(ctx->mir, mir_id), get_mir_clone(ctx->mir, mir_id));
+            return;
+        }
         case MIR_DEREF: {
             MirId operand = get_mir_unary(ctx->mir, mir_id);
-            fprintf(ctx->stream, "(*t%d)", operand.private_field_id - ctx->mir_start);
+            fprintf(ctx->stream, "(*t%d)", get_slot(ctx, operand));
             return;
         }
         default: {
@@ -468,9 +513,9 @@ static void gen_operand(GenContext *ctx, MirId mir_id) {
     }
 
     if (is_lvalue(ctx, mir_id)) {
-        fprintf(ctx->stream, "(*t%d)", mir_id.private_field_id - ctx->mir_start);
+        fprintf(ctx->stream, "(*t%d)", get_slot(ctx, mir_id));
     } else {
-        fprintf(ctx->stream, "t%d", mir_id.private_field_id - ctx->mir_start);
+        fprintf(ctx->stream, "t%d", get_slot(ctx, mir_id));
     }
 }
 
@@ -481,6 +526,10 @@ static void gen_alloc(GenContext *ctx, MirId mir_id) {
         abort();
     }
 
+    if (get_slot(ctx, mir_id) != mir_id.private_field_id - ctx->mir_start) {
+        return;
+    }
+
     fprintf(ctx->stream, "    ");
     gen_type_before(ctx, local_type);
     fprintf(ctx->stream, "t%d", mir_id.private_field_id - ctx->mir_start);
@@ -488,6 +537,89 @@ static void gen_alloc(GenContext *ctx, MirId mir_id) {
     fprintf(ctx->stream, ";\n");
 }
 
+static void gen_constant_elements(GenContext *ctx, TypeId type, int32_t *element) {
+    switch (get_type_tag(ctx->tir, type)) {
+        case TYPE_STRUCT: {
+            StructType s = get_struct_type(ctx->tir, type);
+            fprintf(ctx->stream, "{");
+
+            for (int32_t i = 0; i < s.field_count; i++) {
+                if (i != 0) {
+                    fprintf(ctx->stream, ", ");
+                }
+
+                gen_constant_elements(ctx, get_struct_type_field(ctx->tir, type, i), element);
+            }
+
+            fprintf(ctx->stream, "}");
+            return;
+        }
+        case TYPE_ARRAY: {
+            ArrayType array = get_array_type(ctx->tir, type);
+            int64_t length = get_array_length_type(ctx->tir, array.index);
+            fprintf(ctx->stream, "{");
+
+            for (int64_t i = 0; i < length; i++) {
+                if (i != 0) {
+                    fprintf(ctx->stream, ", ");
+                }
+
+                gen_constant_elements(ctx, array.elem, element);
+            }
+
+            fprintf(ctx->stream, "}");
+            return;
+        }
+        case TYPE_NEWTYPE: {
+            gen_constant_elements(ctx, get_newtype_type(ctx->tir, type).type, element);
+            return;
+        }
+        case TYPE_TAGGED: {
+            gen_constant_elements(ctx, get_tagged_type(ctx->tir, type).inner, element);
+            return;
+        }
+        case TYPE_LINEAR: {
+            gen_constant_elements(ctx, get_linear_elem_type(ctx->tir, type), element);
+            return;
+        }
+        default: {
+            gen_value(ctx, (ValueId) {get_mir_extra(ctx->mir, (*element)++)});
+            return;
+        }
+    }
+}
+
+// The data is read-only; the pointer to it only drops the qualifier so that it
+// can be used like any other aggregate.
+static void gen_constant(GenContext *ctx, MirId mir_id) {
+    TypeId type = get_mir_type(ctx->mir, mir_id);
+    int32_t element = get_mir_access(ctx->mir, mir_id).index;
+    int32_t id = mir_id.private_field_id - ctx->mir_start;
+    fprintf(ctx->stream, "    static const ");
+    gen_type_before(ctx, type);
+    fprintf(ctx->stream, "c%d", id);
+    gen_type_after(ctx, type);
+    fprintf(ctx->stream, " = ");
+    gen_constant_elements(ctx, type, &element);
+    fprintf(ctx->stream, ";\n");
+
+    introduce_temporary(ctx, mir_id, type, true);
+    fputs("(", ctx->stream);
+    gen_ptr_type_before(ctx, type);
+    gen_ptr_type_after(ctx, type);
+    fprintf(ctx->stream, ") &c%d;\n", id);
+}
+
+static void gen_ret_slot(GenContext *ctx, MirId mir_id) {
+    if (!is_type_passed_by_ptr(ctx, ctx->return_type)) {
+        gen_alloc(ctx, mir_id);
+        return;
+    }
+
+    introduce_temporary(ctx, mir_id, ctx->return_type, true);
+    fprintf(ctx->stream, "ret;\n");
+}
+
 static void gen_address(GenContext *ctx, MirId mir_id) {
     MirId operand = get_mir_unary(ctx->mir, mir_id);
     TypeId type = get_mir_type(ctx->mir, mir_id);
@@ -536,6 +668,54 @@ static void gen_bool_binary(GenContext *ctx, MirId mir_id, char const *op) {
     fprintf(ctx->stream, ";\n");
 }
 
+static void gen_load(GenContext *ctx, MirId mir_id) {
+    MirId operand = get_mir_unary(ctx->mir, mir_id);
+    introduce_temporary(ctx, mir_id, get_mir_type(ctx->mir, mir_id), false);
+    gen_operand(ctx, operand);
+    fprintf(ctx->stream, ";\n");
+}
+
+static void gen_mulhi(GenContext *ctx, MirId mir_id) {
+    MirBinary binary = get_mir_binary(ctx->mir, mir_id);
+    TypeId type = get_mir_type(ctx->mir, mir_id);
+    int64_t bits = sizeof_type(ctx->tir, type, ctx->target) * 8;
+    char const *wide_type = bits > 32 ? "__int128" : "int64_t";
+    introduce_temporary(ctx, mir_id, type, false);
+    fprintf(ctx->stream, "((%s) ", wide_type);
+    gen_operand(ctx, binary.left);
+    fprintf(ctx->stream, " * (%s) ", wide_type);
+    gen_operand(ctx, binary.right);
+    fprintf(ctx->stream, ") >> %ld;\n", bits);
+}
+
+// Shifting a negative value left is undefined in C, so the shift is done on
+// uint64_t and the result is truncated back to the type.
+static void gen_shl(GenContext *ctx, MirId mir_id) {
+    MirBinary binary = get_mir_binary(ctx->mir, mir_id);
+    TypeId type = get_mir_type(ctx->mir, mir_id);
+    introduce_temporary(ctx, mir_id, type, false);
+    fprintf(ctx->stream, "(");
+    gen_type_before(ctx, type);
+    gen_type_after(ctx, type);
+    fprintf(ctx->stream, ") ((uint64_t) ");
+    gen_operand(ctx, binary.left);
+    fprintf(ctx->stream, " << ");
+    gen_operand(ctx, binary.right);
+    fprintf(ctx->stream, ");\n");
+}
+
+static void gen_select(GenContext *ctx, MirId mir_id) {
+    MirAccess select = get_mir_access(ctx->mir, mir_id);
+    TypeId type = get_mir_type(ctx->mir, mir_id);
+    introduce_temporary(ctx, mir_id, type, false);
+    gen_operand(ctx, select.operand);
+    fprintf(ctx->stream, " ? ");
+    gen_operand(ctx, (MirId) {get_mir_extra(ctx->mir, select.index)});
+    fprintf(ctx->stream, " : ");
+    gen_operand(ctx, (MirId) {get_mir_extra(ctx->mir, select.index + 1)});
+    fprintf(ctx->stream, ";\n");
+}
+
 static void gen_mod(GenContext *ctx, MirId mir_id) {
     MirBinary binary = get_mir_binary(ctx->mir, mir_id);
     TypeId type = get_mir_type(ctx->mir, mir_id);
@@ -577,7 +757,7 @@ static void gen_new_slice(GenContext *ctx, MirId mir_id) {
     introduce_temporary(ctx, mir_id, type, false);
     fprintf(ctx->stream, "{");
     gen_operand(ctx, binary.left);
-    fprintf(ctx->stream, ", (char *) t%d", binary.right.private_field_id - ctx->mir_start);
+    fprintf(ctx->stream, ", (char *) t%d", get_slot(ctx, binary.right));
     fprintf(ctx->stream, "};\n");
 }
 
@@ -615,8 +795,18 @@ static void gen_call(GenContext *ctx, MirId mir_id) {
     FunctionType function_type = get_function_type(ctx->tir, type);
     int32_t arg_count = function_type.param_count;
     bool implicit_return = function_type.ret.id != TYPE_VOID && is_type_passed_by_ptr(ctx, function_type.ret);
+    MirId result = mir_id;
+    int32_t destination = get_mir_extra(ctx->mir, call.index + arg_count);
 
-    if (function_type.ret.id != TYPE_VOID) {
+    if (destination >= 0) {
+        result = (MirId) {destination};
+        fprintf(ctx->stream, "    ");
+
+        if (!implicit_return) {
+            gen_operand(ctx, result);
+            fprintf(ctx->stream, " = ");
+        }
+    } else if (function_type.ret.id != TYPE_VOID) {
         if (implicit_return) {
             fprintf(ctx->stream, "    ");
             gen_type_before(ctx, function_type.ret);
@@ -636,7 +826,7 @@ static void gen_call(GenContext *ctx, MirId mir_id) {
 
     if (implicit_return) {
         fprintf(ctx->stream, "&");
-        gen_operand(ctx, mir_id);
+        gen_operand(ctx, result);
 
         if (arg_count) {
             fprintf(ctx->stream, ", ");
@@ -719,6 +909,15 @@ static void gen_br_if_not(GenContext *ctx, MirId mir_id) {
     fprintf(ctx->stream, ") goto L%d;\n", br.index);
 }
 
+static void gen_bounds_check(GenContext *ctx, MirId mir_id) {
+    MirBinary check = get_mir_binary(ctx->mir, mir_id);
+    fprintf(ctx->stream, "    if ((uint64_t) ");
+    gen_operand(ctx, check.left);
+    fprintf(ctx->stream, " >= (uint64_t) ");
+    gen_operand(ctx, check.right);
+    fprintf(ctx->stream, ") __builtin_trap();\n");
+}
+
 static void gen_ret_void(GenContext *ctx) {
     if (ctx->is_main) {
         fprintf(ctx->stream, "    return 0;\n");
@@ -734,6 +933,8 @@ static void gen_ret(GenContext *ctx, MirId mir_id) {
         fprintf(ctx->stream, "    return ");
         gen_operand(ctx, operand);
         fprintf(ctx->stream, ";\n");
+    } else if (get_mir_tag(ctx->mir, operand) == MIR_RET_SLOT) {
+        fprintf(ctx->stream, "    return ret;\n");
     } else {
         fprintf(ctx->stream, "    __builtin_memcpy(ret, &");
         gen_operand(ctx, operand);
@@ -746,12 +947,17 @@ static void gen_instruction(GenContext *ctx, MirId mir_id) {
     switch (get_mir_tag(ctx->mir, mir_id)) {
         case MIR_PARAM: break;
         case MIR_ALLOC: gen_alloc(ctx, mir_id); break;
+        case MIR_RET_SLOT: gen_ret_slot(ctx, mir_id); break;
         case MIR_INT: break;
         case MIR_FLOAT: break;
         case MIR_STRING: break;
         case MIR_NULL: break;
         case MIR_TIR_VALUE: break;
+        case MIR_CONSTANT: gen_constant(ctx, mir_id); break;
+        case MIR_CLONE: break;
         case MIR_DEREF: break;
+        case MIR_NOP: break;
+        case MIR_LOAD: gen_load(ctx, mir_id); break;
         case MIR_ASSIGN: gen_assign(ctx, mir_id); break;
         case MIR_NEW_SLICE: gen_new_slice(ctx, mir_id); break;
         case MIR_MINUS: gen_unary(ctx, mir_id, "-"); break;
@@ -760,12 +966,13 @@ static void gen_instruction(GenContext *ctx, MirId mir_id) {
         case MIR_ADD: gen_binary(ctx, mir_id, "+"); break;
         case MIR_SUB: gen_binary(ctx, mir_id, "-"); break;
         case MIR_MUL: gen_binary(ctx, mir_id, "*"); break;
+        case MIR_MULHI: gen_mulhi(ctx, mir_id); break;
         case MIR_DIV: gen_binary(ctx, mir_id, "/"); break;
         case MIR_MOD: gen_mod(ctx, mir_id); break;
         case MIR_AND: gen_binary(ctx, mir_id, "&"); break;
         case MIR_OR: gen_binary(ctx, mir_id, "|"); break;
         case MIR_XOR: gen_binary(ctx, mir_id, "^"); break;
-        case MIR_SHL: gen_binary(ctx, mir_id, "<<"); break;
+        case MIR_SHL: gen_shl(ctx, mir_id); break;
         case MIR_SHR: gen_binary(ctx, mir_id, ">>"); break;
         case MIR_EQ: gen_bool_binary(ctx, mir_id, "=="); break;
         case MIR_NE: gen_bool_binary(ctx, mir_id, "!="); break;
@@ -773,6 +980,7 @@ static void gen_instruction(GenContext *ctx, MirId mir_id) {
         case MIR_GT: gen_bool_binary(ctx, mir_id, ">"); break;
         case MIR_LE: gen_bool_binary(ctx, mir_id, "<="); break;
         case MIR_GE: gen_bool_binary(ctx, mir_id, ">="); break;
+        case MIR_SELECT: gen_select(ctx, mir_id); break;
 
         case MIR_ITOF:
         case MIR_ITRUNC:
@@ -788,6 +996,7 @@ static void gen_instruction(GenContext *ctx, MirId mir_id) {
         case MIR_SLICE_INDEX: gen_slice_index(ctx, mir_id); break;
         case MIR_CONST_INDEX: gen_const_index(ctx, mir_id); break;
         case MIR_ACCESS: gen_access(ctx, mir_id); break;
+        case MIR_BOUNDS_CHECK: gen_bounds_check(ctx, mir_id); break;
         case MIR_BR: gen_br(ctx, mir_id); break;
         case MIR_BR_IF: gen_br_if(ctx, mir_id); break;
         case MIR_BR_IF_NOT: gen_br_if_not(ctx, mir_id); break;
@@ -796,8 +1005,50 @@ static void gen_instruction(GenContext *ctx, MirId mir_id) {
     }
 }
 
-static void gen_function(GenContext *ctx, int32_t mir_start, int32_t mir_end, ValueId value, bool is_main) {
+// Aggregate allocations of the same type whose live ranges do not overlap
+// share one variable, which keeps the frame small.
+static void assign_slots(GenContext *ctx, int32_t mir_start, int32_t mir_end, Arena *arena) {
+    Arena scratch = *arena;
+    ctx->slots = arena_alloc(arena, int32_t, mir_end - mir_start);
+    MirRange *ranges = get_mir_alloc_ranges(ctx->mir, ctx->tir, mir_start, mir_end, &scratch);
+    int32_t *slots = arena_alloc(&scratch, int32_t, mir_end - mir_start);
+    int32_t *slot_ends = arena_alloc(&scratch, int32_t, mir_end - mir_start);
+    int32_t slot_count = 0;
+
+    for (int32_t i = mir_start; i < mir_end; i++) {
+        MirId mir_id = {i};
+        TypeId type = get_mir_type(ctx->mir, mir_id);
+        MirRange range = ranges[i - mir_start];
+        ctx->slots[i - mir_start] = i - mir_start;
+
+        if (get_mir_tag(ctx->mir, mir_id) != MIR_ALLOC || !is_aggregate_type(ctx->tir, type)) {
+            continue;
+        }
+
+        int32_t slot = 0;
+
+        while (slot < slot_count) {
+            MirId occupant = {slots[slot] + mir_start};
+
+            if (get_mir_type(ctx->mir, occupant).id == type.id && slot_ends[slot] < range.start) {
+                break;
+            }
+
+            slot++;
+        }
+
+        if (slot == slot_count) {
+            slots[slot_count++] = i - mir_start;
+        }
+
+        ctx->slots[i - mir_start] = slots[slot];
+        slot_ends[slot] = range.end;
+    }
+}
+
+static void gen_function(GenContext *ctx, int32_t mir_start, int32_t mir_end, ValueId value, int32_t clone, bool is_main, Arena *scratch) {
     ctx->mir_start = mir_start;
+    assign_slots(ctx, mir_start, mir_end, scratch);
     TypeId type = get_value_type(ctx->tir, value);
     TypeId ret_type = get_function_type(ctx->tir, type).ret;
     ctx->return_type = ret_type;
@@ -822,8 +1073,7 @@ static void gen_function(GenContext *ctx, int32_t mir_start, int32_t mir_end, Va
             fprintf(ctx->stream, "void ");
         }
 
-        int32_t name = get_value_data(ctx->tir, value)->index;
-        fprintf(ctx->stream, "%s", &ctx->tir.global->strtab.ptr[name]);
+        gen_function_name(ctx, value, clone);
         gen_params(ctx, type);
 
         if (ret_type.id != TYPE_VOID) {
@@ -873,8 +1123,8 @@ static void gen_struct(GenContext *ctx, TypeId type) {
     fprintf(ctx->stream, "};\n");
 }
 
-void gen_c(GenInput *input, Target target) {
-    FILE *stream = fopen("a.c", "w");
+void gen_c(GenInput *input, Target target, Arena scratch) {
+    FILE *stream = fopen(input->path, "w");
 
     if (!stream) {
         fprintf(stderr, "failed to write to file\n");
@@ -895,35 +1145,59 @@ void gen_c(GenInput *input, Target target) {
         .stream = stream,
     };
 
+    MirResult *mir_result = input->mir_result;
+
     for (int32_t i = 0; i < input->declarations.structs.len; i++) {
         TypeId type = input->declarations.structs.ptr[i];
-        gen_struct_decl(&ctx, type);
+        if (mir_result->reachable_types[type.id] || input->shard_count) {
+            gen_struct_decl(&ctx, type);
+        }
     }
 
     for (int32_t i = 0; i < input->declarations.structs.len; i++) {
         TypeId type = input->declarations.structs.ptr[i];
-        gen_struct(&ctx, type);
+        if (mir_result->reachable_types[type.id] || input->shard_count) {
+            gen_struct(&ctx, type);
+        }
     }
 
     for (int32_t i = 0; i < input->declarations.extern_vars.len; i++) {
         ValueId value = input->declarations.extern_vars.ptr[i];
-        gen_extern_var(&ctx, value);
+        if (mir_result->reachable_values[value.id] || input->shard_count) {
+            gen_extern_var(&ctx, value);
+        }
     }
 
     for (int32_t i = 0; i < input->declarations.extern_functions.len; i++) {
         ValueId value = input->declarations.extern_functions.ptr[i];
-        gen_extern_function(&ctx, value);
+        if (mir_result->reachable_values[value.id] || input->shard_count) {
+            gen_extern_function(&ctx, value);
+        }
+    }
+
+    for (int32_t i = 0; i < mir_result->function_count; i++) {
+        MirFunction function = mir_result->functions[i];
+        ValueId value = input->declarations.functions.ptr[function.tir];
+        gen_function_decl(&ctx, value, function.clone, input->declarations.main.id == value.id, function.is_cold);
+    }
+
+    if (input->shard_count) {
+        fprintf(stream, "// shard %d/%d\n", input->shard, input->shard_count);
     }
 
-    for (int32_t i = 0; i < input->declarations.functions.len; i++) {
-        ValueId value = input->declarations.functions.ptr[i];
-        gen_function_decl(&ctx, value, input->declarations.main.id == value.id);
+    for (int32_t i = 0; i < mir_result->function_count; i++) {
+        MirFunction function = mir_result->functions[i];
+        if (function.in_other_shard) {
+            continue;
+        }
+        ctx.tir.thread = &input->insts[function.tir];
+        ValueId value = input->declarations.functions.ptr[function.tir];
+        Arena function_scratch = scratch;
+        gen_function(&ctx, function.start, function.end, value, function.clone, input->declarations.main.id == value.id, &function_scratch);
     }
 
-    for (int32_t i = 0; i < input->declarations.functions.len; i++) {
-        ctx.tir.thread = &input->insts[i];
-        ValueId value = input->declarations.functions.ptr[i];
-        gen_function(&ctx, input->mir_result->ends[i], input->mir_result->ends[i + 1], value, input->declarations.main.id == value.id);
+    if (input->shard_count) {
+        fprintf(stream, "// end of shard\n");
     }
 
     fclose(stream);
@@ -8,7 +8,18 @@ typedef struct {
     TirDependencies global_deps;
     LocalTir *insts;
     MirResult *mir_result;
+    char const *path;
+    // With a shard count, every declaration is emitted, followed by the
+    // functions this shard lowered between markers. See merge_shards.
+    int32_t shard;
+    int32_t shard_count;
 } GenInput;
 
-void gen_c(GenInput *input, Target target);
-void gen_llvm(GenInput *input, Target target, Arena scratch);
+void gen_c(GenInput *input, Target target, Arena scratch);
+void gen_llvm(GenInput *input, Target target, TargetMachine const *machine, Arena scratch);
+
+// The size of isize on the architecture of a target triple, 64 bits unless it
+// is known to be a 32 bit architecture.
+Target get_triple_target(char const *triple);
+// The triple jellyc was built for, or NULL if it is not known.
+char const *get_host_triple(void);
@@ -0,0 +1,1021 @@
+#define _XOPEN_SOURCE 700
+
+#include "lsp.h"
+
+#include "adt.h"
+#include "arena.h"
+#include "diagnostic.h"
+#include "front-end.h"
+#include "fwd.h"
+#include "lex.h"
+#include "parse.h"
+#include "data/ast.h"
+#include "data/rir.h"
+#include "data/tir.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+} JsonKind;
+
+typedef struct Json Json;
+
+struct Json {
+    JsonKind kind;
+    bool boolean;
+    double number;
+    String string;  // Unescaped.
+    String raw;     // The text of the value in the message.
+    String key;     // Set for the members of an object.
+    Json *first;
+    Json *next;
+};
+
+typedef struct {
+    String text;
+    int32_t cursor;
+    Arena *arena;
+} JsonParser;
+
+typedef struct {
+    int32_t start;
+    int32_t end;
+    bool is_note;
+    char *message;
+} LspDiagnostic;
+
+typedef Vec(LspDiagnostic) LspDiagnostics;
+
+typedef struct {
+    char *uri;
+    char *path;
+    String source;
+    Ast ast;
+    bool parsed;
+    LspDiagnostics parse_diagnostics;
+    LspDiagnostics analysis_diagnostics;
+} Document;
+
+typedef Vec(Document) Documents;
+
+// Documents are the files of the front end, in the same order. Only the
+// document that changed is lexed and parsed again, while name resolution and
+// type checking run over every document once all of them parse.
+typedef struct {
+    Options *options;
+    Documents documents;
+    Arena permanent;
+    Arena scratch;
+    FrontEnd front;
+    bool analyzed;
+    bool parsing;
+    bool initialized;
+    bool shutdown;
+    bool exit;
+} Server;
+
+// JSON
+
+static void skip_whitespace(JsonParser *p) {
+    while (p->cursor < p->text.len) {
+        switch (p->text.ptr[p->cursor]) {
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n': {
+                p->cursor++;
+                break;
+            }
+            default: {
+                return;
+            }
+        }
+    }
+}
+
+static bool consume(JsonParser *p, char c) {
+    skip_whitespace(p);
+    if (p->cursor < p->text.len && p->text.ptr[p->cursor] == c) {
+        p->cursor++;
+        return true;
+    }
+    return false;
+}
+
+static bool consume_word(JsonParser *p, char const *word) {
+    int32_t len = strlen(word);
+    if (p->text.len - p->cursor >= len && memcmp(&p->text.ptr[p->cursor], word, len) == 0) {
+        p->cursor += len;
+        return true;
+    }
+    return false;
+}
+
+static int32_t parse_hex4(JsonParser *p) {
+    int32_t result = 0;
+    for (int32_t i = 0; i < 4; i++) {
+        if (p->cursor >= p->text.len) {
+            return -1;
+        }
+        char c = p->text.ptr[p->cursor++];
+        int32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return -1;
+        }
+        result = result * 16 + digit;
+    }
+    return result;
+}
+
+static int32_t encode_utf8(char *out, int32_t code_point) {
+    if (code_point < 0x80) {
+        out[0] = code_point;
+        return 1;
+    }
+    if (code_point < 0x800) {
+        out[0] = 0xc0 | (code_point >> 6);
+        out[1] = 0x80 | (code_point & 0x3f);
+        return 2;
+    }
+    if (code_point < 0x10000) {
+        out[0] = 0xe0 | (code_point >> 12);
+        out[1] = 0x80 | ((code_point >> 6) & 0x3f);
+        out[2] = 0x80 | (code_point & 0x3f);
+        return 3;
+    }
+    out[0] = 0xf0 | (code_point >> 18);
+    out[1] = 0x80 | ((code_point >> 12) & 0x3f);
+    out[2] = 0x80 | ((code_point >> 6) & 0x3f);
+    out[3] = 0x80 | (code_point & 0x3f);
+    return 4;
+}
+
+// Expects the cursor after the opening quote. Escapes never expand, so the
+// result fits in the length of the escaped string.
+static bool parse_json_string(JsonParser *p, String *result) {
+    int32_t end = p->cursor;
+    while (end < p->text.len && p->text.ptr[end] != '"') {
+        end += p->text.ptr[end] == '\\' ? 2 : 1;
+    }
+
+    char *out = arena_alloc(p->arena, char, end - p->cursor + 1);
+    int32_t len = 0;
+
+    while (p->cursor < p->text.len) {
+        char c = p->text.ptr[p->cursor++];
+
+        if (c == '"') {
+            *result = (String) {len, out};
+            return true;
+        }
+
+        if (c != '\\') {
+            out[len++] = c;
+            continue;
+        }
+
+        if (p->cursor >= p->text.len) {
+            return false;
+        }
+
+        switch (p->text.ptr[p->cursor++]) {
+            case '"': out[len++] = '"'; break;
+            case '\\': out[len++] = '\\'; break;
+            case '/': out[len++] = '/'; break;
+            case 'b': out[len++] = '\b'; break;
+            case 'f': out[len++] = '\f'; break;
+            case 'n': out[len++] = '\n'; break;
+            case 'r': out[len++] = '\r'; break;
+            case 't': out[len++] = '\t'; break;
+            case 'u': {
+                int32_t code_point = parse_hex4(p);
+                if (code_point < 0) {
+                    return false;
+                }
+                if (code_point >= 0xd800 && code_point < 0xdc00 && consume_word(p, "\\u")) {
+                    int32_t low = parse_hex4(p);
+                    if (low < 0xdc00 || low >= 0xe000) {
+                        return false;
+                    }
+                    code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+                }
+                len += encode_utf8(&out[len], code_point);
+                break;
+            }
+            default: {
+                return false;
+            }
+        }
+    }
+
+    return false;
+}
+
+static Json *parse_json_value(JsonParser *p, int32_t depth) {
+    skip_whitespace(p);
+
+    if (p->cursor >= p->text.len || depth > 64) {
+        return NULL;
+    }
+
+    Json *json = arena_alloc(p->arena, Json, 1);
+    int32_t start = p->cursor;
+    char c = p->text.ptr[p->cursor];
+
+    if (c == '{' || c == '[') {
+        bool is_object = c == '{';
+        char close = is_object ? '}' : ']';
+        json->kind = is_object ? JSON_OBJECT : JSON_ARRAY;
+        p->cursor++;
+
+        Json **next = &json->first;
+        if (!consume(p, close)) {
+            do {
+                String key = {0};
+                if (is_object && (!consume(p, '"') || !parse_json_string(p, &key) || !consume(p, ':'))) {
+                    return NULL;
+                }
+                Json *member = parse_json_value(p, depth + 1);
+                if (!member) {
+                    return NULL;
+                }
+                member->key = key;
+                *next = member;
+                next = &member->next;
+            } while (consume(p, ','));
+
+            if (!consume(p, close)) {
+                return NULL;
+            }
+        }
+    } else if (c == '"') {
+        json->kind = JSON_STRING;
+        p->cursor++;
+        if (!parse_json_string(p, &json->string)) {
+            return NULL;
+        }
+    } else if (consume_word(p, "true")) {
+        json->kind = JSON_BOOL;
+        json->boolean = true;
+    } else if (consume_word(p, "false")) {
+        json->kind = JSON_BOOL;
+    } else if (consume_word(p, "null")) {
+        json->kind = JSON_NULL;
+    } else {
+        // Messages are null-terminated, so strtod stops at the end.
+        char *end;
+        json->kind = JSON_NUMBER;
+        json->number = strtod(&p->text.ptr[p->cursor], &end);
+        if (end == &p->text.ptr[p->cursor]) {
+            return NULL;
+        }
+        p->cursor = end - p->text.ptr;
+    }
+
+    json->raw = substring(p->text, start, p->cursor);
+    return json;
+}
+
+static Json *json_get(Json const *object, char const *key) {
+    if (!object || object->kind != JSON_OBJECT) {
+        return NULL;
+    }
+
+    String name = {strlen(key), key};
+    for (Json *member = object->first; member; member = member->next) {
+        if (equals(member->key, name)) {
+            return member;
+        }
+    }
+
+    return NULL;
+}
+
+static String json_get_string(Json const *object, char const *key) {
+    Json *value = json_get(object, key);
+    return value && value->kind == JSON_STRING ? value->string : (String) {0};
+}
+
+static int64_t json_get_int(Json const *object, char const *key) {
+    Json *value = json_get(object, key);
+    return value && value->kind == JSON_NUMBER ? (int64_t) value->number : 0;
+}
+
+static void write_json_string(FILE *out, String s) {
+    fputc('"', out);
+    for (ptrdiff_t i = 0; i < s.len; i++) {
+        unsigned char c = s.ptr[i];
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c == '\n') {
+            fprintf(out, "\\n");
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void write_json_cstring(FILE *out, char const *s) {
+    write_json_string(out, (String) {strlen(s), s});
+}
+
+// Messages
+
+// Returns a null-terminated message body, or NULL at the end of the input.
+static char *read_message(int32_t *length) {
+    char line[256];
+    int64_t content_length = -1;
+
+    while (fgets(line, sizeof(line), stdin)) {
+        if (strcmp(line, "\r\n") == 0 || strcmp(line, "\n") == 0) {
+            if (content_length < 0) {
+                continue;
+            }
+
+            if (content_length > INT32_MAX - 1) {
+                return NULL;
+            }
+
+            char *body = malloc(content_length + 1);
+            if (!body || fread(body, 1, content_length, stdin) != (size_t) content_length) {
+                free(body);
+                return NULL;
+            }
+
+            body[content_length] = '\0';
+            *length = content_length;
+            return body;
+        }
+
+        if (strncmp(line, "Content-Length:", 15) == 0) {
+            content_length = strtoll(&line[15], NULL, 10);
+        }
+    }
+
+    return NULL;
+}
+
+typedef struct {
+    FILE *stream;
+    char *buffer;
+    size_t size;
+} Message;
+
+// The stream writes through `message`, so it must not move until it is sent.
+static void begin_message(Message *message) {
+    *message = (Message) {0};
+    message->stream = open_memstream(&message->buffer, &message->size);
+    if (!message->stream) {
+        abort();
+    }
+    fprintf(message->stream, "{\"jsonrpc\":\"2.0\",");
+}
+
+static void send_message(Message *message) {
+    fputc('}', message->stream);
+    fclose(message->stream);
+    printf("Content-Length: %zu\r\n\r\n", message->size);
+    fwrite(message->buffer, 1, message->size, stdout);
+    fflush(stdout);
+    free(message->buffer);
+}
+
+static void begin_response(Message *message, Json const *id) {
+    begin_message(message);
+    fprintf(message->stream, "\"id\":%.*s,\"result\":", id ? (int) id->raw.len : 4, id ? id->raw.ptr : "null");
+}
+
+static void send_error(Json const *id, int code, char const *text) {
+    Message message;
+    begin_message(&message);
+    fprintf(message.stream, "\"id\":%.*s,\"error\":{\"code\":%d,\"message\":", id ? (int) id->raw.len : 4, id ? id->raw.ptr : "null", code);
+    write_json_cstring(message.stream, text);
+    fputc('}', message.stream);
+    send_message(&message);
+}
+
+// Positions
+
+// Converts a zero-based line and UTF-16 column to a byte offset.
+static int32_t get_offset(String source, int64_t line, int64_t character) {
+    int32_t i = 0;
+
+    while (line > 0 && i < source.len) {
+        if (source.ptr[i++] == '\n') {
+            line--;
+        }
+    }
+
+    while (character > 0 && i < source.len && source.ptr[i] != '\n') {
+        unsigned char c = source.ptr[i++];
+        character -= c >= 0xf0 ? 2 : 1;
+        while (i < source.len && (source.ptr[i] & 0xc0) == 0x80) {
+            i++;
+        }
+    }
+
+    return i;
+}
+
+static void write_position(FILE *out, String source, int32_t offset) {
+    int32_t line = 0;
+    int32_t character = 0;
+
+    for (int32_t i = 0; i < offset && i < source.len; i++) {
+        unsigned char c = source.ptr[i];
+        if (c == '\n') {
+            line++;
+            character = 0;
+        } else if ((c & 0xc0) != 0x80) {
+            character += c >= 0xf0 ? 2 : 1;
+        }
+    }
+
+    fprintf(out, "{\"line\":%d,\"character\":%d}", line, character);
+}
+
+static void write_range(FILE *out, String source, int32_t start, int32_t end) {
+    fprintf(out, "{\"start\":");
+    write_position(out, source, start);
+    fprintf(out, ",\"end\":");
+    write_position(out, source, end);
+    fputc('}', out);
+}
+
+// Documents
+
+static char *path_to_uri(char const *path) {
+    size_t len = strlen(path);
+    char *uri = malloc(len * 3 + 8);
+    if (!uri) {
+        abort();
+    }
+
+    char *out = uri + sprintf(uri, "file://");
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = path[i];
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || strchr("-._~/", c)) {
+            *out++ = c;
+        } else {
+            out += sprintf(out, "%%%02X", c);
+        }
+    }
+
+    *out = '\0';
+    return uri;
+}
+
+static char *uri_to_path(String uri) {
+    String prefix = Str("file://");
+    if (uri.len < prefix.len || memcmp(uri.ptr, prefix.ptr, prefix.len) != 0) {
+        return NULL;
+    }
+
+    char *path = malloc(uri.len + 1);
+    if (!path) {
+        abort();
+    }
+
+    int32_t len = 0;
+    for (ptrdiff_t i = prefix.len; i < uri.len; i++) {
+        char hex[3] = {0};
+        if (uri.ptr[i] == '%' && i + 2 < uri.len) {
+            memcpy(hex, &uri.ptr[i + 1], 2);
+            path[len++] = strtol(hex, NULL, 16);
+            i += 2;
+        } else {
+            path[len++] = uri.ptr[i];
+        }
+    }
+
+    path[len] = '\0';
+    return path;
+}
+
+static char *copy_string(String s) {
+    char *result = malloc(s.len + 1);
+    if (!result) {
+        abort();
+    }
+    memcpy(result, s.ptr, s.len);
+    result[s.len] = '\0';
+    return result;
+}
+
+static void clear_diagnostics(LspDiagnostics *diagnostics) {
+    for (int32_t i = 0; i < diagnostics->len; i++) {
+        free(diagnostics->ptr[i].message);
+    }
+    diagnostics->len = 0;
+}
+
+static void free_document(Document *document) {
+    free(document->uri);
+    free(document->path);
+    free((void *) document->source.ptr);
+    free_ast(&document->ast);
+    clear_diagnostics(&document->parse_diagnostics);
+    clear_diagnostics(&document->analysis_diagnostics);
+    free(document->parse_diagnostics.ptr);
+    free(document->analysis_diagnostics.ptr);
+}
+
+static int32_t find_document(Server *s, String uri) {
+    for (int32_t i = 0; i < s->documents.len; i++) {
+        if (equals((String) {strlen(s->documents.ptr[i].uri), s->documents.ptr[i].uri}, uri)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void collect_diagnostic(void *data, SourceLoc const *loc, Diagnostic const *diagnostic) {
+    Server *s = data;
+    Document *document = NULL;
+
+    for (int32_t i = 0; i < s->documents.len; i++) {
+        if (strcmp(s->documents.ptr[i].path, loc->path) == 0) {
+            document = &s->documents.ptr[i];
+            break;
+        }
+    }
+
+    if (!document) {
+        return;
+    }
+
+    LspDiagnostic result = {
+        .start = loc->where.index,
+        .end = loc->where.index + loc->len,
+        .is_note = diagnostic->kind > ERROR_END,
+    };
+    size_t size;
+    FILE *stream = open_memstream(&result.message, &size);
+    if (!stream) {
+        return;
+    }
+    print_diagnostic_message(stream, diagnostic);
+    fclose(stream);
+
+    vec_push(s->parsing ? &document->parse_diagnostics : &document->analysis_diagnostics, result);
+}
+
+static void release_analysis(Server *s) {
+    if (s->analyzed) {
+        free_scopes(&s->front);
+        free_types(&s->front);
+        s->front = (FrontEnd) {0};
+        s->analyzed = false;
+    }
+}
+
+static void parse_document(Server *s, int32_t index) {
+    // The analysis refers to the old AST.
+    release_analysis(s);
+
+    Document *document = &s->documents.ptr[index];
+    free_ast(&document->ast);
+    clear_diagnostics(&document->parse_diagnostics);
+    s->parsing = true;
+    document->parsed = document->source.len && parse_ast(&document->ast, document->path, document->source) == 0;
+    s->parsing = false;
+}
+
+static void publish_diagnostics(Document *document) {
+    Message message;
+    begin_message(&message);
+    fprintf(message.stream, "\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+    write_json_cstring(message.stream, document->uri);
+    fprintf(message.stream, ",\"diagnostics\":[");
+
+    LspDiagnostics *lists[] = {&document->parse_diagnostics, &document->analysis_diagnostics};
+    bool first = true;
+    for (int32_t i = 0; i < ArrayLength(lists); i++) {
+        for (int32_t j = 0; j < lists[i]->len; j++) {
+            LspDiagnostic *diagnostic = &lists[i]->ptr[j];
+            fprintf(message.stream, "%s{\"range\":", first ? "" : ",");
+            write_range(message.stream, document->source, diagnostic->start, diagnostic->end);
+            fprintf(message.stream, ",\"severity\":%d,\"source\":\"jellyc\",\"message\":", diagnostic->is_note ? 3 : 1);
+            write_json_cstring(message.stream, diagnostic->message);
+            fputc('}', message.stream);
+            first = false;
+        }
+    }
+
+    fprintf(message.stream, "]}");
+    send_message(&message);
+}
+
+// Resolves names and checks types of every document, reusing their ASTs.
+static void analyze(Server *s) {
+    release_analysis(s);
+
+    int32_t count = s->documents.len;
+    bool parsed = true;
+    for (int32_t i = 0; i < count; i++) {
+        clear_diagnostics(&s->documents.ptr[i].analysis_diagnostics);
+        parsed = parsed && s->documents.ptr[i].parsed;
+    }
+
+    if (parsed && count) {
+        Arena permanent = s->permanent;
+        s->front.file_count = count;
+        s->front.paths = arena_alloc(&permanent, char *, count);
+        s->front.sources = arena_alloc(&permanent, String, count);
+        s->front.asts = arena_alloc(&permanent, Ast, count);
+        for (int32_t i = 0; i < count; i++) {
+            s->front.paths[i] = s->documents.ptr[i].path;
+            s->front.sources[i] = s->documents.ptr[i].source;
+            s->front.asts[i] = s->documents.ptr[i].ast;
+        }
+
+        analyze_front_end(&s->front, s->options, &permanent, s->scratch);
+        s->analyzed = true;
+    }
+
+    if (s->initialized) {
+        for (int32_t i = 0; i < count; i++) {
+            publish_diagnostics(&s->documents.ptr[i]);
+        }
+    }
+}
+
+static void add_document(Server *s, char *uri, char *path, String source) {
+    release_analysis(s);
+    vec_push(&s->documents, (Document) {.uri = uri, .path = path, .source = source});
+    parse_document(s, s->documents.len - 1);
+}
+
+// Symbols
+
+static String get_name(Server *s, AstRef ref) {
+    return id_token_to_string(s->front.sources[ref.file], get_ast_token(ref.node, &s->front.asts[ref.file]));
+}
+
+static bool covers(Server *s, AstRef ref, int32_t offset) {
+    int32_t start = get_ast_token(ref.node, &s->front.asts[ref.file]).index;
+    return offset >= start && offset <= start + get_name(s, ref).len;
+}
+
+// Finds the global or local that is named or defined at `offset`.
+static Symbol find_symbol(Server *s, int32_t file, int32_t offset) {
+    Ast *ast = &s->front.asts[file];
+    Rir *rir = &s->front.rirs[file];
+
+    for (int32_t i = 0; i < ast->nodes.len; i++) {
+        AstRef ref = {{i}, file};
+        AstTag tag = get_ast_tag(ref.node, ast);
+
+        if ((tag != AST_ID && tag != AST_ACCESS) || !covers(s, ref, offset)) {
+            continue;
+        }
+
+        int32_t data = get_rir_data(ref.node, rir);
+        switch (get_rir_tag(ref.node, rir)) {
+            case RIR_LOCAL_ID: {
+                return (Symbol) {.kind = SYM_LOCAL, .local = {data}};
+            }
+            case RIR_GLOBAL_ID: {
+                // Module names resolve to the module instead of a definition.
+                if (data < s->front.ast_refs.len && equals(get_name(s, ref), get_name(s, s->front.ast_refs.ptr[data]))) {
+                    return (Symbol) {.kind = SYM_GLOBAL, .global = {data}};
+                }
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+
+    Locals *locals = &s->front.rir_output.local_ast_refs[file];
+    for (int32_t i = 1; i < locals->len; i++) {
+        if (covers(s, (AstRef) {locals->ptr[i].node, file}, offset)) {
+            return (Symbol) {.kind = SYM_LOCAL, .local = {i}};
+        }
+    }
+
+    for (int32_t i = 0; i < s->front.ast_refs.len; i++) {
+        if (s->front.ast_refs.ptr[i].file == file && covers(s, s->front.ast_refs.ptr[i], offset)) {
+            return (Symbol) {.kind = SYM_GLOBAL, .global = {i}};
+        }
+    }
+
+    return (Symbol) {0};
+}
+
+static AstRef get_definition(Server *s, int32_t file, Symbol symbol) {
+    if (symbol.kind == SYM_LOCAL) {
+        return (AstRef) {s->front.rir_output.local_ast_refs[file].ptr[symbol.local.id].node, file};
+    }
+    return s->front.ast_refs.ptr[symbol.global.id];
+}
+
+// Prints `name: type` for values and `name = type` for types.
+static bool print_symbol_type(Server *s, FILE *out, int32_t file, Symbol symbol) {
+    TirOutput *tir_output = &s->front.tir_output;
+    TirContext ctx = {&tir_output->global_deps, NULL};
+    TirRef ref = {0};
+    Role role;
+
+    if (symbol.kind == SYM_GLOBAL) {
+        role = s->front.rir_output.rir_refs[symbol.global.id];
+        ref = tir_output->def_refs[symbol.global.id];
+    } else {
+        role = s->front.rir_output.local_ast_refs[file].ptr[symbol.local.id].role;
+
+        // Locals are numbered per file, so only the definition they belong to
+        // has resolved them.
+        for (int32_t i = 0; i < s->front.ast_refs.len && !ref.value.id; i++) {
+            if (s->front.ast_refs.ptr[i].file != file || !tir_output->local_refs || !tir_output->local_refs[i]) {
+                continue;
+            }
+
+            ref = tir_output->local_refs[i][symbol.local.id];
+            ctx.thread = NULL;
+            for (int32_t j = 0; j < s->front.functions.len; j++) {
+                if (s->front.functions.ptr[j].id == i) {
+                    ctx.thread = &tir_output->insts[j];
+                }
+            }
+        }
+    }
+
+    String name = get_name(s, get_definition(s, file, symbol));
+
+    if (role == ROLE_TYPE && ref.type.id) {
+        fprintf(out, "%.*s = ", (int) name.len, name.ptr);
+        print_type(out, ctx, ref.type);
+        return true;
+    }
+
+    int32_t value_count = ctx.global->values.values.len + (ctx.thread ? ctx.thread->deps.values.values.len : 0);
+    if (role == ROLE_VALUE && ref.value.id && ref.value.id < value_count) {
+        fprintf(out, "%.*s: ", (int) name.len, name.ptr);
+        print_type(out, ctx, get_value_type(ctx, ref.value));
+        return true;
+    }
+
+    return false;
+}
+
+// Requests
+
+static int32_t get_request_position(Server *s, Json const *params, int32_t *file) {
+    String uri = json_get_string(json_get(params, "textDocument"), "uri");
+    *file = find_document(s, uri);
+    if (*file < 0 || !s->analyzed) {
+        return -1;
+    }
+
+    Json *position = json_get(params, "position");
+    return get_offset(s->documents.ptr[*file].source, json_get_int(position, "line"), json_get_int(position, "character"));
+}
+
+static void hover(Server *s, Json const *id, Json const *params) {
+    Message message;
+    begin_response(&message, id);
+    int32_t file;
+    int32_t offset = get_request_position(s, params, &file);
+    Symbol symbol = offset >= 0 ? find_symbol(s, file, offset) : (Symbol) {0};
+
+    char *text = NULL;
+    size_t size = 0;
+    FILE *stream = open_memstream(&text, &size);
+    bool found = stream && symbol.kind != SYM_UNDEFINED && print_symbol_type(s, stream, file, symbol);
+    if (stream) {
+        fclose(stream);
+    }
+
+    if (found) {
+        fprintf(message.stream, "{\"contents\":{\"kind\":\"plaintext\",\"value\":");
+        write_json_string(message.stream, (String) {size, text});
+        fprintf(message.stream, "}}");
+    } else {
+        fprintf(message.stream, "null");
+    }
+
+    free(text);
+    send_message(&message);
+}
+
+static void definition(Server *s, Json const *id, Json const *params) {
+    Message message;
+    begin_response(&message, id);
+    int32_t file;
+    int32_t offset = get_request_position(s, params, &file);
+    Symbol symbol = offset >= 0 ? find_symbol(s, file, offset) : (Symbol) {0};
+
+    if (symbol.kind != SYM_UNDEFINED) {
+        AstRef ref = get_definition(s, file, symbol);
+        int32_t start = get_ast_token(ref.node, &s->front.asts[ref.file]).index;
+        fprintf(message.stream, "{\"uri\":");
+        write_json_cstring(message.stream, s->documents.ptr[ref.file].uri);
+        fprintf(message.stream, ",\"range\":");
+        write_range(message.stream, s->front.sources[ref.file], start, start + get_name(s, ref).len);
+        fputc('}', message.stream);
+    } else {
+        fprintf(message.stream, "null");
+    }
+
+    send_message(&message);
+}
+
+static void open_document(Server *s, Json const *params) {
+    Json *text_document = json_get(params, "textDocument");
+    String uri = json_get_string(text_document, "uri");
+    String text = json_get_string(text_document, "text");
+    int32_t index = find_document(s, uri);
+
+    if (index < 0) {
+        char *path = uri_to_path(uri);
+        if (!path) {
+            return;
+        }
+        add_document(s, copy_string(uri), path, (String) {text.len, copy_string(text)});
+    } else {
+        Document *document = &s->documents.ptr[index];
+        free((void *) document->source.ptr);
+        document->source = (String) {text.len, copy_string(text)};
+        parse_document(s, index);
+    }
+
+    analyze(s);
+}
+
+static void change_document(Server *s, Json const *params) {
+    int32_t index = find_document(s, json_get_string(json_get(params, "textDocument"), "uri"));
+    Json *changes = json_get(params, "contentChanges");
+
+    if (index < 0 || !changes || changes->kind != JSON_ARRAY) {
+        return;
+    }
+
+    Document *document = &s->documents.ptr[index];
+    for (Json *change = changes->first; change; change = change->next) {
+        String text = json_get_string(change, "text");
+        Json *range = json_get(change, "range");
+        String source = document->source;
+        int32_t start = 0;
+        int32_t end = source.len;
+
+        if (range) {
+            Json *from = json_get(range, "start");
+            Json *to = json_get(range, "end");
+            start = get_offset(source, json_get_int(from, "line"), json_get_int(from, "character"));
+            end = get_offset(source, json_get_int(to, "line"), json_get_int(to, "character"));
+            end = end < start ? start : end;
+        }
+
+        int32_t len = source.len - (end - start) + text.len;
+        char *result = malloc(len + 1);
+        if (!result) {
+            abort();
+        }
+        memcpy(result, source.ptr, start);
+        memcpy(&result[start], text.ptr, text.len);
+        memcpy(&result[start + text.len], &source.ptr[end], source.len - end);
+        free((void *) source.ptr);
+        document->source = (String) {len, result};
+    }
+
+    parse_document(s, index);
+    analyze(s);
+}
+
+static void close_document(Server *s, Json const *params) {
+    int32_t index = find_document(s, json_get_string(json_get(params, "textDocument"), "uri"));
+
+    if (index < 0) {
+        return;
+    }
+
+    // What is on disk is analyzed again, and documents that only existed in
+    // the editor are dropped.
+    release_analysis(s);
+    Document *document = &s->documents.ptr[index];
+    String source = read_file(document->path);
+
+    if (source.ptr) {
+        free((void *) document->source.ptr);
+        document->source = source;
+        parse_document(s, index);
+    } else {
+        clear_diagnostics(&document->parse_diagnostics);
+        clear_diagnostics(&document->analysis_diagnostics);
+        publish_diagnostics(document);
+        free_document(document);
+        memmove(document, document + 1, (s->documents.len - index - 1) * sizeof(Document));
+        s->documents.len--;
+    }
+
+    analyze(s);
+}
+
+static void handle_message(Server *s, Json const *message) {
+    String method = json_get_string(message, "method");
+    Json *id = json_get(message, "id");
+    Json *params = json_get(message, "params");
+
+    if (equals(method, (String) Str("initialize"))) {
+        Message response;
+        begin_response(&response, id);
+        fprintf(response.stream, "{\"capabilities\":{\"textDocumentSync\":1,\"hoverProvider\":true,\"definitionProvider\":true},");
+        fprintf(response.stream, "\"serverInfo\":{\"name\":\"jellyc\"}}");
+        send_message(&response);
+    } else if (equals(method, (String) Str("initialized"))) {
+        s->initialized = true;
+        analyze(s);
+    } else if (equals(method, (String) Str("shutdown"))) {
+        s->shutdown = true;
+        Message response;
+        begin_response(&response, id);
+        fprintf(response.stream, "null");
+        send_message(&response);
+    } else if (equals(method, (String) Str("exit"))) {
+        s->exit = true;
+    } else if (equals(method, (String) Str("textDocument/didOpen"))) {
+        open_document(s, params);
+    } else if (equals(method, (String) Str("textDocument/didChange"))) {
+        change_document(s, params);
+    } else if (equals(method, (String) Str("textDocument/didClose"))) {
+        close_document(s, params);
+    } else if (equals(method, (String) Str("textDocument/hover"))) {
+        hover(s, id, params);
+    } else if (equals(method, (String) Str("textDocument/definition"))) {
+        definition(s, id, params);
+    } else if (id && method.len) {
+        send_error(id, -32601, "method not found");
+    }
+}
+
+int run_language_server(Options *options, int file_count, char **paths, String *sources) {
+    Server s = {0};
+    s.options = options;
+    s.permanent = new_arena(64 << 20);
+    s.scratch = new_arena(64 << 20);
+
+    // Standard output carries the protocol.
+    options->print_debug = false;
+    options->lazy = false;
+    options->language_server = true;
+    set_diagnostic_handler(collect_diagnostic, &s);
+
+    for (int i = 0; i < file_count; i++) {
+        char *path = realpath(paths[i], NULL);
+        if (!path || !sources[i].ptr) {
+            free(path);
+            free((void *) sources[i].ptr);
+            continue;
+        }
+        add_document(&s, path_to_uri(path), path, sources[i]);
+    }
+
+    int32_t length;
+    char *text;
+    while (!s.exit && (text = read_message(&length))) {
+        Arena arena = new_arena(64 * (ptrdiff_t) length + 4096);
+        Arena message_arena = arena;
+        JsonParser parser = {{length, text}, 0, &message_arena};
+        Json *message = parse_json_value(&parser, 0);
+
+        if (message) {
+            handle_message(&s, message);
+        } else {
+            send_error(NULL, -32700, "parse error");
+        }
+
+        delete_arena(&arena);
+        free(text);
+    }
+
+    release_analysis(&s);
+    for (int32_t i = 0; i < s.documents.len; i++) {
+        free_document(&s.documents.ptr[i]);
+    }
+    free(s.documents.ptr);
+    set_diagnostic_handler(NULL, NULL);
+    delete_arena(&s.scratch);
+    delete_arena(&s.permanent);
+    return s.shutdown ? 0 : 1;
+}
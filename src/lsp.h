@@ -0,0 +1,9 @@
+#pragma once
+
+#include "adt.h"
+#include "fwd.h"
+
+// Speaks the Language Server Protocol over stdin and stdout. The given files
+// are analyzed together with every document the client opens. Takes ownership
+// of `sources`.
+int run_language_server(Options *options, int file_count, char **paths, String *sources);
@@ -1,19 +1,28 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "adt.h"
 #include "arena.h"
+#include "call-graph.h"
 #include "data/ast.h"
 #include "data/tir.h"
 #include "diagnostic.h"
+#include "front-end.h"
 #include "fwd.h"
 #include "gen.h"
 #include "hash.h"
 #include "lex.h"
+#include "lsp.h"
 #include "parse.h"
 #include "print.h"
-#include "role-analysis.h"
-#include "tir-analysis.h"
+#include "shard.h"
+#include "stats.h"
 #include "tir2mir.h"
 #include "type-analysis.h"
 
+#include <omp.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,7 +33,24 @@ static void print_help(void) {
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -help                    Display this information.\n");
     fprintf(stderr, "  -print-debug             Display debug information about the intermediate representations.\n");
+    fprintf(stderr, "  -lazy                    Only type check the bodies of functions reachable from main.\n");
+    fprintf(stderr, "  -bounds-check            Trap on out of bounds array and slice indices.\n");
+    fprintf(stderr, "  -lsp                     Run a language server on stdin and stdout for the files and open documents.\n");
+    fprintf(stderr, "  -verify-determinism      Also compile with a single thread and fail if the output differs.\n");
+    fprintf(stderr, "  -ir-stats                Print the size of every intermediate representation per function.\n");
+    fprintf(stderr, "  -MD                      Write the source files the output depends on to a.d as a Makefile rule.\n");
     fprintf(stderr, "  -backend=<backend>       Specify the backend that will be used.\n");
+    fprintf(stderr, "  -MF=<file>               Same as -MD, but write the rule to <file>.\n");
+    fprintf(stderr, "  -profile=<file>          Order functions by the call counts in <file> instead of estimating them.\n");
+    fprintf(stderr, "                           Every line is \"<function> <count>\", where <function> is the name in\n");
+    fprintf(stderr, "                           the source or the symbol with its fileN_ prefix. Lines starting\n");
+    fprintf(stderr, "                           with # are ignored.\n");
+    fprintf(stderr, "  -target=<triple>         Generate code for <triple> instead of the host.\n");
+    fprintf(stderr, "  -march=<cpu>             Tune and select instructions for <cpu> (LLVM backend).\n");
+    fprintf(stderr, "  -mcpu=<cpu>              Same as -march.\n");
+    fprintf(stderr, "  -mattr=<features>        Enable or disable CPU features, e.g. +avx2,-avx512f (LLVM backend).\n");
+    fprintf(stderr, "  -shard=<i>/<n>           Generate code only for every <n>th function, starting at <i>, into a.<i>.c or a.<i>.ll.\n");
+    fprintf(stderr, "  -merge-shards=<n>        Combine the outputs of shards 0 to <n>-1 into a.c or a.ll instead of compiling.\n");
 }
 
 static Backend parse_backend(String value) {
@@ -67,160 +93,274 @@ static void print_tokens(char const *path, String source) {
     printf("}\n");
 }
 
-static String read_file(char const *path) {
-    FILE *file = fopen(path, "r");
-    String buffer = {0};
+static bool files_equal(char const *a_path, char const *b_path) {
+    String a = read_file(a_path);
+    String b = read_file(b_path);
+    bool equal = a.len == b.len && (a.len == 0 || memcmp(a.ptr, b.ptr, a.len) == 0);
+    free((void *) a.ptr);
+    free((void *) b.ptr);
+    return equal;
+}
+
+static char const *output_path(Options *options) {
+    static char path[32];
+    char const *extension = options->backend == BACKEND_LLVM ? "ll" : "c";
 
-    if (!file) {
-        return buffer;
+    if (options->shard_count) {
+        snprintf(path, sizeof(path), "a.%d.%s", options->shard, extension);
+    } else {
+        snprintf(path, sizeof(path), "a.%s", extension);
     }
 
-    fseek(file, 0, SEEK_END);
-    long length = ftell(file);
-    fseek(file, 0, SEEK_SET);
-
-    if (length >= 0) {
-        char *data = malloc(length);
+    return path;
+}
 
-        if (data) {
-            if (fread(data, 1, (size_t) length, file) == (size_t) length) {
-                buffer.ptr = data;
-                buffer.len = length;
-            } else {
-                free(data);
-            }
+static void write_escaped_path(FILE *stream, char const *path) {
+    for (char const *c = path; *c; c++) {
+        if (*c == ' ' || *c == '#') {
+            fputc('\\', stream);
+        } else if (*c == '$') {
+            fputc('$', stream);
         }
+        fputc(*c, stream);
     }
-
-    fclose(file);
-    return buffer;
 }
 
-typedef struct {
-    char **paths;
-    String *sources;
-    Ast *asts;
-    File *files;
-    Module *modules;
-    HashTable *global_scope;
-    HashTable *extern_symbols;
-    AstRefVec *ast_refs;
-    DefVec *functions;
-} GlobalScopeBuilder;
-
-static SourceLoc get_ast_location(GlobalScopeBuilder *b, AstRef def) {
-    SourceIndex token = get_ast_token(def.node, &b->asts[def.file]);
-    String name = id_token_to_string(b->sources[def.file], token);
-    return (SourceLoc) {
-        .path = b->paths[def.file],
-        .source = b->sources[def.file],
-        .where = token,
-        .len = name.len,
-        .mark = token,
-    };
-}
+static int write_depfile(Options *options, int file_count, char **paths, bool *used_files) {
+    FILE *stream = fopen(options->depfile, "w");
 
-static String get_string_from_location(SourceLoc const *loc) {
-    return substring(loc->source, loc->where.index, loc->where.index + loc->len);
-}
+    if (!stream) {
+        fprintf(stderr, "failed to write to file \"%s\"\n", options->depfile);
+        return -1;
+    }
 
-static Symbol lookup(GlobalScopeBuilder *b, int32_t file, String name) {
-    uint32_t *file_def = htable_lookup(&b->files[file].scope, name);
-    if (file_def) {
-        return (Symbol) {.kind = SYM_GLOBAL, .global = {*file_def}};
+    write_escaped_path(stream, output_path(options));
+    fprintf(stream, ":");
+    for (int i = 0; i < file_count; i++) {
+        if (used_files[i]) {
+            fprintf(stream, " \\\n  ");
+            write_escaped_path(stream, paths[i]);
+        }
     }
+    fprintf(stream, "\n");
 
-    int32_t module = b->files[file].module;
+    fclose(stream);
+    return 0;
+}
 
-    uint32_t *private_def = htable_lookup(&b->modules[module].private_scope, name);
-    if (private_def) {
-        return (Symbol) {.kind = SYM_GLOBAL, .global = {*private_def}};
+static int compile(Options *options, int file_count, char **paths, String *sources, Arena permanent_arena, Arena scratch_arena) {
+    Ast *asts = arena_alloc(&permanent_arena, Ast, file_count);
+    // Diagnostics are printed in file order once every file is parsed, so that
+    // they do not depend on how the files were scheduled.
+    char **diagnostics = arena_alloc(&permanent_arena, char *, file_count);
+    size_t *diagnostic_sizes = arena_alloc(&permanent_arena, size_t, file_count);
+    int err = 0;
+    #pragma omp parallel for reduction (||:err)
+    for (int i = 0; i < file_count; i++) {
+        FILE *stream = open_memstream(&diagnostics[i], &diagnostic_sizes[i]);
+        redirect_diagnostics(stream);
+        String source = sources[i];
+        if (!source.len || parse_ast(&asts[i], paths[i], source)) {
+            err = 1;
+        }
+        redirect_diagnostics(NULL);
+        if (stream) {
+            fclose(stream);
+        }
     }
-
-    uint32_t *public_def = htable_lookup(&b->modules[module].public_scope, name);
-    if (public_def) {
-        return (Symbol) {.kind = SYM_GLOBAL, .global = {*public_def}};
+    for (int i = 0; i < file_count; i++) {
+        if (diagnostics[i]) {
+            fwrite(diagnostics[i], 1, diagnostic_sizes[i], stderr);
+            free(diagnostics[i]);
+        }
+    }
+    if (err) {
+        return -1;
+    }
+    if (options->print_debug) {
+        for (int i = 0; i < file_count; i++) {
+            print_ast(paths[i], sources[i], &asts[i]);
+        }
     }
 
-    uint32_t *builtin_def = htable_lookup(b->global_scope, name);
-    if (builtin_def) {
-        return (Symbol) {.kind = SYM_BUILTIN, .global = {*builtin_def}};
+    FrontEnd front = {
+        .file_count = file_count,
+        .paths = paths,
+        .sources = sources,
+        .asts = asts,
+    };
+    err = analyze_front_end(&front, options, &permanent_arena, scratch_arena);
+    if (err) {
+        return -1;
     }
+    bool *used_files = options->depfile ? find_used_files(&front, &permanent_arena, scratch_arena) : NULL;
 
-    return (Symbol) {0};
-}
+    IrStats ir_stats = {0};
+    if (options->ir_stats) {
+        ir_stats.file_count = file_count;
+        ir_stats.ast_nodes = arena_alloc(&permanent_arena, int32_t, file_count);
+        for (int32_t i = 0; i < file_count; i++) {
+            ir_stats.ast_nodes[i] = asts[i].nodes.len;
+        }
+    }
 
-static int add_global(GlobalScopeBuilder *b, AstRef def) {
-    int32_t module = b->files[def.file].module;
-    Ast *ast = &b->asts[def.file];
-    HashTable *scope = &b->modules[module].private_scope;
-    if (get_ast_tag(def.node, ast) == AST_PUBLIC) {
-        scope = &b->modules[module].public_scope;
-        def.node = get_ast_unary(def.node, ast);
+    // Nothing after type checking reads the sources, the ASTs, the RIR or the
+    // scopes. The front end's pages of the scratch arena are returned as well.
+    free_scopes(&front);
+    for (int32_t i = 0; i < file_count; i++) {
+        free_ast(&asts[i]);
+        free((void *) sources[i].ptr);
+        sources[i] = (String) {0};
     }
+    delete_arena(&scratch_arena);
+    scratch_arena = new_arena(64 << 20);
+    TirOutput tir_output = front.tir_output;
 
-    bool is_extern = false;
-    bool is_function = false;
-    switch (get_ast_tag(def.node, ast)) {
-        case AST_IMPORT: {
-            scope = &b->files[def.file].scope;
-            break;
-        }
-        case AST_FUNCTION: {
-            is_function = true;
-            break;
+    MirResult mir_result = tir_to_mir(&(MirAnalysisInput) {
+        .functions = tir_output.declarations.functions.ptr,
+        .main = tir_output.declarations.main,
+        .global_deps = &tir_output.global_deps,
+        .insts = tir_output.insts,
+        .function_count = tir_output.declarations.functions.len,
+        .target = options->target,
+        .bounds_check = options->bounds_check,
+        .shard = options->shard,
+        .shard_count = options->shard_count,
+    }, &permanent_arena, scratch_arena);
+
+    if (options->ir_stats) {
+        ir_stats.function_count = tir_output.declarations.functions.len;
+        ir_stats.tir_insts = arena_alloc(&permanent_arena, int32_t, ir_stats.function_count);
+        for (int32_t i = 0; i < ir_stats.function_count; i++) {
+            ir_stats.tir_insts[i] = tir_output.insts[i].insts.insts.len;
         }
-        case AST_STRUCT:
-        case AST_ENUM:
-        case AST_NEWTYPE:
-        case AST_CONST: {
+    }
+
+    // The backends only need the types and values of each function.
+    for (int32_t i = 0; i < tir_output.declarations.functions.len; i++) {
+        free_tir_insts(&tir_output.insts[i].insts);
+    }
+
+    CallGraphInput call_graph_input = {
+        .mir_result = &mir_result,
+        .functions = tir_output.declarations.functions.ptr,
+        .main = tir_output.declarations.main,
+        .global_deps = &tir_output.global_deps,
+        .insts = tir_output.insts,
+    };
+    // Every shard declares every function, so the declarations must not
+    // depend on calls made by other shards.
+    if (!options->shard_count) {
+        CallGraph call_graph = build_call_graph(&call_graph_input, &permanent_arena, scratch_arena);
+        order_functions(&call_graph_input, &call_graph, options->profile, scratch_arena);
+    }
+    GenInput gen_input = {
+        .declarations = tir_output.declarations,
+        .global_deps = tir_output.global_deps,
+        .insts = tir_output.insts,
+        .mir_result = &mir_result,
+        .path = output_path(options),
+        .shard = options->shard,
+        .shard_count = options->shard_count,
+    };
+    switch (options->backend) {
+        case BACKEND_C: {
+            gen_c(&gen_input, options->target, scratch_arena);
             break;
         }
-        case AST_EXTERN_FUNCTION:
-        case AST_EXTERN_MUT: {
-            is_extern = true;
+        case BACKEND_LLVM: {
+            gen_llvm(&gen_input, options->target, &options->machine, scratch_arena);
             break;
         }
-        default: {
-            return 0;
-        }
     }
 
-    SourceLoc loc = get_ast_location(b, def);
-    String name = get_string_from_location(&loc);
+    if (options->ir_stats) {
+        print_ir_stats(stdout, &ir_stats, paths, &gen_input, options->backend, scratch_arena);
+    }
 
-    uint32_t *prev_extern_sym = is_extern ? htable_lookup(b->extern_symbols, name) : NULL;
-    if (prev_extern_sym) {
-        print_diagnostic(&loc, &(Diagnostic) {.kind = ERROR_MULTIPLE_EXTERN_DEFINITION});
-        AstRef prev_ref = b->ast_refs->ptr[*prev_extern_sym];
-        SourceLoc prev_loc = get_ast_location(b, prev_ref);
-        print_diagnostic(&prev_loc, &(Diagnostic) {.kind = NOTE_PREVIOUS_DEFINITION});
-        return 1;
+    if (used_files) {
+        return write_depfile(options, file_count, paths, used_files);
     }
 
-    Symbol prev_sym = lookup(b, def.file, name);
-    if (prev_sym.kind != SYM_UNDEFINED) {
-        print_diagnostic(&loc, &(Diagnostic) {.kind = ERROR_MULTIPLE_DEFINITION});
-        if (prev_sym.kind == SYM_GLOBAL) {
-            AstRef prev_ref = b->ast_refs->ptr[prev_sym.global.id];
-            SourceLoc prev_loc = get_ast_location(b, prev_ref);
-            print_diagnostic(&prev_loc, &(Diagnostic) {.kind = NOTE_PREVIOUS_DEFINITION});
-        } else {
-            print_diagnostic(&loc, &(Diagnostic) {.kind = NOTE_PREVIOUS_BUILTIN_DEFINITION});
+    return 0;
+}
+
+// Compiles with one thread in a child process as well, writing to a temporary
+// directory, and fails if the outputs or the diagnostics differ.
+static int verify_determinism(Options *options, int file_count, char **paths, String *sources, Arena permanent_arena, Arena scratch_arena) {
+    char dir[] = "/tmp/jellyc-XXXXXX";
+
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "failed to create a temporary directory\n");
+        return -1;
+    }
+
+    char child_log[sizeof(dir) + 16];
+    char parent_log[sizeof(dir) + 16];
+    snprintf(child_log, sizeof(child_log), "%s/child.txt", dir);
+    snprintf(parent_log, sizeof(parent_log), "%s/parent.txt", dir);
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t child = fork();
+
+    if (child < 0) {
+        fprintf(stderr, "failed to start the single-threaded compile\n");
+        rmdir(dir);
+        return -1;
+    }
+
+    if (child == 0) {
+        omp_set_num_threads(1);
+        options->depfile = NULL;
+        if (!freopen("/dev/null", "w", stdout) || !freopen(child_log, "w", stderr) || chdir(dir)) {
+            exit(-1);
         }
-        return 1;
+        exit(compile(options, file_count, paths, sources, permanent_arena, scratch_arena));
     }
 
-    int32_t entry = b->ast_refs->len;
-    vec_push(b->ast_refs, def);
-    htable_try_insert(scope, name, entry);
-    if (is_extern) {
-        htable_try_insert(b->extern_symbols, name, entry);
+    // The diagnostics of this compile are captured as well, and shown once
+    // both are done.
+    int saved_stderr = dup(STDERR_FILENO);
+    FILE *log = fopen(parent_log, "w");
+    if (log) {
+        dup2(fileno(log), STDERR_FILENO);
+        fclose(log);
     }
-    if (is_function) {
-        vec_push(b->functions, (DefId) {entry});
+
+    int threads = omp_get_max_threads() > 2 ? omp_get_max_threads() : 2;
+    omp_set_num_threads(threads);
+    int err = compile(options, file_count, paths, sources, permanent_arena, scratch_arena);
+    int status;
+    waitpid(child, &status, 0);
+
+    fflush(stderr);
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+    String diagnostics = read_file(parent_log);
+    if (diagnostics.len) {
+        fwrite(diagnostics.ptr, 1, diagnostics.len, stderr);
     }
-    return 0;
+    free((void *) diagnostics.ptr);
+
+    char const *output = output_path(options);
+    char copy[sizeof(dir) + 32];
+    snprintf(copy, sizeof(copy), "%s/%s", dir, output);
+    bool child_failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+
+    if (!files_equal(parent_log, child_log)) {
+        fprintf(stderr, "diagnostics differ between 1 and %d threads\n", threads);
+        err = -1;
+    } else if (!err && (child_failed || !files_equal(output, copy))) {
+        fprintf(stderr, "output differs between 1 and %d threads\n", threads);
+        err = -1;
+    }
+
+    remove(copy);
+    remove(child_log);
+    remove(parent_log);
+    rmdir(dir);
+    return err;
 }
 
 int main(int argc, char **argv) {
@@ -244,6 +384,49 @@ int main(int argc, char **argv) {
                 continue;
             }
 
+            if (equals(key, (String) Str("profile"))) {
+                options.profile = value.ptr;
+                continue;
+            }
+
+            if (equals(key, (String) Str("target"))) {
+                options.machine.triple = value.ptr;
+                options.target = get_triple_target(value.ptr);
+                continue;
+            }
+
+            if (equals(key, (String) Str("march")) || equals(key, (String) Str("mcpu"))) {
+                options.machine.cpu = value.ptr;
+                continue;
+            }
+
+            if (equals(key, (String) Str("mattr"))) {
+                options.machine.features = value.ptr;
+                continue;
+            }
+
+            if (equals(key, (String) Str("MF"))) {
+                options.depfile = value.ptr;
+                continue;
+            }
+
+            if (equals(key, (String) Str("shard"))) {
+                if (sscanf(value.ptr, "%d/%d", &options.shard, &options.shard_count) != 2
+                    || options.shard_count < 1 || options.shard < 0 || options.shard >= options.shard_count) {
+                    fprintf(stderr, "expected -shard=<i>/<n> with 0 <= i < n\n");
+                    return -1;
+                }
+                continue;
+            }
+
+            if (equals(key, (String) Str("merge-shards"))) {
+                if (sscanf(value.ptr, "%d", &options.merge_shard_count) != 1 || options.merge_shard_count < 1) {
+                    fprintf(stderr, "expected -merge-shards=<n> with n > 0\n");
+                    return -1;
+                }
+                continue;
+            }
+
             fprintf(stderr, "ignored unknown argument ");
             fwrite(key.ptr, 1, key.len, stderr);
             fprintf(stderr, "\n");
@@ -260,12 +443,48 @@ int main(int argc, char **argv) {
                 continue;
             }
 
+            if (equals(option, (String) Str("lazy"))) {
+                options.lazy = true;
+                continue;
+            }
+
+            if (equals(option, (String) Str("bounds-check"))) {
+                options.bounds_check = true;
+                continue;
+            }
+
+            if (equals(option, (String) Str("lsp"))) {
+                options.language_server = true;
+                continue;
+            }
+
+            if (equals(option, (String) Str("verify-determinism"))) {
+                options.verify_determinism = true;
+                continue;
+            }
+
+            if (equals(option, (String) Str("ir-stats"))) {
+                options.ir_stats = true;
+                continue;
+            }
+
+            if (equals(option, (String) Str("MD"))) {
+                if (!options.depfile) {
+                    options.depfile = "a.d";
+                }
+                continue;
+            }
+
             fprintf(stderr, "ignored unknown option ");
             fwrite(option.ptr, 1, option.len, stderr);
             fprintf(stderr, "\n");
         }
     }
 
+    if (options.merge_shard_count) {
+        return merge_shards(options.backend, options.merge_shard_count);
+    }
+
     int file_count = argc - o;
     char **paths = argv + o;
 
@@ -293,173 +512,14 @@ int main(int argc, char **argv) {
     }
 
     init_diagnostic_module();
-    Ast *asts = arena_alloc(&permanent_arena, Ast, file_count);
-    int err = 0;
-    #pragma omp parallel for reduction (||:err)
-    for (int i = 0; i < file_count; i++) {
-        String source = sources[i];
-        if (!source.len || parse_ast(&asts[i], paths[i], source)) {
-            err = 1;
-        }
-    }
-    if (err) {
-        return -1;
-    }
-    if (options.print_debug) {
-        for (int i = 0; i < file_count; i++) {
-            print_ast(paths[i], sources[i], &asts[i]);
-        }
-    }
 
-    File *files = arena_alloc(&permanent_arena, File, file_count);
-    HashTable module_table = htable_init();
-    for (int32_t i = 0; i < file_count; i++) {
-        SourceIndex module_token = get_ast_token(null_ast, &asts[i]);
-        String module_name = id_token_to_string(sources[i], module_token);
-        int32_t new_module = module_table.count;
-        int64_t module = htable_try_insert(&module_table, module_name, new_module);
-        if (module < 0) {
-            module = new_module;
-        }
-        files[i].module = module;
-        files[i].scope = htable_init();
-    }
-
-    Module *modules = arena_alloc(&permanent_arena, Module, module_table.count);
-    for (int32_t i = 0; i < (int32_t) module_table.count; i++) {
-        modules[i].public_scope = htable_init();
-        modules[i].private_scope = htable_init();
-    }
-
-    HashTable global_scope = htable_init();
-    #define TYPE(type) htable_try_insert(&global_scope, (String) Str(#type), BUILTIN_##type);
-    #include "simple-types"
-    htable_try_insert(&global_scope, (String) Str("`Size"), BUILTIN_SIZE_TAG);
-    htable_try_insert(&global_scope, (String) Str("`Alignment"), BUILTIN_ALIGNMENT_TAG);
-    htable_try_insert(&global_scope, (String) Str("`align_of"), BUILTIN_ALIGNOF);
-    htable_try_insert(&global_scope, (String) Str("`size_of"), BUILTIN_SIZEOF);
-    htable_try_insert(&global_scope, (String) Str("`zero_extend"), BUILTIN_ZERO_EXTEND);
-    htable_try_insert(&global_scope, (String) Str("`slice"), BUILTIN_SLICE);
-    htable_try_insert(&global_scope, (String) Str("`Affine"), BUILTIN_AFFINE);
-    htable_try_insert(&global_scope, (String) Str("`ArrayLength"), BUILTIN_ARRAY_LENGTH_TYPE);
-
-    AstRefVec ast_refs = {0};
-    DefVec functions = {0};
-    {
-        HashTable extern_symbols = htable_init();
-        GlobalScopeBuilder b = {0};
-        b.paths = paths;
-        b.sources = sources;
-        b.asts = asts;
-        b.files = files;
-        b.modules = modules;
-        b.global_scope = &global_scope;
-        b.extern_symbols = &extern_symbols;
-        b.ast_refs = &ast_refs;
-        b.functions = &functions;
-        for (int32_t i = 0; i < file_count; i++) {
-            AstList list = get_ast_list(null_ast, &asts[i]);
-            for (int32_t j = 0; j < list.count; j++) {
-                add_global(&b, (AstRef) {list.nodes[j], i});
-            }
-        }
-        htable_free(&extern_symbols);
+    if (options.language_server) {
+        return run_language_server(&options, file_count, paths, sources);
     }
 
-    Rir *rirs = arena_alloc(&permanent_arena, Rir, file_count);
-    for (int32_t i = 0; i < file_count; i++) {
-        rirs[i].tags = arena_alloc(&permanent_arena, unsigned char, asts[i].nodes.len);
-        rirs[i].data = arena_alloc(&permanent_arena, int32_t, asts[i].nodes.len);
-    }
-
-    RirTopInput rir_input = {0};
-    rir_input.file_count = file_count;
-    rir_input.paths = paths;
-    rir_input.sources = sources;
-    rir_input.asts = asts;
-    rir_input.files = files;
-    rir_input.module_table = &module_table;
-    rir_input.modules = modules;
-    rir_input.global_scope = &global_scope;
-    rir_input.rirs = rirs;
-    rir_input.ast_refs = ast_refs.ptr;
-    rir_input.def_count = ast_refs.len;
-    rir_input.functions = functions.ptr;
-    rir_input.function_count = functions.len;
-    RirTopOutput rir_output = analyze_roles(&rir_input, &permanent_arena, scratch_arena);
-
-    TirInput tir_input = {0};
-    tir_input.options = &options;
-    tir_input.paths = paths;
-    tir_input.sources = sources;
-    tir_input.asts = asts;
-    tir_input.files = files;
-    tir_input.module_table = &module_table;
-    tir_input.modules = modules;
-    tir_input.global_scope = &global_scope;
-    tir_input.ast_refs = ast_refs.ptr;
-    tir_input.def_count = ast_refs.len;
-    tir_input.order_count = rir_output.count;
-    tir_input.local_ast_refs = rir_output.local_ast_refs;
-    tir_input.order = rir_output.order;
-    tir_input.rirs = rirs;
-    tir_input.functions = functions.ptr;
-    tir_input.function_count = functions.len;
-    TirOutput tir_output = analyze_types(&tir_input, &permanent_arena, scratch_arena);
-    if (rir_output.error || tir_output.error) {
-        return -1;
-    }
-    if (options.print_debug) {
-        for (int32_t i = 0; i < tir_output.declarations.functions.len; i++) {
-            TirContext ctx = {
-                .global = &tir_output.global_deps,
-                .thread = &tir_output.insts[i],
-            };
-            int32_t name = get_value_data(ctx, tir_output.declarations.functions.ptr[i])->index;
-            print_tir(ctx, &ctx.global->strtab.ptr[name], &tir_output.insts[i].insts, tir_output.insts[i].first);
-        }
-    }
-    err = check_substructural_types(
-        &(SubstructuralAnalysisInput) {
-            .paths = paths,
-            .sources = sources,
-            .asts = asts,
-            .ast_refs = ast_refs.ptr,
-            .global_deps = &tir_output.global_deps,
-            .insts = tir_output.insts,
-            .functions = functions.ptr,
-            .function_count = functions.len,
-        },
-        scratch_arena
-    );
-    if (err) {
-        return -1;
+    if (options.verify_determinism) {
+        return verify_determinism(&options, file_count, paths, sources, permanent_arena, scratch_arena);
     }
 
-    MirResult mir_result = tir_to_mir(&(MirAnalysisInput) {
-        .paths = paths,
-        .sources = sources,
-        .asts = asts,
-        .ast_refs = ast_refs.ptr,
-        .functions = tir_output.declarations.functions.ptr,
-        .global_deps = &tir_output.global_deps,
-        .insts = tir_output.insts,
-        .function_count = tir_output.declarations.functions.len,
-    }, &permanent_arena, scratch_arena);
-    GenInput gen_input = {
-        .declarations = tir_output.declarations,
-        .global_deps = tir_output.global_deps,
-        .insts = tir_output.insts,
-        .mir_result = &mir_result,
-    };
-    switch (options.backend) {
-        case BACKEND_C: {
-            gen_c(&gen_input, options.target);
-            break;
-        }
-        case BACKEND_LLVM: {
-            gen_llvm(&gen_input, options.target, scratch_arena);
-            break;
-        }
-    }
+    return compile(&options, file_count, paths, sources, permanent_arena, scratch_arena);
 }
@@ -0,0 +1,347 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "adt.h"
+#include "arena.h"
+#include "data/tir.h"
+#include "float.h"
+#include "hash.h"
+#include "lex.h"
+#include "wrappers.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Benchmarks the building blocks of the compiler one at a time on synthetic
+// inputs, so that a change to one of them can be measured without the noise of
+// a whole compile. Every benchmark is run several times and the fastest run is
+// reported.
+
+#define RUNS 5
+#define THREAD_TYPES 1024
+
+typedef struct {
+    int64_t ops;
+    // Memory held by the data structure at the end of the run, or for the
+    // benchmarks that read an input, the size of the input.
+    int64_t bytes;
+    double seconds;
+} Result;
+
+typedef struct {
+    char const *name;
+    Result (*run)(int64_t n, Arena scratch);
+    // Chosen so that every run takes a few milliseconds.
+    int64_t default_count;
+} Benchmark;
+
+// Keeps the compiler from removing the work of a benchmark.
+static volatile uint64_t sink;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state = *state * 6364136223846793005u + 1442695040888963407u;
+    return *state >> 33;
+}
+
+static String *make_keys(int64_t n, Arena *arena) {
+    String *keys = arena_alloc(arena, String, n);
+    uint64_t state = 1;
+
+    for (int64_t i = 0; i < n; i++) {
+        char *key = arena_alloc(arena, char, 24);
+        int len = snprintf(key, 24, "id_%lu_%ld", next_random(&state) % 1000, i);
+        keys[i] = (String) {len, key};
+    }
+
+    return keys;
+}
+
+// Slots are a key length, a key pointer and a value, see hash.c.
+static int64_t htable_bytes(HashTable const *table) {
+    return table->capacity * (2 * sizeof(uint32_t) + sizeof(char const *));
+}
+
+static Result bench_htable_try_insert(int64_t n, Arena scratch) {
+    String *keys = make_keys(n, &scratch);
+    double start = now();
+    HashTable table = htable_init();
+
+    for (int64_t i = 0; i < n; i++) {
+        htable_try_insert(&table, keys[i], i);
+    }
+
+    Result result = {n, htable_bytes(&table), now() - start};
+    htable_free(&table);
+    return result;
+}
+
+static Result bench_htable_lookup(int64_t n, Arena scratch) {
+    String *keys = make_keys(n, &scratch);
+    HashTable table = htable_init();
+
+    for (int64_t i = 0; i < n; i++) {
+        htable_try_insert(&table, keys[i], i);
+    }
+
+    double start = now();
+    uint64_t sum = 0;
+
+    for (int64_t i = 0; i < n; i++) {
+        sum += *htable_lookup(&table, keys[(i * 7919) % n]);
+    }
+
+    Result result = {n, htable_bytes(&table), now() - start};
+    sink = sum;
+    htable_free(&table);
+    return result;
+}
+
+static Result bench_next_token(int64_t n, Arena scratch) {
+    static char const snippet[] =
+        "function sum(xs []i64, scale f64) -> i64 {\n"
+        "    let total = 0\n"
+        "    for i in 0..`ArrayLength[xs] {\n"
+        "        total += xs[i] * 0x1f + 'a' // comment\n"
+        "    }\n"
+        "    return total >> 2\n"
+        "}\n";
+    int64_t length = sizeof(snippet) - 1;
+    // The snippet has about 60 tokens.
+    int64_t copies = n / 60 + 1;
+    char *source = arena_alloc(&scratch, char, copies * length);
+
+    for (int64_t i = 0; i < copies; i++) {
+        memcpy(&source[i * length], snippet, length);
+    }
+
+    double start = now();
+    Lexer lexer = new_lexer((String) {copies * length, source});
+    int64_t count = 0;
+
+    while (next_token(&lexer).tag != TOK_SENTINEL) {
+        count++;
+    }
+
+    return (Result) {count, copies * length, now() - start};
+}
+
+static Result bench_parse_float(int64_t n, Arena scratch) {
+    String *literals = arena_alloc(&scratch, String, n);
+    uint64_t state = 1;
+    int64_t bytes = 0;
+
+    for (int64_t i = 0; i < n; i++) {
+        char *literal = arena_alloc(&scratch, char, 48);
+        int len;
+
+        // Mostly short literals, with some that need more than 19 digits.
+        switch (i % 4) {
+            case 0: len = snprintf(literal, 48, "%lu.%lu", next_random(&state) % 1000, next_random(&state) % 100); break;
+            case 1: len = snprintf(literal, 48, "%lu.%lue-%lu", next_random(&state) % 10, next_random(&state), next_random(&state) % 300); break;
+            case 2: len = snprintf(literal, 48, "%lue%lu", next_random(&state) % 100000, next_random(&state) % 300); break;
+            default: len = snprintf(literal, 48, "0.%lu%lu%lu", next_random(&state), next_random(&state), next_random(&state)); break;
+        }
+
+        literals[i] = (String) {len, literal};
+        bytes += len;
+    }
+
+    double start = now();
+    double sum = 0.0;
+
+    for (int64_t i = 0; i < n; i++) {
+        sum += parse_float(literals[i], scratch);
+    }
+
+    sink = (uint64_t) sum;
+    return (Result) {n, bytes, now() - start};
+}
+
+static int64_t type_list_bytes(TypeList const *types) {
+    return types->types.cap * (sizeof(TypeData) + 1) + types->extra.cap * sizeof(int32_t) + types->set.capacity * sizeof(TypeId);
+}
+
+static TypeId const element_types[] = {type_i8, type_i16, type_i32, type_i64, type_isize, type_f32, type_f64, type_bool};
+
+// Every type is new, so each call hashes, probes and appends. The table is
+// reset every THREAD_TYPES types, since the compiler interns most types in the
+// small table of one function.
+static Result bench_new_type(int64_t n, Arena scratch) {
+    (void) scratch;
+    TirDependencies deps = {0};
+    TirContext ctx = {&deps, NULL};
+    int64_t bytes = 0;
+    double start = now();
+
+    for (int64_t i = 0; i < n; i++) {
+        if (i % THREAD_TYPES == 0) {
+            bytes += type_list_bytes(&deps.types);
+            free_tir_deps(&deps);
+            init_tir_deps(&deps);
+        }
+        int64_t k = i % THREAD_TYPES;
+        new_array_type(ctx, new_array_length_type(ctx, k / ArrayLength(element_types)), element_types[k % ArrayLength(element_types)]);
+    }
+
+    bytes += type_list_bytes(&deps.types);
+    Result result = {2 * n, bytes, now() - start};
+    free_tir_deps(&deps);
+    return result;
+}
+
+// Every type was interned before, so each call only hashes and probes.
+static Result bench_existing_type(int64_t n, Arena scratch) {
+    (void) scratch;
+    TirDependencies deps = {0};
+    init_tir_deps(&deps);
+    TirContext ctx = {&deps, NULL};
+
+    for (int64_t k = 0; k < THREAD_TYPES; k++) {
+        new_array_type(ctx, new_array_length_type(ctx, k / ArrayLength(element_types)), element_types[k % ArrayLength(element_types)]);
+    }
+
+    double start = now();
+    uint64_t sum = 0;
+
+    for (int64_t i = 0; i < n; i++) {
+        int64_t k = (i * 7919) % THREAD_TYPES;
+        TypeId length = new_array_length_type(ctx, k / ArrayLength(element_types));
+        sum += new_array_type(ctx, length, element_types[k % ArrayLength(element_types)]).id;
+    }
+
+    // Bytes per type in the table, like bench_new_type.
+    Result result = {2 * n, type_list_bytes(&deps.types) * n / THREAD_TYPES, now() - start};
+    sink = sum;
+    free_tir_deps(&deps);
+    return result;
+}
+
+static Result bench_vec_grow(int64_t n, Arena scratch) {
+    (void) scratch;
+    Vec(int64_t) vec = {0};
+    double start = now();
+
+    for (int64_t i = 0; i < n; i++) {
+        vec_push(&vec, i);
+    }
+
+    Result result = {n, vec.cap * sizeof(int64_t), now() - start};
+    sink = vec.ptr[n - 1];
+    free(vec.ptr);
+    return result;
+}
+
+static Result bench_sum_vec_reserve(int64_t n, Arena scratch) {
+    (void) scratch;
+    SumVec(int64_t) vec = {0};
+    double start = now();
+
+    for (int64_t i = 0; i < n; i++) {
+        sum_vec_push(&vec, i, (unsigned char) i);
+    }
+
+    Result result = {n, vec.cap * (sizeof(int64_t) + 1), now() - start};
+    sink = vec.datas[n - 1];
+    free(vec.datas);
+    return result;
+}
+
+static Result bench_arena_alloc(int64_t n, Arena scratch) {
+    char *begin = scratch.start;
+    double start = now();
+
+    for (int64_t i = 0; i < n; i++) {
+        // Odd sizes and alignments, like the AST and MIR side tables.
+        switch (i % 3) {
+            case 0: arena_alloc(&scratch, int32_t, 3); break;
+            case 1: arena_alloc(&scratch, int64_t, 1); break;
+            default: arena_alloc(&scratch, char, 5); break;
+        }
+    }
+
+    return (Result) {n, scratch.start - begin, now() - start};
+}
+
+static Benchmark const benchmarks[] = {
+    {"htable_try_insert", bench_htable_try_insert, 1000000},
+    {"htable_lookup", bench_htable_lookup, 1000000},
+    {"next_token", bench_next_token, 1000000},
+    {"parse_float", bench_parse_float, 10000},
+    {"new_type", bench_new_type, 10000},
+    {"existing_type", bench_existing_type, 10000},
+    {"vec_grow", bench_vec_grow, 1000000},
+    {"sum_vec_reserve", bench_sum_vec_reserve, 1000000},
+    {"arena_alloc", bench_arena_alloc, 1000000},
+};
+
+static void print_help(void) {
+    fprintf(stderr, "Usage: jellyc-microbench [options] [benchmark...]\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -help                    Display this information.\n");
+    fprintf(stderr, "  -n=<count>               Run every benchmark for about <count> operations instead of its default.\n");
+    fprintf(stderr, "Benchmarks:\n");
+    for (int i = 0; i < ArrayLength(benchmarks); i++) {
+        fprintf(stderr, "  %s\n", benchmarks[i].name);
+    }
+}
+
+int main(int argc, char **argv) {
+    int64_t n = 0;
+    int o;
+
+    for (o = 1; o < argc && argv[o][0] == '-'; o++) {
+        if (strncmp(argv[o], "-n=", 3) == 0 && sscanf(argv[o] + 3, "%ld", &n) == 1 && n > 0) {
+            continue;
+        }
+
+        print_help();
+        return strcmp(argv[o], "-help") == 0 ? 0 : -1;
+    }
+
+    if (init_lex_module()) {
+        abort();
+    }
+
+    // The inputs are generated into the arena, so it is sized by the count.
+    int64_t max_count = n;
+    for (int i = 0; i < ArrayLength(benchmarks); i++) {
+        if (!n && benchmarks[i].default_count > max_count) {
+            max_count = benchmarks[i].default_count;
+        }
+    }
+    Arena scratch = new_arena(256 * max_count + (64 << 20));
+    printf("%-20s %12s %10s %10s\n", "benchmark", "ops", "ns/op", "bytes/op");
+
+    for (int i = 0; i < ArrayLength(benchmarks); i++) {
+        bool selected = o == argc;
+        for (int j = o; j < argc; j++) {
+            selected |= strcmp(argv[j], benchmarks[i].name) == 0;
+        }
+
+        if (!selected) {
+            continue;
+        }
+
+        Result best = {0};
+
+        for (int run = 0; run < RUNS; run++) {
+            Result result = benchmarks[i].run(n ? n : benchmarks[i].default_count, scratch);
+            if (run == 0 || result.seconds < best.seconds) {
+                best = result;
+            }
+        }
+
+        printf("%-20s %12ld %10.2f %10.2f\n", benchmarks[i].name, best.ops, best.seconds * 1e9 / best.ops, (double) best.bytes / best.ops);
+    }
+
+    delete_arena(&scratch);
+    return 0;
+}
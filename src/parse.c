@@ -914,9 +914,16 @@ int parse_ast(Ast *result, char const *path, String source) {
     delete_arena(&scratch);
 
     if (parser.error) {
+        free_ast(&parser.ast);
         return 1;
     }
 
     *result = parser.ast;
     return 0;
 }
+
+void free_ast(Ast *ast) {
+    free(ast->nodes.datas);
+    free(ast->extra.ptr);
+    *ast = (Ast) {0};
+}
@@ -4,3 +4,4 @@
 #include "data/ast.h"
 
 int parse_ast(Ast *result, char const *path, String source);
+void free_ast(Ast *ast);
@@ -0,0 +1,104 @@
+#include "shard.h"
+
+#include "adt.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The parts of one shard, split at the lines the backends write before and
+// after the functions of the shard.
+typedef struct {
+    String header;
+    String body;
+    String trailer;
+} Shard;
+
+static ptrdiff_t find_line(String s, ptrdiff_t start, String prefix) {
+    for (ptrdiff_t i = start; i + prefix.len <= s.len; i++) {
+        if ((i == 0 || s.ptr[i - 1] == '\n') && memcmp(&s.ptr[i], prefix.ptr, prefix.len) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static ptrdiff_t line_end(String s, ptrdiff_t start) {
+    char const *newline = memchr(&s.ptr[start], '\n', s.len - start);
+    return newline ? newline - s.ptr + 1 : s.len;
+}
+
+static bool split_shard(String source, String comment, Shard *shard) {
+    char begin[16];
+    char end[32];
+    snprintf(begin, sizeof(begin), "%sshard ", comment.ptr);
+    snprintf(end, sizeof(end), "%send of shard\n", comment.ptr);
+
+    ptrdiff_t begin_start = find_line(source, 0, (String) {strlen(begin), begin});
+    if (begin_start < 0) {
+        return false;
+    }
+
+    ptrdiff_t body_start = line_end(source, begin_start);
+    ptrdiff_t end_start = find_line(source, body_start, (String) {strlen(end), end});
+    if (end_start < 0) {
+        return false;
+    }
+
+    shard->header = substring(source, 0, begin_start);
+    shard->body = substring(source, body_start, end_start);
+    shard->trailer = substring(source, end_start + strlen(end), source.len);
+    return true;
+}
+
+int merge_shards(Backend backend, int32_t shard_count) {
+    char const *extension = backend == BACKEND_LLVM ? "ll" : "c";
+    String comment = backend == BACKEND_LLVM ? (String) Str("; ") : (String) Str("// ");
+    String *sources = calloc(shard_count, sizeof(String));
+    Shard *shards = calloc(shard_count, sizeof(Shard));
+    int err = 0;
+
+    for (int32_t i = 0; i < shard_count && !err; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "a.%d.%s", i, extension);
+        sources[i] = read_file(path);
+
+        if (!sources[i].len) {
+            fprintf(stderr, "failed to read shard \"%s\"\n", path);
+            err = -1;
+        } else if (!split_shard(sources[i], comment, &shards[i])) {
+            fprintf(stderr, "\"%s\" is not the output of a shard\n", path);
+            err = -1;
+        } else if (i > 0 && (!equals(shards[i].header, shards[0].header) || !equals(shards[i].trailer, shards[0].trailer))) {
+            fprintf(stderr, "\"%s\" was compiled from different sources or options than shard 0\n", path);
+            err = -1;
+        }
+    }
+
+    if (!err) {
+        char path[8];
+        snprintf(path, sizeof(path), "a.%s", extension);
+        FILE *stream = fopen(path, "w");
+
+        if (!stream) {
+            fprintf(stderr, "failed to write to file\n");
+            err = -1;
+        } else {
+            fwrite(shards[0].header.ptr, 1, shards[0].header.len, stream);
+            for (int32_t i = 0; i < shard_count; i++) {
+                fwrite(shards[i].body.ptr, 1, shards[i].body.len, stream);
+            }
+            fwrite(shards[0].trailer.ptr, 1, shards[0].trailer.len, stream);
+            fclose(stream);
+        }
+    }
+
+    for (int32_t i = 0; i < shard_count; i++) {
+        free((void *) sources[i].ptr);
+    }
+    free(sources);
+    free(shards);
+    return err;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "enums.h"
+
+#include <stdint.h>
+
+// Combines the outputs of `-shard=i/n` for every i into the usual output file
+// of the backend. Each shard repeats the declarations before its functions, so
+// those are written once and checked to be identical. Returns nonzero on
+// failure.
+int merge_shards(Backend backend, int32_t shard_count);
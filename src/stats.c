@@ -0,0 +1,188 @@
+#include "stats.h"
+
+#include "adt.h"
+#include "arena.h"
+#include "data/mir.h"
+#include "data/tir.h"
+#include "fwd.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char const *mir_tag_names[] = {
+    [MIR_PARAM] = "param",
+    [MIR_ALLOC] = "alloc",
+    [MIR_RET_SLOT] = "ret_slot",
+    [MIR_ASSIGN] = "assign",
+    [MIR_NOP] = "nop",
+    [MIR_INT] = "int",
+    [MIR_FLOAT] = "float",
+    [MIR_STRING] = "string",
+    [MIR_NULL] = "null",
+    [MIR_TIR_VALUE] = "tir_value",
+    [MIR_CONSTANT] = "constant",
+    [MIR_CLONE] = "clone",
+    [MIR_ADDRESS] = "address",
+    [MIR_DEREF] = "deref",
+    [MIR_LOAD] = "load",
+    [MIR_MINUS] = "minus",
+    [MIR_ADD] = "add",
+    [MIR_SUB] = "sub",
+    [MIR_MUL] = "mul",
+    [MIR_MULHI] = "mulhi",
+    [MIR_DIV] = "div",
+    [MIR_MOD] = "mod",
+    [MIR_NOT] = "not",
+    [MIR_AND] = "and",
+    [MIR_OR] = "or",
+    [MIR_XOR] = "xor",
+    [MIR_SHL] = "shl",
+    [MIR_SHR] = "shr",
+    [MIR_EQ] = "eq",
+    [MIR_NE] = "ne",
+    [MIR_LT] = "lt",
+    [MIR_GT] = "gt",
+    [MIR_LE] = "le",
+    [MIR_GE] = "ge",
+    [MIR_SELECT] = "select",
+    [MIR_ITOF] = "itof",
+    [MIR_ITRUNC] = "itrunc",
+    [MIR_SEXT] = "sext",
+    [MIR_ZEXT] = "zext",
+    [MIR_FTOI] = "ftoi",
+    [MIR_FTRUNC] = "ftrunc",
+    [MIR_FEXT] = "fext",
+    [MIR_PTR_CAST] = "ptr_cast",
+    [MIR_NEW_SLICE] = "new_slice",
+    [MIR_INDEX] = "index",
+    [MIR_CONST_INDEX] = "const_index",
+    [MIR_SLICE_INDEX] = "slice_index",
+    [MIR_ACCESS] = "access",
+    [MIR_BOUNDS_CHECK] = "bounds_check",
+    [MIR_CALL] = "call",
+    [MIR_BR] = "br",
+    [MIR_BR_IF] = "br_if",
+    [MIR_BR_IF_NOT] = "br_if_not",
+    [MIR_RET_VOID] = "ret_void",
+    [MIR_RET] = "ret",
+};
+
+#define MIR_TAG_COUNT ((int32_t) ArrayLength(mir_tag_names))
+
+typedef struct {
+    int64_t tir;
+    int64_t types;
+    int64_t values;
+    int64_t mir;
+    int64_t allocs;
+    int64_t blocks;
+} Sizes;
+
+static void print_sizes(FILE *stream, Sizes sizes) {
+    fprintf(stream, "tir %"PRId64" types %"PRId64" values %"PRId64" mir %"PRId64" allocs %"PRId64" blocks %"PRId64, sizes.tir, sizes.types, sizes.values, sizes.mir, sizes.allocs, sizes.blocks);
+}
+
+// Functions are reported in declaration order, which unlike the emitted order
+// does not depend on the estimated call frequencies.
+static int compare_functions(void const *a, void const *b) {
+    MirFunction const *left = a;
+    MirFunction const *right = b;
+
+    if (left->tir != right->tir) {
+        return left->tir - right->tir;
+    }
+
+    return left->clone - right->clone;
+}
+
+static long file_size(char const *path) {
+    FILE *file = fopen(path, "r");
+
+    if (!file) {
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+void print_ir_stats(FILE *stream, IrStats const *stats, char **paths, GenInput *input, Backend backend, Arena scratch) {
+    MirResult *mir_result = input->mir_result;
+    Mir *mir = &mir_result->mir;
+    TirContext ctx = {&input->global_deps, NULL};
+    int64_t *tag_counts = arena_alloc(&scratch, int64_t, MIR_TAG_COUNT);
+    Sizes total = {0};
+    int64_t ast_nodes = 0;
+
+    for (int32_t i = 0; i < stats->file_count; i++) {
+        fprintf(stream, "file %s ast %d\n", paths[i], stats->ast_nodes[i]);
+        ast_nodes += stats->ast_nodes[i];
+    }
+
+    int32_t function_count = mir_result->function_count;
+    MirFunction *functions = arena_alloc(&scratch, MirFunction, function_count);
+    if (function_count) {
+        memcpy(functions, mir_result->functions, function_count * sizeof(MirFunction));
+    }
+    qsort(functions, function_count, sizeof(MirFunction), compare_functions);
+
+    for (int32_t f = 0; f < function_count; f++) {
+        MirFunction function = functions[f];
+        LocalTir *thread = &input->insts[function.tir];
+        Sizes sizes = {
+            .tir = function.clone ? 0 : stats->tir_insts[function.tir],
+            .types = function.clone ? 0 : thread->deps.types.types.len,
+            .values = function.clone ? 0 : thread->deps.values.values.len,
+            .mir = function.end - function.start,
+        };
+
+        for (int32_t i = function.start; i < function.end; i++) {
+            MirTag tag = get_mir_tag(mir, (MirId) {i});
+            tag_counts[tag]++;
+            if (tag == MIR_ALLOC) {
+                sizes.allocs++;
+            }
+        }
+
+        if (function.end > function.start) {
+            Arena block_scratch = scratch;
+            int32_t block_count;
+            get_mir_block_starts(mir, function.start, function.end, &block_count, &block_scratch);
+            sizes.blocks = block_count;
+        }
+
+        ValueId value = input->declarations.functions.ptr[function.tir];
+        char const *name = &ctx.global->strtab.ptr[get_value_data(ctx, value)->index];
+        if (function.clone) {
+            fprintf(stream, "function %s.%d ", name, function.clone);
+        } else {
+            fprintf(stream, "function %s ", name);
+        }
+        print_sizes(stream, sizes);
+        fprintf(stream, function.is_cold ? " cold\n" : "\n");
+
+        total.tir += sizes.tir;
+        total.types += sizes.types;
+        total.values += sizes.values;
+        total.mir += sizes.mir;
+        total.allocs += sizes.allocs;
+        total.blocks += sizes.blocks;
+    }
+
+    for (int32_t i = 0; i < MIR_TAG_COUNT; i++) {
+        if (tag_counts[i]) {
+            fprintf(stream, "mir %s %"PRId64"\n", mir_tag_names[i], tag_counts[i]);
+        }
+    }
+
+    fprintf(stream, "global types %d values %d\n", input->global_deps.types.types.len, input->global_deps.values.values.len);
+    fprintf(stream, "total functions %d ast %"PRId64" ", function_count, ast_nodes);
+    print_sizes(stream, total);
+    fprintf(stream, "\n");
+    fprintf(stream, "emitted %s %ld\n", backend == BACKEND_LLVM ? "llvm" : "c", file_size(input->path));
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "arena.h"
+#include "enums.h"
+#include "gen.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Sizes of the representations that are freed before code generation,
+// recorded before they are.
+typedef struct {
+    int32_t file_count;
+    int32_t *ast_nodes;
+    int32_t function_count;
+    // Indexed like the functions of the declarations.
+    int32_t *tir_insts;
+} IrStats;
+
+// Prints the size of every representation per function and in total, followed
+// by the size of the file the backend wrote. The report only depends on the
+// input and the options, so it can be compared across commits.
+void print_ir_stats(FILE *stream, IrStats const *stats, char **paths, GenInput *input, Backend backend, Arena scratch);
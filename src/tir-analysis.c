@@ -459,6 +459,9 @@ static void check_node(LinearChecker *ctx, TirId node, ExpectedValue expected_ca
 int check_substructural_types(SubstructuralAnalysisInput *input, Arena scratch) {
     int error = 0;
     for (int32_t i = 0; i < input->function_count; i++) {
+        if (!input->insts[i].first.id) {
+            continue;
+        }
         LinearChecker ctx = {0};
         ctx.paths = input->paths;
         ctx.sources = input->sources;
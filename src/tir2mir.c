@@ -3,14 +3,29 @@
 #include "arena.h"
 #include "data/mir.h"
 #include "data/tir.h"
+#include "function-folding.h"
 #include "fwd.h"
 #include "util.h"
+#include "value-numbering.h"
 #include "wrappers.h"
 
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+typedef struct {
+    bool known;
+    int64_t value;
+} ConstantArg;
+
+// Within the body of a loop, the counter `variable` is at least 0 and below
+// either the length of the slice variable `slice`, or `limit` if it is -1.
+typedef struct {
+    int32_t variable;
+    int32_t slice;
+    int64_t limit;
+} IndexBound;
+
 typedef struct {
     Tir tir;
     Mir mir;
@@ -18,7 +33,17 @@ typedef struct {
     int32_t basic_block;
     Vec(MirId) break_instructions;
     Vec(MirId) continue_instructions;
+    // Loop-invariant temporaries that were computed ahead of their loop,
+    // indexed by TirId, or -1.
+    MirId *hoisted;
+    // Variables whose address may be stored somewhere.
+    bool *address_taken;
+    // Per param, a constant that every caller passes, or NULL.
+    ConstantArg *constant_args;
+    Vec(IndexBound) index_bounds;
     Arena scratch;
+    Target target;
+    bool bounds_check;
     bool error;
 } Context;
 
@@ -97,6 +122,9 @@ static void patch_br(Context *c, MirId br, int32_t basic_block) {
 }
 
 static MirId transform_node(Context *c, TirId tir_id, TypeId type);
+static void transform_value_into(Context *c, ValueId value, MirId destination);
+static bool use_constant_data(Context *c, TirId tir_id, TypeId type);
+static MirId transform_constant(Context *c, TirId tir_id, TypeId type);
 
 static MirId transform_value(Context *c, ValueId value) {
     switch (get_value_tag(c->tir.ctx, value)) {
@@ -122,20 +150,37 @@ static MirId transform_value(Context *c, ValueId value) {
         case VAL_TEMPORARY: {
             TirId tir_id = {get_value_data(c->tir.ctx, value)->index};
             TypeId type = get_value_type(c->tir.ctx, value);
+
+            if (c->hoisted[tir_id.id].private_field_id >= 0) {
+                return c->hoisted[tir_id.id];
+            }
+
             return transform_node(c, tir_id, type);
         }
     }
     abort();
 }
 
-static MirId transform_let(Context *c, TirId tir_id) {
+static MirId transform_let(Context *c, TirId tir_id, bool mutable) {
     TirInstData data = get_tir_data(&c->tir.insts, tir_id);
     int32_t variable = data.left;
     ValueId init = {data.right};
     TypeId type = get_value_type(c->tir.ctx, init);
+
+    // An immutable variable can refer to read-only data without a copy.
+    if (!mutable && get_value_tag(c->tir.ctx, init) == VAL_TEMPORARY) {
+        TirId init_tir = {get_value_data(c->tir.ctx, init)->index};
+        TirTag tag = get_tir_tag(&c->tir.insts, init_tir);
+
+        if ((tag == TIR_NEW_STRUCT || tag == TIR_NEW_ARRAY) && use_constant_data(c, init_tir, type)) {
+            MirId constant_mir = transform_constant(c, init_tir, type);
+            c->variable_to_mir_map[variable] = constant_mir;
+            return constant_mir;
+        }
+    }
+
     MirId alloc_mir = add_leaf_instruction(c, MIR_ALLOC, type);
-    MirId init_mir = transform_value(c, init);
-    add_binary_instruction(c, MIR_ASSIGN, type, alloc_mir, init_mir);
+    transform_value_into(c, init, alloc_mir);
     c->variable_to_mir_map[variable] = alloc_mir;
     return alloc_mir;
 }
@@ -193,6 +238,237 @@ static MirId transform_address(Context *c, TirId tir_id) {
     return add_unary_instruction(c, MIR_ADDRESS, type, operand_mir);
 }
 
+static bool get_mir_const_int(Context *c, MirId mir_id, int64_t *i) {
+    if (get_mir_tag(&c->mir, mir_id) == MIR_INT) {
+        *i = get_mir_int(&c->mir, mir_id);
+        return true;
+    }
+
+    if (get_mir_tag(&c->mir, mir_id) != MIR_TIR_VALUE) {
+        return false;
+    }
+
+    ValueId value = get_mir_tir_value(&c->mir, mir_id);
+
+    if (get_value_tag(c->tir.ctx, value) != VAL_CONST_INT) {
+        return false;
+    }
+
+    *i = get_value_int(c->tir.ctx, value);
+    return true;
+}
+
+// Returns k if i is 2^k, or -1.
+static int32_t exact_log2(uint64_t i) {
+    if (i == 0 || (i & (i - 1)) != 0) {
+        return -1;
+    }
+
+    return __builtin_ctzll(i);
+}
+
+// Magic number and shift for signed division by 2 < divisor < 2^(bits - 1),
+// from Hacker's Delight, figure 10-1.
+static void get_signed_magic(uint64_t divisor, int32_t bits, int64_t *magic, int32_t *shift) {
+    uint64_t mask = bits == 64 ? UINT64_MAX : (1ull << bits) - 1;
+    uint64_t two_n1 = 1ull << (bits - 1);
+    uint64_t anc = two_n1 - 1 - two_n1 % divisor;
+    uint64_t q1 = two_n1 / anc;
+    uint64_t r1 = two_n1 - q1 * anc;
+    uint64_t q2 = two_n1 / divisor;
+    uint64_t r2 = two_n1 - q2 * divisor;
+    uint64_t delta;
+    int32_t p = bits - 1;
+
+    do {
+        p++;
+        q1 = (q1 * 2) & mask;
+        r1 = r1 * 2;
+
+        if (r1 >= anc) {
+            q1 = (q1 + 1) & mask;
+            r1 -= anc;
+        }
+
+        q2 = (q2 * 2) & mask;
+        r2 = r2 * 2;
+
+        if (r2 >= divisor) {
+            q2 = (q2 + 1) & mask;
+            r2 -= divisor;
+        }
+
+        delta = divisor - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    uint64_t m = (q2 + 1) & mask;
+
+    // Sign-extend from `bits` to 64 bits.
+    if (bits < 64 && (m & two_n1)) {
+        m |= ~mask;
+    }
+
+    *magic = (int64_t) m;
+    *shift = p - bits;
+}
+
+// Truncating signed division and remainder by a constant, using shifts and
+// masks for powers of two and a multiplication by a magic number otherwise.
+static MirId reduce_division(Context *c, MirTag tag, TypeId type, MirId left, int64_t divisor, int32_t bits) {
+    uint64_t abs_divisor = divisor < 0 ? -(uint64_t) divisor : (uint64_t) divisor;
+    int32_t log2 = exact_log2(abs_divisor);
+    MirId sign = add_binary_instruction(c, MIR_SHR, type, left, add_int_instruction(c, type, bits - 1));
+    MirId quotient;
+
+    if (log2 >= 0) {
+        // Negative dividends are biased by 2^k - 1 to round towards zero.
+        MirId bias = add_binary_instruction(c, MIR_AND, type, sign, add_int_instruction(c, type, (1ll << log2) - 1));
+        MirId biased = add_binary_instruction(c, MIR_ADD, type, left, bias);
+
+        if (tag == MIR_MOD) {
+            MirId rounded = add_binary_instruction(c, MIR_AND, type, biased, add_int_instruction(c, type, -(1ll << log2)));
+            return add_binary_instruction(c, MIR_SUB, type, left, rounded);
+        }
+
+        quotient = add_binary_instruction(c, MIR_SHR, type, biased, add_int_instruction(c, type, log2));
+    } else {
+        int64_t magic;
+        int32_t shift;
+        get_signed_magic(abs_divisor, bits, &magic, &shift);
+        quotient = add_binary_instruction(c, MIR_MULHI, type, left, add_int_instruction(c, type, magic));
+
+        if (magic < 0) {
+            quotient = add_binary_instruction(c, MIR_ADD, type, quotient, left);
+        }
+
+        if (shift) {
+            quotient = add_binary_instruction(c, MIR_SHR, type, quotient, add_int_instruction(c, type, shift));
+        }
+
+        quotient = add_binary_instruction(c, MIR_SUB, type, quotient, sign);
+    }
+
+    if (divisor < 0) {
+        quotient = add_unary_instruction(c, MIR_MINUS, type, quotient);
+    }
+
+    if (tag == MIR_MOD) {
+        MirId product = add_binary_instruction(c, MIR_MUL, type, quotient, add_int_instruction(c, type, divisor));
+        return add_binary_instruction(c, MIR_SUB, type, left, product);
+    }
+
+    return quotient;
+}
+
+// Wraps around like the generated code does. Operations that trap or are
+// undefined are left to run.
+static bool fold_int(MirTag tag, int64_t left, int64_t right, int32_t bits, int64_t *result) {
+    uint64_t l = (uint64_t) left;
+    uint64_t r = (uint64_t) right;
+    uint64_t i;
+
+    switch (tag) {
+        case MIR_ADD: i = l + r; break;
+        case MIR_SUB: i = l - r; break;
+        case MIR_MUL: i = l * r; break;
+        case MIR_AND: i = l & r; break;
+        case MIR_OR: i = l | r; break;
+        case MIR_XOR: i = l ^ r; break;
+        case MIR_SHL: {
+            if (right < 0 || right >= bits) {
+                return false;
+            }
+            i = l << right;
+            break;
+        }
+        case MIR_SHR: {
+            if (right < 0 || right >= bits) {
+                return false;
+            }
+            i = (uint64_t) (left >> right);
+            break;
+        }
+        case MIR_EQ: i = left == right; break;
+        case MIR_NE: i = left != right; break;
+        case MIR_LT: i = left < right; break;
+        case MIR_GT: i = left > right; break;
+        case MIR_LE: i = left <= right; break;
+        case MIR_GE: i = left >= right; break;
+        case MIR_DIV:
+        case MIR_MOD: {
+            if (right == 0 || (right == -1 && left == (bits == 64 ? INT64_MIN : -(1ll << (bits - 1))))) {
+                return false;
+            }
+            i = (uint64_t) (tag == MIR_DIV ? left / right : left % right);
+            break;
+        }
+        default: {
+            return false;
+        }
+    }
+
+    // Sign-extend from `bits` to 64 bits.
+    if (bits < 64) {
+        uint64_t sign = 1ull << (bits - 1);
+        i &= (sign << 1) - 1;
+        i = (i ^ sign) - sign;
+    }
+
+    *result = (int64_t) i;
+    return true;
+}
+
+// Integer arithmetic with constant operands is strength-reduced here, so both
+// backends benefit without relying on the optimization level of the C compiler
+// or llc.
+static MirId add_arithmetic_instruction(Context *c, MirTag tag, TypeId type, MirId left, MirId right) {
+    int64_t constant;
+
+    if (!type_is_int(type)) {
+        return add_binary_instruction(c, tag, type, left, right);
+    }
+
+    int32_t bits = (int32_t) sizeof_type(c->tir.ctx, type, c->target) * 8;
+    uint64_t limit = 1ull << (bits - 1);
+    int64_t left_constant;
+    int64_t folded;
+
+    if (get_mir_const_int(c, left, &left_constant) && get_mir_const_int(c, right, &constant)
+        && fold_int(tag, left_constant, constant, bits, &folded)) {
+        bool is_comparison = tag >= MIR_EQ && tag <= MIR_GE;
+        return add_int_instruction(c, is_comparison ? type_bool : type, folded);
+    }
+
+    if (tag == MIR_MUL) {
+        if (get_mir_const_int(c, left, &constant)) {
+            MirId swap = left;
+            left = right;
+            right = swap;
+        }
+
+        if (get_mir_const_int(c, right, &constant) && constant > 1 && (uint64_t) constant < limit) {
+            int32_t log2 = exact_log2(constant);
+
+            if (log2 > 0) {
+                return add_binary_instruction(c, MIR_SHL, type, left, add_int_instruction(c, type, log2));
+            }
+        }
+    } else if (tag == MIR_DIV || tag == MIR_MOD) {
+        if (get_mir_const_int(c, right, &constant) && constant != 0 && constant != 1 && constant != -1) {
+            uint64_t abs_constant = constant < 0 ? -(uint64_t) constant : (uint64_t) constant;
+
+            // The double-width product needs a type twice as wide as a register.
+            bool can_multiply_high = bits <= sizeof_pointer(c->target) * 8;
+
+            if (abs_constant < limit && (exact_log2(abs_constant) >= 0 || can_multiply_high)) {
+                return reduce_division(c, tag, type, left, constant, bits);
+            }
+        }
+    }
+
+    return add_binary_instruction(c, tag, type, left, right);
+}
+
 static MirId transform_binary(Context *c, TirId tir_id, MirTag tag) {
     TirInstData data = get_tir_data(&c->tir.insts, tir_id);
     ValueId left = {data.left};
@@ -200,7 +476,7 @@ static MirId transform_binary(Context *c, TirId tir_id, MirTag tag) {
     TypeId type = get_value_type(c->tir.ctx, left);
     MirId left_mir = transform_value(c, left);
     MirId right_mir = transform_value(c, right);
-    return add_binary_instruction(c, tag, type, left_mir, right_mir);
+    return add_arithmetic_instruction(c, tag, type, left_mir, right_mir);
 }
 
 static MirId transform_compound_assignment(Context *c, TirId tir_id, MirTag tag) {
@@ -210,7 +486,7 @@ static MirId transform_compound_assignment(Context *c, TirId tir_id, MirTag tag)
     TypeId type = get_value_type(c->tir.ctx, left);
     MirId left_mir = transform_value(c, left);
     MirId right_mir = transform_value(c, right);
-    MirId op_result = add_binary_instruction(c, tag, type, left_mir, right_mir);
+    MirId op_result = add_arithmetic_instruction(c, tag, type, left_mir, right_mir);
     return add_binary_instruction(c, MIR_ASSIGN, type, left_mir, op_result);
 }
 
@@ -224,7 +500,9 @@ static MirId transform_access(Context *c, TirId tir_id) {
     return add_mir_const_instruction(c, MIR_ACCESS, s, operand_mir, index);
 }
 
-static MirId transform_call(Context *c, TirId tir_id) {
+// The extra data of a call holds the arguments followed by the destination of
+// an aggregate result, or -1 when the call provides its own storage.
+static MirId transform_call_into(Context *c, TirId tir_id, int32_t destination) {
     TirInstData data = get_tir_data(&c->tir.insts, tir_id);
     ValueId operand = {data.left};
     int32_t args = data.right;
@@ -232,7 +510,7 @@ static MirId transform_call(Context *c, TirId tir_id) {
     FunctionType function_type = get_function_type(c->tir.ctx, type);
     MirId operand_mir = transform_value(c, operand);
 
-    int32_t *args_mir = arena_alloc(&c->scratch, int32_t, function_type.param_count);
+    int32_t *args_mir = arena_alloc(&c->scratch, int32_t, function_type.param_count + 1);
 
     for (int32_t i = 0; i < function_type.param_count; i++) {
         ValueId arg = {get_tir_extra(&c->tir.insts, args + i)};
@@ -240,7 +518,72 @@ static MirId transform_call(Context *c, TirId tir_id) {
         args_mir[i] = arg_mir.private_field_id;
     }
 
-    return add_mir_const_instruction(c, MIR_CALL, type, operand_mir, push_extra(c, args_mir, function_type.param_count));
+    args_mir[function_type.param_count] = destination;
+    return add_mir_const_instruction(c, MIR_CALL, type, operand_mir, push_extra(c, args_mir, function_type.param_count + 1));
+}
+
+static MirId transform_call(Context *c, TirId tir_id) {
+    return transform_call_into(c, tir_id, -1);
+}
+
+// The local variable a value is read from, or -1.
+static int32_t get_variable(Context *c, ValueId value) {
+    ValueTag tag = get_value_tag(c->tir.ctx, value);
+
+    if (tag == VAL_VARIABLE || tag == VAL_MUTABLE_VARIABLE) {
+        return get_value_data(c->tir.ctx, value)->index;
+    }
+
+    return -1;
+}
+
+static bool is_index_in_bounds(Context *c, ValueId operand, ValueId index, int64_t length) {
+    for (int32_t i = 0; i < c->index_bounds.len; i++) {
+        IndexBound bound = c->index_bounds.ptr[i];
+
+        if (get_variable(c, index) != bound.variable) {
+            continue;
+        }
+
+        if (bound.slice < 0 ? length >= 0 && bound.limit <= length : get_variable(c, operand) == bound.slice) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Checks are left out for constant indices into arrays and for loop counters
+// that the loop condition keeps in bounds.
+static void add_bounds_check(Context *c, ValueId operand, ValueId index, MirId operand_mir, MirId index_mir) {
+    TypeId type = remove_tags(c->tir.ctx, get_value_type(c->tir.ctx, operand));
+    int64_t length = -1;
+    int64_t i;
+    MirId length_mir;
+
+    if (get_type_tag(c->tir.ctx, type) == TYPE_ARRAY) {
+        TypeId index_type = get_array_type(c->tir.ctx, type).index;
+
+        // Other index types only have values in range.
+        if (get_type_tag(c->tir.ctx, index_type) != TYPE_ARRAY_LENGTH) {
+            return;
+        }
+
+        length = get_array_length_type(c->tir.ctx, index_type);
+    }
+
+    if ((length >= 0 && get_mir_const_int(c, index_mir, &i) && i >= 0 && i < length)
+        || is_index_in_bounds(c, operand, index, length)) {
+        return;
+    }
+
+    if (length >= 0) {
+        length_mir = add_int_instruction(c, type_isize, length);
+    } else {
+        length_mir = add_mir_const_instruction(c, MIR_ACCESS, type, operand_mir, 0);
+    }
+
+    add_binary_instruction(c, MIR_BOUNDS_CHECK, type_isize, index_mir, length_mir);
 }
 
 static MirId transform_index(Context *c, TirId tir_id) {
@@ -254,6 +597,9 @@ static MirId transform_index(Context *c, TirId tir_id) {
     if (remove_slice(c->tir.ctx, type).id) {
         tag = MIR_SLICE_INDEX;
     }
+    if (c->bounds_check) {
+        add_bounds_check(c, operand, index, operand_mir, index_mir);
+    }
     return add_binary_instruction(c, tag, type, operand_mir, index_mir);
 }
 
@@ -286,154 +632,1316 @@ static MirId transform_array_to_slice(Context *c, TirId tir_id, TypeId type) {
     return add_binary_instruction(c, MIR_NEW_SLICE, type, length_mir, data_mir);
 }
 
-static MirId transform_new_struct(Context *c, TirId tir_id, TypeId type) {
+static bool is_constant_aggregate(Context *c, TirId tir_id, TypeId type);
+
+static bool is_constant_element(Context *c, ValueId value, TypeId type) {
+    if (get_value_type(c->tir.ctx, value).id != type.id) {
+        return false;
+    }
+
+    switch (get_value_tag(c->tir.ctx, value)) {
+        case VAL_CONST_INT:
+        case VAL_CONST_FLOAT: {
+            return true;
+        }
+        case VAL_CONST_NULL: {
+            TypeTag tag = get_type_tag(c->tir.ctx, remove_tags(c->tir.ctx, type));
+            return tag == TYPE_PTR || tag == TYPE_PTR_MUT;
+        }
+        case VAL_TEMPORARY: {
+            TirId tir_id = {get_value_data(c->tir.ctx, value)->index};
+            TirTag tag = get_tir_tag(&c->tir.insts, tir_id);
+            return (tag == TIR_NEW_STRUCT || tag == TIR_NEW_ARRAY) && is_constant_aggregate(c, tir_id, type);
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+static bool is_constant_aggregate(Context *c, TirId tir_id, TypeId type) {
     TirInstData data = get_tir_data(&c->tir.insts, tir_id);
     int32_t args = data.left;
     int32_t arg_count = data.right;
-    MirId alloc_mir = add_leaf_instruction(c, MIR_ALLOC, type);
-    TypeId s = remove_tags(c->tir.ctx, type);
+    bool is_struct = get_tir_tag(&c->tir.insts, tir_id) == TIR_NEW_STRUCT;
 
     for (int32_t i = 0; i < arg_count; i++) {
         ValueId arg = {get_tir_extra(&c->tir.insts, args + i)};
-        TypeId field_type = get_value_type(c->tir.ctx, arg);
-        MirId arg_mir = transform_value(c, arg);
-        MirId field_address = add_mir_const_instruction(c, MIR_ACCESS, s, alloc_mir, i);
-        add_binary_instruction(c, MIR_ASSIGN, field_type, field_address, arg_mir);
+        TypeId element_type = is_struct
+            ? get_any_struct_type_field(c->tir.ctx, remove_tags(c->tir.ctx, type), i)
+            : remove_c_pointer_like(c->tir.ctx, type);
+
+        if (!is_constant_element(c, arg, element_type)) {
+            return false;
+        }
     }
 
-    return alloc_mir;
+    return true;
 }
 
-static MirId transform_new_array(Context *c, TirId tir_id, TypeId type) {
+// Pushes the scalar elements of a constant aggregate in memory order.
+static void push_constant_elements(Context *c, TirId tir_id) {
     TirInstData data = get_tir_data(&c->tir.insts, tir_id);
     int32_t args = data.left;
     int32_t arg_count = data.right;
-    MirId alloc_mir = add_leaf_instruction(c, MIR_ALLOC, type);
-    TypeId element_type = remove_c_pointer_like(c->tir.ctx, type);
 
     for (int32_t i = 0; i < arg_count; i++) {
         ValueId arg = {get_tir_extra(&c->tir.insts, args + i)};
-        MirId arg_mir = transform_value(c, arg);
-        MirId field_address = add_mir_const_instruction(c, MIR_CONST_INDEX, type, alloc_mir, i);
-        add_binary_instruction(c, MIR_ASSIGN, element_type, field_address, arg_mir);
+
+        if (get_value_tag(c->tir.ctx, arg) == VAL_TEMPORARY) {
+            push_constant_elements(c, (TirId) {get_value_data(c->tir.ctx, arg)->index});
+        } else {
+            vec_push(&c->mir.extra, arg.id);
+        }
     }
+}
 
-    return alloc_mir;
+// Aggregates that fit in two registers are cheaper to build with stores than
+// to copy from memory.
+static bool use_constant_data(Context *c, TirId tir_id, TypeId type) {
+    return sizeof_type(c->tir.ctx, type, c->target) > 2 * sizeof_pointer(c->target)
+        && is_constant_aggregate(c, tir_id, type);
 }
 
-static bool last_is_terminator(Context *c, MirId last_br) {
-    return c->mir.mir.len - 1 > last_br.private_field_id && is_mir_terminator(c->mir.mir.tags[c->mir.mir.len - 1]);
+static MirId transform_constant(Context *c, TirId tir_id, TypeId type) {
+    int32_t elements = c->mir.extra.len;
+    push_constant_elements(c, tir_id);
+    return add_mir_const_instruction(c, MIR_CONSTANT, type, (MirId) {0}, elements);
 }
 
-static MirId transform_if(Context *c, TirId tir_id) {
+static void transform_new_struct_into(Context *c, TirId tir_id, TypeId type, MirId destination) {
     TirInstData data = get_tir_data(&c->tir.insts, tir_id);
-    ValueId condition = {data.left};
-    int32_t extra = data.right;
-    int32_t true_block = get_tir_extra(&c->tir.insts, extra);
-    int32_t true_block_length = get_tir_extra(&c->tir.insts, extra + 1);
-    int32_t false_block = get_tir_extra(&c->tir.insts, extra + 2);
-    int32_t false_block_length = get_tir_extra(&c->tir.insts, extra + 3);
-    MirId condition_mir = transform_value(c, condition);
-    MirId condition_br = add_cond_br_instruction(c, MIR_BR_IF_NOT, condition_mir);
+    int32_t args = data.left;
+    int32_t arg_count = data.right;
+    TypeId s = remove_tags(c->tir.ctx, type);
 
-    for (int32_t i = 0; i < true_block_length; i++) {
-        TirId statement = {get_tir_extra(&c->tir.insts, true_block + i)};
-        transform_node(c, statement, null_type);
+    for (int32_t i = 0; i < arg_count; i++) {
+        ValueId arg = {get_tir_extra(&c->tir.insts, args + i)};
+        MirId field_address = add_mir_const_instruction(c, MIR_ACCESS, s, destination, i);
+        transform_value_into(c, arg, field_address);
     }
+}
 
-    MirId true_br = condition_br;
+static void transform_new_array_into(Context *c, TirId tir_id, TypeId type, MirId destination) {
+    TirInstData data = get_tir_data(&c->tir.insts, tir_id);
+    int32_t args = data.left;
+    int32_t arg_count = data.right;
 
-    if (!last_is_terminator(c, condition_br)) {
-        true_br = add_br_instruction(c);
+    for (int32_t i = 0; i < arg_count; i++) {
+        ValueId arg = {get_tir_extra(&c->tir.insts, args + i)};
+        MirId element_address = add_mir_const_instruction(c, MIR_CONST_INDEX, type, destination, i);
+        transform_value_into(c, arg, element_address);
     }
+}
 
-    int32_t false_basic_block = c->basic_block;
-
-    for (int32_t i = 0; i < false_block_length; i++) {
-        TirId statement = {get_tir_extra(&c->tir.insts, false_block + i)};
-        transform_node(c, statement, null_type);
+static MirId transform_new_struct(Context *c, TirId tir_id, TypeId type) {
+    if (use_constant_data(c, tir_id, type)) {
+        return transform_constant(c, tir_id, type);
     }
 
-    MirId false_br = condition_br;
+    MirId alloc_mir = add_leaf_instruction(c, MIR_ALLOC, type);
+    transform_new_struct_into(c, tir_id, type, alloc_mir);
+    return alloc_mir;
+}
 
-    if (!last_is_terminator(c, true_br)) {
-        false_br = add_br_instruction(c);
+static MirId transform_new_array(Context *c, TirId tir_id, TypeId type) {
+    if (use_constant_data(c, tir_id, type)) {
+        return transform_constant(c, tir_id, type);
     }
 
-    int32_t next_basic_block = c->basic_block;
-    patch_br(c, condition_br, false_basic_block);
+    MirId alloc_mir = add_leaf_instruction(c, MIR_ALLOC, type);
+    transform_new_array_into(c, tir_id, type, alloc_mir);
+    return alloc_mir;
+}
 
-    if (true_br.private_field_id != condition_br.private_field_id) {
-        patch_br(c, true_br, next_basic_block);
-    }
+// Aggregate literals and calls are built directly in `destination`, which must
+// be fresh storage that nothing else refers to yet.
+static void transform_value_into(Context *c, ValueId value, MirId destination) {
+    TypeId type = get_value_type(c->tir.ctx, value);
 
-    if (false_br.private_field_id != condition_br.private_field_id) {
-        patch_br(c, false_br, next_basic_block);
+    if (get_value_tag(c->tir.ctx, value) == VAL_TEMPORARY && is_aggregate_type(c->tir.ctx, type)) {
+        TirId tir_id = {get_value_data(c->tir.ctx, value)->index};
+
+        switch (get_tir_tag(&c->tir.insts, tir_id)) {
+            case TIR_NEW_STRUCT: {
+                if (!use_constant_data(c, tir_id, type)) {
+                    transform_new_struct_into(c, tir_id, type, destination);
+                    return;
+                }
+                break;
+            }
+            case TIR_NEW_ARRAY: {
+                if (!use_constant_data(c, tir_id, type)) {
+                    transform_new_array_into(c, tir_id, type, destination);
+                    return;
+                }
+                break;
+            }
+            case TIR_CALL: {
+                transform_call_into(c, tir_id, destination.private_field_id);
+                return;
+            }
+            default: {
+                break;
+            }
+        }
     }
 
-    return condition_mir;
+    MirId value_mir = transform_value(c, value);
+    add_binary_instruction(c, MIR_ASSIGN, type, destination, value_mir);
 }
 
-static MirId transform_switch(Context *c, TirId tir_id, TypeId type) {
-    TirInstData data = get_tir_data(&c->tir.insts, tir_id);
-    ValueId switch_ = {data.left};
-    int32_t extra = data.right;
-    int32_t branches = get_tir_extra(&c->tir.insts, extra);
-    int32_t branch_count = get_tir_extra(&c->tir.insts, extra + 1);
-    MirId alloc_mir = {0};
+static bool last_is_terminator(Context *c, MirId last_br) {
+    return c->mir.mir.len - 1 > last_br.private_field_id && is_mir_terminator(c->mir.mir.tags[c->mir.mir.len - 1]);
+}
 
-    if (type.id != TYPE_VOID) {
-        alloc_mir = add_leaf_instruction(c, MIR_ALLOC, type);
-    }
+// Total number of operations that may be evaluated unconditionally to replace
+// a branch.
+#define SPECULATION_BUDGET 8
 
-    MirId switch_mir;
-    TypeId pattern_type;
+// Whether a value can be computed even when the program would not have
+// computed it: it cannot trap, has no side effects and is cheap.
+static bool is_speculatable(Context *c, ValueId value, int32_t *budget) {
+    switch (get_value_tag(c->tir.ctx, value)) {
+        case VAL_FUNCTION:
+        case VAL_EXTERN_FUNCTION:
+        case VAL_EXTERN_VAR:
+        case VAL_CONST_INT:
+        case VAL_CONST_FLOAT:
+        case VAL_CONST_NULL:
+        case VAL_STRING:
+        case VAL_VARIABLE:
+        case VAL_MUTABLE_VARIABLE: {
+            return true;
+        }
+        case VAL_ERROR: {
+            return false;
+        }
+        case VAL_TEMPORARY: {
+            break;
+        }
+    }
 
-    if (switch_.id) {
-        switch_mir = transform_value(c, switch_);
-        pattern_type = get_value_type(c->tir.ctx, switch_);
+    if (--*budget < 0) {
+        return false;
     }
 
-    MirId *br_list = arena_alloc(&c->scratch, MirId, branch_count);
-    int32_t real_count = 0;
+    TirId tir_id = {get_value_data(c->tir.ctx, value)->index};
+    TirInstData data = get_tir_data(&c->tir.insts, tir_id);
+    ValueId left = {data.left};
+    ValueId right = {data.right};
 
-    for (int32_t i = 0; i < branch_count; i++) {
-        ValueId pattern = {get_tir_extra(&c->tir.insts, branches + i * 2)};
-        ValueId value = {get_tir_extra(&c->tir.insts, branches + i * 2 + 1)};
+    switch (get_tir_tag(&c->tir.insts, tir_id)) {
+        case TIR_ADD:
+        case TIR_SUB:
+        case TIR_MUL:
+        case TIR_AND:
+        case TIR_OR:
+        case TIR_XOR:
+        case TIR_EQ:
+        case TIR_NE:
+        case TIR_LT:
+        case TIR_GT:
+        case TIR_LE:
+        case TIR_GE: {
+            return is_speculatable(c, left, budget) && is_speculatable(c, right, budget);
+        }
+        case TIR_PLUS:
+        case TIR_MINUS:
+        case TIR_NOT:
+        case TIR_NOP:
+        case TIR_ITOF:
+        case TIR_ITRUNC:
+        case TIR_SEXT:
+        case TIR_ZEXT:
+        case TIR_FTRUNC:
+        case TIR_FEXT:
+        case TIR_PTR_CAST: {
+            return is_speculatable(c, left, budget);
+        }
+        case TIR_ACCESS: {
+            TypeTag tag = get_type_tag(c->tir.ctx, remove_tags(c->tir.ctx, get_value_type(c->tir.ctx, left)));
+            return tag == TYPE_STRUCT && is_speculatable(c, left, budget);
+        }
+        case TIR_SWITCH: {
+            int32_t branches = get_tir_extra(&c->tir.insts, data.right);
+            int32_t branch_count = get_tir_extra(&c->tir.insts, data.right + 1);
 
-        if (pattern.id) {
-            MirId pattern_mir = transform_value(c, pattern);
-            MirId condition_mir = pattern_mir;
+            if (left.id && !is_speculatable(c, left, budget)) {
+                return false;
+            }
 
-            if (switch_.id) {
+            for (int32_t i = 0; i < branch_count * 2; i++) {
+                ValueId branch_value = {get_tir_extra(&c->tir.insts, branches + i)};
+
+                if (branch_value.id && !is_speculatable(c, branch_value, budget)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+static bool is_select_type(Context *c, TypeId type) {
+    return type.id != TYPE_VOID && !is_aggregate_type(c->tir.ctx, type);
+}
+
+static MirId add_select_instruction(Context *c, TypeId type, MirId condition, MirId true_value, MirId false_value) {
+    int32_t values[] = {true_value.private_field_id, false_value.private_field_id};
+    return add_mir_const_instruction(c, MIR_SELECT, type, condition, push_extra(c, values, ArrayLength(values)));
+}
+
+// Block statements are values, so an assignment is reached through the
+// temporary it produces.
+static TirId get_statement_inst(Context *c, TirId statement) {
+    if (get_tir_tag(&c->tir.insts, statement) != TIR_VALUE) {
+        return statement;
+    }
+
+    ValueId value = {get_tir_data(&c->tir.insts, statement).left};
+
+    if (!value.id || get_value_tag(c->tir.ctx, value) != VAL_TEMPORARY) {
+        return statement;
+    }
+
+    return (TirId) {get_value_data(c->tir.ctx, value)->index};
+}
+
+// `if c { x = a } else { x = b }` on a local variable becomes `x = c ? a : x`
+// or `x = c ? a : b` when both sides can be evaluated unconditionally.
+static bool transform_select_if(Context *c, ValueId condition, int32_t true_block, int32_t true_block_length,
+                                int32_t false_block, int32_t false_block_length, MirId *result) {
+    if (true_block_length != 1 || false_block_length > 1) {
+        return false;
+    }
+
+    TirId true_statement = get_statement_inst(c, (TirId) {get_tir_extra(&c->tir.insts, true_block)});
+
+    if (get_tir_tag(&c->tir.insts, true_statement) != TIR_ASSIGN) {
+        return false;
+    }
+
+    ValueId place = {get_tir_data(&c->tir.insts, true_statement).left};
+    ValueId true_value = {get_tir_data(&c->tir.insts, true_statement).right};
+    ValueId false_value = place;
+
+    if (false_block_length) {
+        TirId false_statement = get_statement_inst(c, (TirId) {get_tir_extra(&c->tir.insts, false_block)});
+
+        if (get_tir_tag(&c->tir.insts, false_statement) != TIR_ASSIGN
+            || get_tir_data(&c->tir.insts, false_statement).left != place.id) {
+            return false;
+        }
+
+        false_value = (ValueId) {get_tir_data(&c->tir.insts, false_statement).right};
+    }
+
+    ValueTag place_tag = get_value_tag(c->tir.ctx, place);
+    TypeId type = get_value_type(c->tir.ctx, place);
+    int32_t budget = SPECULATION_BUDGET;
+
+    if ((place_tag != VAL_VARIABLE && place_tag != VAL_MUTABLE_VARIABLE) || !is_select_type(c, type)
+        || !is_speculatable(c, true_value, &budget) || !is_speculatable(c, false_value, &budget)) {
+        return false;
+    }
+
+    MirId condition_mir = transform_value(c, condition);
+    MirId true_mir = transform_value(c, true_value);
+    MirId false_mir = transform_value(c, false_value);
+    MirId select_mir = add_select_instruction(c, type, condition_mir, true_mir, false_mir);
+    *result = add_binary_instruction(c, MIR_ASSIGN, type, transform_value(c, place), select_mir);
+    return true;
+}
+
+static MirId transform_if(Context *c, TirId tir_id) {
+    TirInstData data = get_tir_data(&c->tir.insts, tir_id);
+    ValueId condition = {data.left};
+    int32_t extra = data.right;
+    int32_t true_block = get_tir_extra(&c->tir.insts, extra);
+    int32_t true_block_length = get_tir_extra(&c->tir.insts, extra + 1);
+    int32_t false_block = get_tir_extra(&c->tir.insts, extra + 2);
+    int32_t false_block_length = get_tir_extra(&c->tir.insts, extra + 3);
+
+    MirId select_mir;
+
+    if (transform_select_if(c, condition, true_block, true_block_length, false_block, false_block_length, &select_mir)) {
+        return select_mir;
+    }
+
+    MirId condition_mir = transform_value(c, condition);
+    int64_t constant;
+
+    // Only the branch that is taken is lowered when the condition is known,
+    // e.g. because a param was replaced by a constant.
+    if (get_mir_const_int(c, condition_mir, &constant)) {
+        int32_t block = constant ? true_block : false_block;
+        int32_t block_length = constant ? true_block_length : false_block_length;
+
+        for (int32_t i = 0; i < block_length; i++) {
+            TirId statement = {get_tir_extra(&c->tir.insts, block + i)};
+            transform_node(c, statement, null_type);
+        }
+
+        return condition_mir;
+    }
+
+    MirId condition_br = add_cond_br_instruction(c, MIR_BR_IF_NOT, condition_mir);
+
+    for (int32_t i = 0; i < true_block_length; i++) {
+        TirId statement = {get_tir_extra(&c->tir.insts, true_block + i)};
+        transform_node(c, statement, null_type);
+    }
+
+    MirId true_br = condition_br;
+
+    if (!last_is_terminator(c, condition_br)) {
+        true_br = add_br_instruction(c);
+    }
+
+    int32_t false_basic_block = c->basic_block;
+
+    for (int32_t i = 0; i < false_block_length; i++) {
+        TirId statement = {get_tir_extra(&c->tir.insts, false_block + i)};
+        transform_node(c, statement, null_type);
+    }
+
+    MirId false_br = condition_br;
+
+    if (!last_is_terminator(c, true_br)) {
+        false_br = add_br_instruction(c);
+    }
+
+    int32_t next_basic_block = c->basic_block;
+    patch_br(c, condition_br, false_basic_block);
+
+    if (true_br.private_field_id != condition_br.private_field_id) {
+        patch_br(c, true_br, next_basic_block);
+    }
+
+    if (false_br.private_field_id != condition_br.private_field_id) {
+        patch_br(c, false_br, next_basic_block);
+    }
+
+    return condition_mir;
+}
+
+// A value switch whose patterns and values can all be evaluated up front
+// becomes a chain of selects, and the switches built for `and` and `or` become
+// bitwise operations on booleans.
+static bool transform_select_switch(Context *c, TirId tir_id, TypeId type, MirId *result) {
+    TirInstData data = get_tir_data(&c->tir.insts, tir_id);
+    ValueId switch_ = {data.left};
+    int32_t branches = get_tir_extra(&c->tir.insts, data.right);
+    int32_t branch_count = get_tir_extra(&c->tir.insts, data.right + 1);
+    int32_t budget = SPECULATION_BUDGET;
+
+    if (!is_select_type(c, type) || branch_count == 0) {
+        return false;
+    }
+
+    // The value switched on is evaluated unconditionally anyway. Only the last
+    // branch may be the else branch.
+    for (int32_t i = 0; i < branch_count; i++) {
+        ValueId pattern = {get_tir_extra(&c->tir.insts, branches + i * 2)};
+        ValueId value = {get_tir_extra(&c->tir.insts, branches + i * 2 + 1)};
+
+        if (!pattern.id != (i == branch_count - 1)) {
+            return false;
+        }
+
+        if ((pattern.id && !is_speculatable(c, pattern, &budget)) || !is_speculatable(c, value, &budget)) {
+            return false;
+        }
+    }
+
+    MirId switch_mir = {0};
+    TypeId pattern_type = null_type;
+
+    if (switch_.id) {
+        switch_mir = transform_value(c, switch_);
+        pattern_type = get_value_type(c->tir.ctx, switch_);
+    }
+
+    if (branch_count == 2 && pattern_type.id == TYPE_bool && type.id == TYPE_bool) {
+        ValueId pattern = {get_tir_extra(&c->tir.insts, branches)};
+        ValueId value = {get_tir_extra(&c->tir.insts, branches + 1)};
+
+        if (pattern.id == value.id && get_value_tag(c->tir.ctx, pattern) == VAL_CONST_INT) {
+            ValueId other = {get_tir_extra(&c->tir.insts, branches + 3)};
+            MirTag tag = get_value_int(c->tir.ctx, pattern) ? MIR_OR : MIR_AND;
+            *result = add_binary_instruction(c, tag, type_bool, switch_mir, transform_value(c, other));
+            return true;
+        }
+    }
+
+    MirId *conditions = arena_alloc(&c->scratch, MirId, branch_count);
+    MirId *values = arena_alloc(&c->scratch, MirId, branch_count);
+
+    for (int32_t i = 0; i < branch_count; i++) {
+        ValueId pattern = {get_tir_extra(&c->tir.insts, branches + i * 2)};
+        ValueId value = {get_tir_extra(&c->tir.insts, branches + i * 2 + 1)};
+
+        if (pattern.id) {
+            conditions[i] = transform_value(c, pattern);
+
+            if (switch_.id) {
+                conditions[i] = add_binary_instruction(c, MIR_EQ, pattern_type, switch_mir, conditions[i]);
+            }
+        }
+
+        values[i] = transform_value(c, value);
+    }
+
+    *result = values[branch_count - 1];
+
+    for (int32_t i = branch_count - 2; i >= 0; i--) {
+        *result = add_select_instruction(c, type, conditions[i], values[i], *result);
+    }
+
+    return true;
+}
+
+static MirId transform_switch(Context *c, TirId tir_id, TypeId type) {
+    TirInstData data = get_tir_data(&c->tir.insts, tir_id);
+    ValueId switch_ = {data.left};
+    int32_t extra = data.right;
+    int32_t branches = get_tir_extra(&c->tir.insts, extra);
+    int32_t branch_count = get_tir_extra(&c->tir.insts, extra + 1);
+    MirId select_mir;
+
+    if (transform_select_switch(c, tir_id, type, &select_mir)) {
+        return select_mir;
+    }
+
+    MirId alloc_mir = {0};
+
+    if (type.id != TYPE_VOID) {
+        alloc_mir = add_leaf_instruction(c, MIR_ALLOC, type);
+    }
+
+    MirId switch_mir;
+    TypeId pattern_type;
+
+    if (switch_.id) {
+        switch_mir = transform_value(c, switch_);
+        pattern_type = get_value_type(c->tir.ctx, switch_);
+    }
+
+    MirId *br_list = arena_alloc(&c->scratch, MirId, branch_count);
+    int32_t real_count = 0;
+
+    for (int32_t i = 0; i < branch_count; i++) {
+        ValueId pattern = {get_tir_extra(&c->tir.insts, branches + i * 2)};
+        ValueId value = {get_tir_extra(&c->tir.insts, branches + i * 2 + 1)};
+
+        if (pattern.id) {
+            MirId pattern_mir = transform_value(c, pattern);
+            MirId condition_mir = pattern_mir;
+
+            if (switch_.id) {
                 condition_mir = add_binary_instruction(c, MIR_EQ, pattern_type, switch_mir, pattern_mir);
             }
 
-            MirId condition_br = add_cond_br_instruction(c, MIR_BR_IF_NOT, condition_mir);
-            MirId value_mir = transform_value(c, value);
-            if (type.id != TYPE_VOID) {
-                add_binary_instruction(c, MIR_ASSIGN, type, alloc_mir, value_mir);
-            }
-            br_list[real_count++] = add_br_instruction(c);
-            int32_t next_case_basic_block = c->basic_block;
-            patch_br(c, condition_br, next_case_basic_block);
+            MirId condition_br = add_cond_br_instruction(c, MIR_BR_IF_NOT, condition_mir);
+            MirId value_mir = transform_value(c, value);
+            if (type.id != TYPE_VOID) {
+                add_binary_instruction(c, MIR_ASSIGN, type, alloc_mir, value_mir);
+            }
+            br_list[real_count++] = add_br_instruction(c);
+            int32_t next_case_basic_block = c->basic_block;
+            patch_br(c, condition_br, next_case_basic_block);
+        } else {
+            MirId value_mir = transform_value(c, value);
+            if (type.id != TYPE_VOID) {
+                add_binary_instruction(c, MIR_ASSIGN, type, alloc_mir, value_mir);
+            }
+            br_list[real_count++] = add_br_instruction(c);
+            break;
+        }
+
+        pattern = value;
+    }
+
+    for (int32_t i = 0; i < real_count; i++) {
+        patch_br(c, br_list[i], c->basic_block);
+    }
+
+    return alloc_mir;
+}
+
+// Loop-invariant code motion. Before a loop is lowered, the largest
+// subexpressions of it that compute the same value in every iteration are
+// lowered once in front of it. Memory is assumed to change in any loop that
+// calls a function or stores through a pointer.
+
+typedef struct {
+    // Variables that are declared or assigned in the loop.
+    bool *assigned;
+    bool writes_memory;
+    bool has_jumps;
+    // Number of instructions, as an estimate of the code size.
+    int32_t size;
+} LoopEffects;
+
+static bool is_array_value(Context *c, ValueId value) {
+    TypeId type = remove_tags(c->tir.ctx, get_value_type(c->tir.ctx, value));
+    return get_type_tag(c->tir.ctx, type) == TYPE_ARRAY;
+}
+
+// The variable a place is part of, or -1 if it is reached through a pointer.
+static int32_t get_place_variable(Context *c, ValueId place) {
+    while (get_value_tag(c->tir.ctx, place) == VAL_TEMPORARY) {
+        TirId tir_id = {get_value_data(c->tir.ctx, place)->index};
+        TirTag tag = get_tir_tag(&c->tir.insts, tir_id);
+        ValueId operand = {get_tir_data(&c->tir.insts, tir_id).left};
+
+        if (tag != TIR_ACCESS && tag != TIR_NOP && !(tag == TIR_INDEX && is_array_value(c, operand))) {
+            return -1;
+        }
+
+        place = operand;
+    }
+
+    ValueTag tag = get_value_tag(c->tir.ctx, place);
+
+    if (tag == VAL_VARIABLE || tag == VAL_MUTABLE_VARIABLE) {
+        return get_value_data(c->tir.ctx, place)->index;
+    }
+
+    return -1;
+}
+
+static void find_address_taken(Context *c) {
+    c->address_taken = arena_alloc(&c->scratch, bool, c->tir.ctx.thread->local_count);
+
+    for (int32_t i = 0; i < c->tir.insts.insts.len; i++) {
+        TirId tir_id = {i};
+        TirTag tag = get_tir_tag(&c->tir.insts, tir_id);
+
+        if (tag == TIR_ADDRESS || tag == TIR_SLICE || tag == TIR_ARRAY_TO_SLICE) {
+            int32_t variable = get_place_variable(c, (ValueId) {get_tir_data(&c->tir.insts, tir_id).left});
+
+            if (variable >= 0) {
+                c->address_taken[variable] = true;
+            }
+        }
+    }
+}
+
+static void find_loop_effects(Context *c, LoopEffects *e, TirId tir_id);
+
+static void find_value_effects(Context *c, LoopEffects *e, ValueId value) {
+    if (value.id && get_value_tag(c->tir.ctx, value) == VAL_TEMPORARY) {
+        find_loop_effects(c, e, (TirId) {get_value_data(c->tir.ctx, value)->index});
+    }
+}
+
+static void find_block_effects(Context *c, LoopEffects *e, int32_t block, int32_t block_length) {
+    for (int32_t i = 0; i < block_length; i++) {
+        find_loop_effects(c, e, (TirId) {get_tir_extra(&c->tir.insts, block + i)});
+    }
+}
+
+static void find_loop_effects(Context *c, LoopEffects *e, TirId tir_id) {
+    TirInstData data = get_tir_data(&c->tir.insts, tir_id);
+    ValueId left = {data.left};
+    ValueId right = {data.right};
+    e->size++;
+
+    switch (get_tir_tag(&c->tir.insts, tir_id)) {
+        case TIR_LET:
+        case TIR_MUT: {
+            e->assigned[data.left] = true;
+            find_value_effects(c, e, right);
+            break;
+        }
+        case TIR_ASSIGN:
+        case TIR_ASSIGN_ADD:
+        case TIR_ASSIGN_SUB:
+        case TIR_ASSIGN_MUL:
+        case TIR_ASSIGN_DIV:
+        case TIR_ASSIGN_MOD:
+        case TIR_ASSIGN_AND:
+        case TIR_ASSIGN_OR:
+        case TIR_ASSIGN_XOR: {
+            int32_t variable = get_place_variable(c, left);
+
+            if (variable >= 0) {
+                e->assigned[variable] = true;
+            }
+
+            if (variable < 0 || c->address_taken[variable]) {
+                e->writes_memory = true;
+            }
+
+            find_value_effects(c, e, left);
+            find_value_effects(c, e, right);
+            break;
+        }
+        case TIR_CALL: {
+            int32_t param_count = get_function_type(c->tir.ctx, get_value_type(c->tir.ctx, left)).param_count;
+            e->writes_memory = true;
+            find_value_effects(c, e, left);
+
+            for (int32_t i = 0; i < param_count; i++) {
+                find_value_effects(c, e, (ValueId) {get_tir_extra(&c->tir.insts, data.right + i)});
+            }
+            break;
+        }
+        case TIR_IF: {
+            find_value_effects(c, e, left);
+            find_block_effects(c, e, get_tir_extra(&c->tir.insts, data.right), get_tir_extra(&c->tir.insts, data.right + 1));
+            find_block_effects(c, e, get_tir_extra(&c->tir.insts, data.right + 2), get_tir_extra(&c->tir.insts, data.right + 3));
+            break;
+        }
+        case TIR_LOOP: {
+            find_value_effects(c, e, left);
+            find_value_effects(c, e, (ValueId) {get_tir_extra(&c->tir.insts, data.right)});
+            find_block_effects(c, e, get_tir_extra(&c->tir.insts, data.right + 1), get_tir_extra(&c->tir.insts, data.right + 2));
+            break;
+        }
+        case TIR_SWITCH: {
+            int32_t branches = get_tir_extra(&c->tir.insts, data.right);
+            int32_t branch_count = get_tir_extra(&c->tir.insts, data.right + 1);
+            find_value_effects(c, e, left);
+
+            for (int32_t i = 0; i < branch_count * 2; i++) {
+                find_value_effects(c, e, (ValueId) {get_tir_extra(&c->tir.insts, branches + i)});
+            }
+            break;
+        }
+        case TIR_NEW_STRUCT:
+        case TIR_NEW_ARRAY: {
+            for (int32_t i = 0; i < data.right; i++) {
+                find_value_effects(c, e, (ValueId) {get_tir_extra(&c->tir.insts, data.left + i)});
+            }
+            break;
+        }
+        case TIR_SLICE: {
+            find_value_effects(c, e, left);
+            find_value_effects(c, e, (ValueId) {get_tir_extra(&c->tir.insts, data.right)});
+            find_value_effects(c, e, (ValueId) {get_tir_extra(&c->tir.insts, data.right + 1)});
+            break;
+        }
+        case TIR_ADD:
+        case TIR_SUB:
+        case TIR_MUL:
+        case TIR_DIV:
+        case TIR_MOD:
+        case TIR_AND:
+        case TIR_OR:
+        case TIR_XOR:
+        case TIR_SHL:
+        case TIR_SHR:
+        case TIR_EQ:
+        case TIR_NE:
+        case TIR_LT:
+        case TIR_GT:
+        case TIR_LE:
+        case TIR_GE:
+        case TIR_INDEX: {
+            find_value_effects(c, e, left);
+            find_value_effects(c, e, right);
+            break;
+        }
+        case TIR_BREAK:
+        case TIR_CONTINUE: {
+            e->has_jumps = true;
+            break;
+        }
+        case TIR_FUNCTION: {
+            break;
+        }
+        default: {
+            find_value_effects(c, e, left);
+            break;
+        }
+    }
+}
+
+static bool is_constant_divisor(Context *c, ValueId value) {
+    if (get_value_tag(c->tir.ctx, value) != VAL_CONST_INT) {
+        return false;
+    }
+
+    int64_t i = get_value_int(c->tir.ctx, value);
+    return i != 0 && i != -1;
+}
+
+// Whether a value is the same in every iteration. `may_trap` is set if
+// computing it ahead of the loop could fault when the loop would not have.
+static bool is_loop_invariant(Context *c, LoopEffects *e, ValueId value, bool *may_trap) {
+    switch (get_value_tag(c->tir.ctx, value)) {
+        case VAL_FUNCTION:
+        case VAL_EXTERN_FUNCTION:
+        case VAL_CONST_INT:
+        case VAL_CONST_FLOAT:
+        case VAL_CONST_NULL:
+        case VAL_STRING: {
+            return true;
+        }
+        case VAL_EXTERN_VAR: {
+            return !e->writes_memory;
+        }
+        case VAL_VARIABLE:
+        case VAL_MUTABLE_VARIABLE: {
+            int32_t variable = get_value_data(c->tir.ctx, value)->index;
+            return !e->assigned[variable] && !(c->address_taken[variable] && e->writes_memory);
+        }
+        case VAL_ERROR: {
+            return false;
+        }
+        case VAL_TEMPORARY: {
+            break;
+        }
+    }
+
+    TirId tir_id = {get_value_data(c->tir.ctx, value)->index};
+    TirInstData data = get_tir_data(&c->tir.insts, tir_id);
+    ValueId left = {data.left};
+    ValueId right = {data.right};
+
+    switch (get_tir_tag(&c->tir.insts, tir_id)) {
+        case TIR_DIV:
+        case TIR_MOD: {
+            if (!is_constant_divisor(c, right)) {
+                *may_trap = true;
+            }
+            return is_loop_invariant(c, e, left, may_trap) && is_loop_invariant(c, e, right, may_trap);
+        }
+        case TIR_ADD:
+        case TIR_SUB:
+        case TIR_MUL:
+        case TIR_AND:
+        case TIR_OR:
+        case TIR_XOR:
+        case TIR_SHL:
+        case TIR_SHR:
+        case TIR_EQ:
+        case TIR_NE:
+        case TIR_LT:
+        case TIR_GT:
+        case TIR_LE:
+        case TIR_GE: {
+            return is_loop_invariant(c, e, left, may_trap) && is_loop_invariant(c, e, right, may_trap);
+        }
+        case TIR_FTOI: {
+            *may_trap = true;
+            return is_loop_invariant(c, e, left, may_trap);
+        }
+        case TIR_PLUS:
+        case TIR_MINUS:
+        case TIR_NOT:
+        case TIR_NOP:
+        case TIR_ITOF:
+        case TIR_ITRUNC:
+        case TIR_SEXT:
+        case TIR_ZEXT:
+        case TIR_FTRUNC:
+        case TIR_FEXT:
+        case TIR_PTR_CAST:
+        case TIR_ACCESS: {
+            return is_loop_invariant(c, e, left, may_trap);
+        }
+        case TIR_INDEX: {
+            *may_trap = true;
+
+            if (!is_array_value(c, left) && e->writes_memory) {
+                return false;
+            }
+
+            return is_loop_invariant(c, e, left, may_trap) && is_loop_invariant(c, e, right, may_trap);
+        }
+        case TIR_DEREF: {
+            *may_trap = true;
+            return !e->writes_memory && is_loop_invariant(c, e, left, may_trap);
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+static void hoist_operands(Context *c, LoopEffects *e, TirId tir_id, bool executed);
+
+// `executed` tells whether the value is computed whenever the loop is entered.
+// Places are never hoisted themselves, since they are not read.
+static void hoist_value(Context *c, LoopEffects *e, ValueId value, bool executed, bool place) {
+    if (!value.id || get_value_tag(c->tir.ctx, value) != VAL_TEMPORARY) {
+        return;
+    }
+
+    TirId tir_id = {get_value_data(c->tir.ctx, value)->index};
+    TirTag tag = get_tir_tag(&c->tir.insts, tir_id);
+    TypeId type = get_value_type(c->tir.ctx, value);
+    bool may_trap = false;
+
+    if (place || tag == TIR_NOP || tag == TIR_PLUS || type.id == TYPE_VOID || is_aggregate_type(c->tir.ctx, type)
+        || !is_loop_invariant(c, e, value, &may_trap) || (may_trap && !executed)) {
+        hoist_operands(c, e, tir_id, executed);
+        return;
+    }
+
+    MirId mir_id = transform_value(c, value);
+
+    switch (get_mir_tag(&c->mir, mir_id)) {
+        case MIR_DEREF:
+        case MIR_INDEX:
+        case MIR_SLICE_INDEX:
+        case MIR_ACCESS: {
+            mir_id = add_unary_instruction(c, MIR_LOAD, type, mir_id);
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+
+    c->hoisted[tir_id.id] = mir_id;
+}
+
+static void hoist_block(Context *c, LoopEffects *e, int32_t block, int32_t block_length) {
+    for (int32_t i = 0; i < block_length; i++) {
+        hoist_operands(c, e, (TirId) {get_tir_extra(&c->tir.insts, block + i)}, false);
+    }
+}
+
+static void hoist_operands(Context *c, LoopEffects *e, TirId tir_id, bool executed) {
+    TirInstData data = get_tir_data(&c->tir.insts, tir_id);
+    ValueId left = {data.left};
+    ValueId right = {data.right};
+
+    switch (get_tir_tag(&c->tir.insts, tir_id)) {
+        case TIR_LET:
+        case TIR_MUT: {
+            hoist_value(c, e, right, executed, false);
+            break;
+        }
+        case TIR_ASSIGN:
+        case TIR_ASSIGN_ADD:
+        case TIR_ASSIGN_SUB:
+        case TIR_ASSIGN_MUL:
+        case TIR_ASSIGN_DIV:
+        case TIR_ASSIGN_MOD:
+        case TIR_ASSIGN_AND:
+        case TIR_ASSIGN_OR:
+        case TIR_ASSIGN_XOR: {
+            hoist_value(c, e, left, executed, true);
+            hoist_value(c, e, right, executed, false);
+            break;
+        }
+        case TIR_ADDRESS:
+        case TIR_ARRAY_TO_SLICE:
+        case TIR_ACCESS: {
+            hoist_value(c, e, left, executed, true);
+            break;
+        }
+        case TIR_INDEX: {
+            hoist_value(c, e, left, executed, is_aggregate_type(c->tir.ctx, get_value_type(c->tir.ctx, left)));
+            hoist_value(c, e, right, executed, false);
+            break;
+        }
+        case TIR_SLICE: {
+            hoist_value(c, e, left, executed, is_aggregate_type(c->tir.ctx, get_value_type(c->tir.ctx, left)));
+            hoist_value(c, e, (ValueId) {get_tir_extra(&c->tir.insts, data.right)}, executed, false);
+            hoist_value(c, e, (ValueId) {get_tir_extra(&c->tir.insts, data.right + 1)}, executed, false);
+            break;
+        }
+        case TIR_CALL: {
+            int32_t param_count = get_function_type(c->tir.ctx, get_value_type(c->tir.ctx, left)).param_count;
+            hoist_value(c, e, left, executed, false);
+
+            for (int32_t i = 0; i < param_count; i++) {
+                hoist_value(c, e, (ValueId) {get_tir_extra(&c->tir.insts, data.right + i)}, executed, false);
+            }
+            break;
+        }
+        case TIR_IF: {
+            hoist_value(c, e, left, executed, false);
+            hoist_block(c, e, get_tir_extra(&c->tir.insts, data.right), get_tir_extra(&c->tir.insts, data.right + 1));
+            hoist_block(c, e, get_tir_extra(&c->tir.insts, data.right + 2), get_tir_extra(&c->tir.insts, data.right + 3));
+            break;
+        }
+        case TIR_LOOP: {
+            hoist_value(c, e, left, false, false);
+            hoist_value(c, e, (ValueId) {get_tir_extra(&c->tir.insts, data.right)}, false, false);
+            hoist_block(c, e, get_tir_extra(&c->tir.insts, data.right + 1), get_tir_extra(&c->tir.insts, data.right + 2));
+            break;
+        }
+        case TIR_SWITCH: {
+            int32_t branches = get_tir_extra(&c->tir.insts, data.right);
+            int32_t branch_count = get_tir_extra(&c->tir.insts, data.right + 1);
+            hoist_value(c, e, left, executed, false);
+
+            for (int32_t i = 0; i < branch_count * 2; i++) {
+                hoist_value(c, e, (ValueId) {get_tir_extra(&c->tir.insts, branches + i)}, false, false);
+            }
+            break;
+        }
+        case TIR_NEW_STRUCT:
+        case TIR_NEW_ARRAY: {
+            for (int32_t i = 0; i < data.right; i++) {
+                hoist_value(c, e, (ValueId) {get_tir_extra(&c->tir.insts, data.left + i)}, executed, false);
+            }
+            break;
+        }
+        case TIR_ADD:
+        case TIR_SUB:
+        case TIR_MUL:
+        case TIR_DIV:
+        case TIR_MOD:
+        case TIR_AND:
+        case TIR_OR:
+        case TIR_XOR:
+        case TIR_SHL:
+        case TIR_SHR:
+        case TIR_EQ:
+        case TIR_NE:
+        case TIR_LT:
+        case TIR_GT:
+        case TIR_LE:
+        case TIR_GE: {
+            hoist_value(c, e, left, executed, false);
+            hoist_value(c, e, right, executed, false);
+            break;
+        }
+        case TIR_FUNCTION:
+        case TIR_BREAK:
+        case TIR_CONTINUE: {
+            break;
+        }
+        default: {
+            hoist_value(c, e, left, executed, false);
+            break;
+        }
+    }
+}
+
+static void hoist_loop_invariants(Context *c, TirId tir_id) {
+    Arena scratch = c->scratch;
+    TirInstData data = get_tir_data(&c->tir.insts, tir_id);
+    LoopEffects e = {arena_alloc(&c->scratch, bool, c->tir.ctx.thread->local_count), false, false, 0};
+    find_loop_effects(c, &e, tir_id);
+
+    // The condition is evaluated at least once, the rest of the loop may not be.
+    hoist_value(c, &e, (ValueId) {data.left}, true, false);
+    hoist_value(c, &e, (ValueId) {get_tir_extra(&c->tir.insts, data.right)}, false, false);
+    hoist_block(c, &e, get_tir_extra(&c->tir.insts, data.right + 1), get_tir_extra(&c->tir.insts, data.right + 2));
+    c->scratch = scratch;
+}
+
+// Loop unrolling. A loop that counts a variable from a constant by a constant
+// step up to a constant bound runs a known number of times. Short loops are
+// replaced by a copy of the body for every iteration, in which the variable is
+// a constant. Longer loops with small bodies repeat the body a few times per
+// condition check.
+
+#define MAX_UNROLLED_TRIPS 16
+#define MAX_UNROLLED_SIZE 192
+#define MAX_PARTIAL_UNROLL_BODY 24
+#define MAX_COUNTED_TRIPS 4096
+
+typedef struct {
+    int32_t variable;
+    TypeId type;
+    int64_t start;
+    int64_t step;
+    int32_t trips;
+} CountedLoop;
+
+// The constant last assigned to a variable in the current basic block.
+static bool find_initial_value(Context *c, MirId alloc, int64_t *value) {
+    for (int32_t i = c->mir.mir.len - 1; i > alloc.private_field_id; i--) {
+        MirId mir_id = {i};
+        MirTag tag = get_mir_tag(&c->mir, mir_id);
+
+        if (is_mir_terminator(tag)) {
+            return false;
+        }
+
+        if (tag == MIR_ASSIGN && get_mir_binary(&c->mir, mir_id).left.private_field_id == alloc.private_field_id) {
+            return get_mir_const_int(c, get_mir_binary(&c->mir, mir_id).right, value);
+        }
+    }
+
+    return false;
+}
+
+static bool compare_int(TirTag tag, int64_t left, int64_t right) {
+    switch (tag) {
+        case TIR_LT: return left < right;
+        case TIR_GT: return left > right;
+        case TIR_LE: return left <= right;
+        case TIR_GE: return left >= right;
+        case TIR_NE: return left != right;
+
+        default: return false;
+    }
+}
+
+static bool is_variable(Context *c, ValueId value, int32_t variable) {
+    return get_value_tag(c->tir.ctx, value) == VAL_MUTABLE_VARIABLE && get_value_data(c->tir.ctx, value)->index == variable;
+}
+
+static bool find_counted_loop(Context *c, ValueId condition, ValueId next, CountedLoop *loop) {
+    if (!next.id || get_value_tag(c->tir.ctx, next) != VAL_TEMPORARY || get_value_tag(c->tir.ctx, condition) != VAL_TEMPORARY) {
+        return false;
+    }
+
+    TirId next_tir = {get_value_data(c->tir.ctx, next)->index};
+    TirTag next_tag = get_tir_tag(&c->tir.insts, next_tir);
+    ValueId counter = {get_tir_data(&c->tir.insts, next_tir).left};
+    ValueId step = {get_tir_data(&c->tir.insts, next_tir).right};
+
+    if ((next_tag != TIR_ASSIGN_ADD && next_tag != TIR_ASSIGN_SUB) || get_value_tag(c->tir.ctx, counter) != VAL_MUTABLE_VARIABLE
+        || get_value_tag(c->tir.ctx, step) != VAL_CONST_INT) {
+        return false;
+    }
+
+    loop->variable = get_value_data(c->tir.ctx, counter)->index;
+    loop->type = get_value_type(c->tir.ctx, counter);
+    loop->step = get_value_int(c->tir.ctx, step);
+
+    if (next_tag == TIR_ASSIGN_SUB) {
+        loop->step = -loop->step;
+    }
+
+    if (!type_is_int(loop->type) || loop->step == 0 || c->address_taken[loop->variable]
+        || !find_initial_value(c, c->variable_to_mir_map[loop->variable], &loop->start)) {
+        return false;
+    }
+
+    TirId condition_tir = {get_value_data(c->tir.ctx, condition)->index};
+    TirTag tag = get_tir_tag(&c->tir.insts, condition_tir);
+    ValueId left = {get_tir_data(&c->tir.insts, condition_tir).left};
+    ValueId right = {get_tir_data(&c->tir.insts, condition_tir).right};
+
+    // The variable is kept on the left.
+    if (is_variable(c, right, loop->variable)) {
+        ValueId swap = left;
+        left = right;
+        right = swap;
+
+        switch (tag) {
+            case TIR_LT: tag = TIR_GT; break;
+            case TIR_GT: tag = TIR_LT; break;
+            case TIR_LE: tag = TIR_GE; break;
+            case TIR_GE: tag = TIR_LE; break;
+            default: break;
+        }
+    }
+
+    if (!is_variable(c, left, loop->variable) || get_value_tag(c->tir.ctx, right) != VAL_CONST_INT) {
+        return false;
+    }
+
+    int64_t bound = get_value_int(c->tir.ctx, right);
+    int32_t bits = (int32_t) sizeof_type(c->tir.ctx, loop->type, c->target) * 8;
+    int64_t max = bits == 64 ? INT64_MAX : (1ll << (bits - 1)) - 1;
+    int64_t min = -max - 1;
+    int64_t i = loop->start;
+    loop->trips = 0;
+
+    while (compare_int(tag, i, bound)) {
+        if (loop->trips == MAX_COUNTED_TRIPS || (loop->step > 0 ? i > max - loop->step : i < min - loop->step)) {
+            return false;
+        }
+
+        i += loop->step;
+        loop->trips++;
+    }
+
+    return true;
+}
+
+// A counter that starts at a constant that is not negative and is only
+// incremented by `next` stays in bounds of what the condition compares it to,
+// unless the body assigns either of them.
+static bool find_index_bound(Context *c, TirId tir_id, IndexBound *bound) {
+    TirInstData data = get_tir_data(&c->tir.insts, tir_id);
+    ValueId condition = {data.left};
+    ValueId next = {get_tir_extra(&c->tir.insts, data.right)};
+    int32_t block = get_tir_extra(&c->tir.insts, data.right + 1);
+    int32_t block_length = get_tir_extra(&c->tir.insts, data.right + 2);
+
+    if (!next.id || get_value_tag(c->tir.ctx, next) != VAL_TEMPORARY || get_value_tag(c->tir.ctx, condition) != VAL_TEMPORARY) {
+        return false;
+    }
+
+    TirId next_tir = {get_value_data(c->tir.ctx, next)->index};
+    ValueId counter = {get_tir_data(&c->tir.insts, next_tir).left};
+    ValueId step = {get_tir_data(&c->tir.insts, next_tir).right};
+    int64_t start;
+
+    if (get_tir_tag(&c->tir.insts, next_tir) != TIR_ASSIGN_ADD || get_value_tag(c->tir.ctx, counter) != VAL_MUTABLE_VARIABLE
+        || get_value_tag(c->tir.ctx, step) != VAL_CONST_INT || get_value_int(c->tir.ctx, step) < 1
+        || get_value_type(c->tir.ctx, counter).id != type_isize.id) {
+        return false;
+    }
+
+    bound->variable = get_value_data(c->tir.ctx, counter)->index;
+    bound->slice = -1;
+
+    if (c->address_taken[bound->variable] || !find_initial_value(c, c->variable_to_mir_map[bound->variable], &start)
+        || start < 0) {
+        return false;
+    }
+
+    TirId condition_tir = {get_value_data(c->tir.ctx, condition)->index};
+    TirTag tag = get_tir_tag(&c->tir.insts, condition_tir);
+    ValueId left = {get_tir_data(&c->tir.insts, condition_tir).left};
+    ValueId right = {get_tir_data(&c->tir.insts, condition_tir).right};
+
+    if (tag == TIR_GT || tag == TIR_GE) {
+        ValueId swap = left;
+        left = right;
+        right = swap;
+        tag = tag == TIR_GT ? TIR_LT : TIR_LE;
+    }
+
+    if ((tag != TIR_LT && tag != TIR_LE) || !is_variable(c, left, bound->variable)) {
+        return false;
+    }
+
+    int64_t increment = get_value_int(c->tir.ctx, step);
+    int64_t max = sizeof_pointer(c->target) == 8 ? INT64_MAX : INT32_MAX;
+
+    if (get_value_tag(c->tir.ctx, right) == VAL_CONST_INT) {
+        bound->limit = get_value_int(c->tir.ctx, right);
+
+        if (tag == TIR_LE) {
+            if (bound->limit == max) {
+                return false;
+            }
+            bound->limit++;
+        }
+
+        // The counter must not overflow on its way past the limit.
+        if (bound->limit - 1 > max - increment) {
+            return false;
+        }
+    } else if (tag == TIR_LT && increment == 1 && get_value_tag(c->tir.ctx, right) == VAL_TEMPORARY) {
+        TirId length_tir = {get_value_data(c->tir.ctx, right)->index};
+        ValueId slice = {get_tir_data(&c->tir.insts, length_tir).left};
+
+        if (get_tir_tag(&c->tir.insts, length_tir) != TIR_ACCESS || get_tir_data(&c->tir.insts, length_tir).right != 0
+            || !remove_slice(c->tir.ctx, get_value_type(c->tir.ctx, slice)).id) {
+            return false;
+        }
+
+        bound->slice = get_variable(c, slice);
+
+        if (bound->slice < 0 || c->address_taken[bound->slice]) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    Arena scratch = c->scratch;
+    LoopEffects e = {arena_alloc(&c->scratch, bool, c->tir.ctx.thread->local_count), false, false, 0};
+    find_block_effects(c, &e, block, block_length);
+    c->scratch = scratch;
+    return !e.assigned[bound->variable] && (bound->slice < 0 || !e.assigned[bound->slice]);
+}
+
+// The bound only holds in the body, since the condition is also lowered for
+// the value of the counter that ends the loop.
+static void transform_loop_body(Context *c, IndexBound const *bound, int32_t block, int32_t block_length) {
+    if (bound) {
+        vec_push(&c->index_bounds, *bound);
+    }
+
+    for (int32_t i = 0; i < block_length; i++) {
+        TirId statement = {get_tir_extra(&c->tir.insts, block + i)};
+        transform_node(c, statement, null_type);
+    }
+
+    if (bound) {
+        c->index_bounds.len--;
+    }
+}
+
+// Every copy of the body lowers its temporaries again, including ones that
+// inner loops hoist.
+static void restore_hoisted(Context *c, MirId *hoisted) {
+    memcpy(c->hoisted, hoisted, c->tir.insts.insts.len * sizeof(MirId));
+}
+
+static bool unroll_loop(Context *c, TirId tir_id, IndexBound const *bound, MirId *result) {
+    TirInstData data = get_tir_data(&c->tir.insts, tir_id);
+    ValueId condition = {data.left};
+    ValueId next = {get_tir_extra(&c->tir.insts, data.right)};
+    int32_t block = get_tir_extra(&c->tir.insts, data.right + 1);
+    int32_t block_length = get_tir_extra(&c->tir.insts, data.right + 2);
+    CountedLoop loop;
+
+    if (!find_counted_loop(c, condition, next, &loop)) {
+        return false;
+    }
+
+    Arena scratch = c->scratch;
+    LoopEffects e = {arena_alloc(&c->scratch, bool, c->tir.ctx.thread->local_count), false, false, 0};
+    find_block_effects(c, &e, block, block_length);
+    c->scratch = scratch;
+
+    if (e.assigned[loop.variable] || e.has_jumps) {
+        return false;
+    }
+
+    int32_t factor = 1;
+
+    if (loop.trips > MAX_UNROLLED_TRIPS || loop.trips * e.size > MAX_UNROLLED_SIZE) {
+        if (e.size * 4 <= MAX_PARTIAL_UNROLL_BODY && loop.trips % 4 == 0) {
+            factor = 4;
+        } else if (e.size * 2 <= MAX_PARTIAL_UNROLL_BODY && loop.trips % 2 == 0) {
+            factor = 2;
         } else {
-            MirId value_mir = transform_value(c, value);
-            if (type.id != TYPE_VOID) {
-                add_binary_instruction(c, MIR_ASSIGN, type, alloc_mir, value_mir);
-            }
-            br_list[real_count++] = add_br_instruction(c);
-            break;
+            return false;
         }
+    }
 
-        pattern = value;
+    hoist_loop_invariants(c, tir_id);
+    MirId *hoisted = arena_alloc(&c->scratch, MirId, c->tir.insts.insts.len);
+    memcpy(hoisted, c->hoisted, c->tir.insts.insts.len * sizeof(MirId));
+    MirId alloc = c->variable_to_mir_map[loop.variable];
+
+    if (factor == 1) {
+        for (int32_t i = 0; i < loop.trips; i++) {
+            restore_hoisted(c, hoisted);
+            c->variable_to_mir_map[loop.variable] = add_int_instruction(c, loop.type, loop.start + i * loop.step);
+            transform_loop_body(c, bound, block, block_length);
+        }
+
+        c->variable_to_mir_map[loop.variable] = alloc;
+        MirId end = add_int_instruction(c, loop.type, loop.start + loop.trips * loop.step);
+        *result = add_binary_instruction(c, MIR_ASSIGN, loop.type, alloc, end);
+        return true;
     }
 
-    for (int32_t i = 0; i < real_count; i++) {
-        patch_br(c, br_list[i], c->basic_block);
+    // The trip count is a multiple of the factor, so the condition only has to
+    // be checked before every group of iterations.
+    MirId entry_br = add_br_instruction(c);
+    int32_t condition_basic_block = c->basic_block;
+    patch_br(c, entry_br, condition_basic_block);
+    *result = transform_value(c, condition);
+    MirId condition_br = add_cond_br_instruction(c, MIR_BR_IF_NOT, *result);
+
+    for (int32_t i = 0; i < factor; i++) {
+        restore_hoisted(c, hoisted);
+        transform_loop_body(c, bound, block, block_length);
+        transform_value(c, next);
     }
 
-    return alloc_mir;
+    MirId next_iteration_br = add_br_instruction(c);
+    patch_br(c, next_iteration_br, condition_basic_block);
+    patch_br(c, condition_br, c->basic_block);
+    return true;
 }
 
 static MirId transform_loop(Context *c, TirId tir_id) {
@@ -443,7 +1951,18 @@ static MirId transform_loop(Context *c, TirId tir_id) {
     ValueId next = {get_tir_extra(&c->tir.insts, extra)};
     int32_t block = get_tir_extra(&c->tir.insts, extra + 1);
     int32_t block_length = get_tir_extra(&c->tir.insts, extra + 2);
+    MirId unrolled;
+    IndexBound bound;
 
+    // The bound is found first, since it needs the counter to still be a
+    // variable, and it holds in every unrolled copy of the body too.
+    bool has_bound = c->bounds_check && find_index_bound(c, tir_id, &bound);
+
+    if (unroll_loop(c, tir_id, has_bound ? &bound : NULL, &unrolled)) {
+        return unrolled;
+    }
+
+    hoist_loop_invariants(c, tir_id);
     MirId entry_br = add_br_instruction(c);
     int32_t condition_basic_block = c->basic_block;
     patch_br(c, entry_br, condition_basic_block);
@@ -454,10 +1973,7 @@ static MirId transform_loop(Context *c, TirId tir_id) {
     int32_t break_index = c->break_instructions.len;
     int32_t continue_index = c->continue_instructions.len;
 
-    for (int32_t i = 0; i < block_length; i++) {
-        TirId statement = {get_tir_extra(&c->tir.insts, block + i)};
-        transform_node(c, statement, null_type);
-    }
+    transform_loop_body(c, has_bound ? &bound : NULL, block, block_length);
 
     int32_t continue_basic_block = condition_basic_block;
 
@@ -504,7 +2020,15 @@ static MirId transform_return(Context *c, TirId tir_id) {
 
     if (operand.id) {
         TypeId type = get_value_type(c->tir.ctx, operand);
-        MirId operand_mir = transform_value(c, operand);
+        MirId operand_mir;
+
+        if (is_aggregate_type(c->tir.ctx, type)) {
+            operand_mir = add_leaf_instruction(c, MIR_RET_SLOT, type);
+            transform_value_into(c, operand, operand_mir);
+        } else {
+            operand_mir = transform_value(c, operand);
+        }
+
         c->basic_block++;
         return add_unary_instruction(c, MIR_RET, type, operand_mir);
     }
@@ -528,6 +2052,13 @@ static void transform_function(Context *c, TirId tir_id, ValueId value) {
         c->variable_to_mir_map[i] = add_leaf_instruction(c, MIR_PARAM, param_type);
     }
 
+    for (int32_t i = 0; c->constant_args && i < func_type.param_count; i++) {
+        if (c->constant_args[i].known && !c->address_taken[i]) {
+            TypeId param_type = get_function_type_param(c->tir.ctx, type, i);
+            c->variable_to_mir_map[i] = add_int_instruction(c, param_type, c->constant_args[i].value);
+        }
+    }
+
     int32_t block = get_tir_data(&c->tir.insts, tir_id).left;
     int32_t block_length = get_tir_data(&c->tir.insts, tir_id).right;
     int32_t start = c->mir.mir.len;
@@ -545,8 +2076,8 @@ static void transform_function(Context *c, TirId tir_id, ValueId value) {
 static MirId transform_node(Context *c, TirId tir_id, TypeId type) {
     switch (get_tir_tag(&c->tir.insts, tir_id)) {
         case TIR_FUNCTION: abort();
-        case TIR_LET: return transform_let(c, tir_id);
-        case TIR_MUT: return transform_let(c, tir_id);
+        case TIR_LET: return transform_let(c, tir_id, false);
+        case TIR_MUT: return transform_let(c, tir_id, true);
         case TIR_VALUE: return transform_value_statement(c, tir_id);
         case TIR_PLUS: return transform_plus(c, tir_id);
         case TIR_MINUS: return transform_unary(c, tir_id, MIR_MINUS);
@@ -605,28 +2136,592 @@ static MirId transform_node(Context *c, TirId tir_id, TypeId type) {
     compiler_error("tir_to_mir: unimplemented tag");
 }
 
+typedef struct {
+    TirContext ctx;
+    bool *values;
+    bool *types;
+    bool *thread_types;
+    int32_t *function_indices;
+    bool *enqueued;
+    Vec(int32_t) worklist;
+} Reachability;
+
+static void mark_type(Reachability *r, TypeId type) {
+    if (type.id < TYPE_COUNT) {
+        return;
+    }
+
+    int32_t global_count = r->ctx.global->types.types.len;
+
+    if (type.id - TYPE_COUNT < global_count) {
+        if (r->types[type.id]) {
+            return;
+        }
+        r->types[type.id] = true;
+    } else {
+        if (r->thread_types[type.id - TYPE_COUNT - global_count]) {
+            return;
+        }
+        r->thread_types[type.id - TYPE_COUNT - global_count] = true;
+    }
+
+    switch (get_type_tag(r->ctx, type)) {
+        case TYPE_PRIMITIVE:
+        case TYPE_ARRAY_LENGTH:
+        case TYPE_TYPE_PARAMETER: {
+            break;
+        }
+        case TYPE_ARRAY: {
+            ArrayType array = get_array_type(r->ctx, type);
+            mark_type(r, array.index);
+            mark_type(r, array.elem);
+            break;
+        }
+        case TYPE_PTR:
+        case TYPE_PTR_MUT:
+        case TYPE_MULTIPTR:
+        case TYPE_MULTIPTR_MUT: {
+            mark_type(r, remove_any_pointer(r->ctx, type));
+            break;
+        }
+        case TYPE_FUNCTION: {
+            FunctionType function_type = get_function_type(r->ctx, type);
+            for (int32_t i = 0; i < function_type.param_count; i++) {
+                mark_type(r, function_type.params[i]);
+            }
+            mark_type(r, function_type.ret);
+            break;
+        }
+        case TYPE_STRUCT: {
+            StructType s = get_struct_type(r->ctx, type);
+            for (int32_t i = 0; i < s.field_count; i++) {
+                mark_type(r, get_struct_type_field(r->ctx, type, i));
+            }
+            break;
+        }
+        case TYPE_ENUM: {
+            mark_type(r, get_enum_type(r->ctx, type).repr);
+            break;
+        }
+        case TYPE_NEWTYPE: {
+            mark_type(r, get_newtype_type(r->ctx, type).type);
+            break;
+        }
+        case TYPE_TAGGED: {
+            TaggedType tagged = get_tagged_type(r->ctx, type);
+            mark_type(r, tagged.inner);
+            for (int32_t i = 0; i < tagged.arg_count; i++) {
+                mark_type(r, tagged.args[i]);
+            }
+            break;
+        }
+        case TYPE_LINEAR: {
+            mark_type(r, get_linear_elem_type(r->ctx, type));
+            break;
+        }
+    }
+}
+
+static void mark_value(Reachability *r, ValueId value) {
+    if (value.id >= r->ctx.global->values.values.len) {
+        return;
+    }
+
+    switch (get_value_tag(r->ctx, value)) {
+        case VAL_FUNCTION: {
+            int32_t function = r->function_indices[value.id];
+            if (function >= 0 && !r->enqueued[function]) {
+                r->enqueued[function] = true;
+                vec_push(&r->worklist, function);
+            }
+            break;
+        }
+        case VAL_EXTERN_FUNCTION:
+        case VAL_EXTERN_VAR: {
+            r->values[value.id] = true;
+            mark_type(r, get_value_type(r->ctx, value));
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+}
+
+static void mark_function_references(Reachability *r, Mir *mir, int32_t start, int32_t end) {
+    for (int32_t i = start; i < end; i++) {
+        MirId mir_id = {i};
+        mark_type(r, get_mir_type(mir, mir_id));
+
+        switch (get_mir_tag(mir, mir_id)) {
+            case MIR_TIR_VALUE: {
+                mark_value(r, get_mir_tir_value(mir, mir_id));
+                break;
+            }
+            case MIR_ITOF:
+            case MIR_ITRUNC:
+            case MIR_SEXT:
+            case MIR_ZEXT:
+            case MIR_FTOI:
+            case MIR_FTRUNC:
+            case MIR_FEXT:
+            case MIR_PTR_CAST: {
+                mark_type(r, (TypeId) {get_mir_access(mir, mir_id).index});
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+}
+
+static int compare_mir_functions(void const *a, void const *b) {
+    MirFunction const *left = a;
+    MirFunction const *right = b;
+
+    if (left->tir != right->tir) {
+        return left->tir - right->tir;
+    }
+
+    return left->clone - right->clone;
+}
+
+// Lowers function i to the end of the MIR, replacing the params that have a
+// known value by constants.
+static MirFunction lower_function(MirAnalysisInput *input, Mir *mir, int32_t i, ConstantArg *constant_args, Arena scratch) {
+    Context c = {0};
+    c.mir = *mir;
+    c.tir.ctx.global = input->global_deps;
+    c.tir.ctx.thread = &input->insts[i];
+    c.tir.insts = input->insts[i].insts;
+    c.scratch = scratch;
+    c.target = input->target;
+    c.bounds_check = input->bounds_check;
+    c.constant_args = constant_args;
+    c.variable_to_mir_map = arena_alloc(&c.scratch, MirId, input->insts[i].local_count);
+    c.hoisted = arena_alloc(&c.scratch, MirId, c.tir.insts.insts.len);
+    memset(c.hoisted, 0xff, c.tir.insts.insts.len * sizeof(MirId));
+    find_address_taken(&c);
+    int32_t start = c.mir.mir.len;
+    transform_function(&c, input->insts[i].first, input->functions[i]);
+    free(c.break_instructions.ptr);
+    free(c.continue_instructions.ptr);
+    free(c.index_bounds.ptr);
+    *mir = c.mir;
+    number_mir_values(mir, c.tir.ctx, start, mir->mir.len, c.scratch);
+    return (MirFunction) {i, start, mir->mir.len, false, false, false, 0};
+}
+
+// Interprocedural constant propagation. A param that every call passes the
+// same constant to is replaced by it, and a function that is mostly called
+// with one constant gets a copy specialized for it. The functions are lowered
+// again, leaving their previous MIR unused.
+
+// Every round that changes a function lowers it again by appending to the flat
+// MIR. The old copies are never reclaimed, so the MIR grows with the number of
+// rounds, and the side tables indexed by MirId in later passes, like the ones
+// in function folding and the call graph, are sized for all of it.
+#define PROPAGATION_ROUNDS 4
+#define MAX_CLONED_SIZE 256
+// Copies may add up to this percentage to the size of the program.
+#define CLONE_BUDGET 25
+
+typedef struct {
+    int32_t caller;
+    int32_t callee;
+    MirId call;
+} DirectCall;
+
+typedef struct {
+    MirAnalysisInput *input;
+    Mir *mir;
+    MirFunction *functions;
+    int32_t function_count;
+    // Indexed by global value id, the TIR function, or -1.
+    int32_t *function_indices;
+    // Indexed by TIR function, the position in `functions`, or -1.
+    int32_t *positions;
+    // Indexed by position.
+    bool *address_taken;
+    ConstantArg **constant_args;
+    Vec(DirectCall) calls;
+} Propagation;
+
+static TirContext get_function_ctx(Propagation *p, int32_t function) {
+    int32_t tir = p->functions[function].tir;
+    return (TirContext) {p->input->global_deps, &p->input->insts[tir]};
+}
+
+static int32_t get_param_count(Propagation *p, int32_t function) {
+    ValueId value = p->input->functions[p->functions[function].tir];
+    TirContext ctx = get_function_ctx(p, function);
+    return get_function_type(ctx, get_value_type(ctx, value)).param_count;
+}
+
+// Functions that are reachable from outside, or through a pointer, may be
+// called with any argument.
+static bool has_unknown_callers(Propagation *p, int32_t function) {
+    return p->address_taken[function] || p->input->functions[p->functions[function].tir].id == p->input->main.id;
+}
+
+static bool is_propagated_param(Propagation *p, int32_t function, int32_t param) {
+    ValueId value = p->input->functions[p->functions[function].tir];
+    TirContext ctx = get_function_ctx(p, function);
+    TypeId type = get_function_type_param(ctx, get_value_type(ctx, value), param);
+    return type_is_int(type) || type.id == TYPE_bool;
+}
+
+static void find_direct_calls(Propagation *p, Arena scratch) {
+    Mir *mir = p->mir;
+    bool *is_callee = arena_alloc(&scratch, bool, mir->mir.len);
+    int32_t value_count = p->input->global_deps->values.values.len;
+    p->calls.len = 0;
+    memset(p->address_taken, 0, p->function_count * sizeof(bool));
+
+    for (int32_t f = 0; f < p->function_count; f++) {
+        MirFunction function = p->functions[f];
+        TirContext ctx = get_function_ctx(p, f);
+
+        for (int32_t i = function.start; i < function.end; i++) {
+            MirId mir_id = {i};
+
+            if (get_mir_tag(mir, mir_id) != MIR_CALL) {
+                continue;
+            }
+
+            MirId operand = get_mir_access(mir, mir_id).operand;
+
+            if (get_mir_tag(mir, operand) != MIR_TIR_VALUE) {
+                continue;
+            }
+
+            ValueId value = get_mir_tir_value(mir, operand);
+
+            if (value.id < value_count && get_value_tag(ctx, value) == VAL_FUNCTION) {
+                int32_t callee = p->positions[p->function_indices[value.id]];
+                is_callee[operand.private_field_id] = true;
+                vec_push(&p->calls, (DirectCall) {f, callee, mir_id});
+            }
+        }
+
+        for (int32_t i = function.start; i < function.end; i++) {
+            MirId mir_id = {i};
+
+            if (get_mir_tag(mir, mir_id) != MIR_TIR_VALUE || is_callee[i]) {
+                continue;
+            }
+
+            ValueId value = get_mir_tir_value(mir, mir_id);
+
+            if (value.id < value_count && get_value_tag(ctx, value) == VAL_FUNCTION) {
+                p->address_taken[p->positions[p->function_indices[value.id]]] = true;
+            }
+        }
+    }
+}
+
+static MirId get_call_arg(Propagation *p, DirectCall *call, int32_t param) {
+    MirAccess access = get_mir_access(p->mir, call->call);
+    return (MirId) {get_mir_extra(p->mir, access.index + param)};
+}
+
+static bool get_constant_arg(Propagation *p, DirectCall *call, int32_t param, int64_t *value) {
+    MirId arg = get_call_arg(p, call, param);
+
+    if (get_mir_tag(p->mir, arg) == MIR_INT) {
+        *value = get_mir_int(p->mir, arg);
+        return true;
+    }
+
+    if (get_mir_tag(p->mir, arg) != MIR_TIR_VALUE) {
+        return false;
+    }
+
+    TirContext ctx = get_function_ctx(p, call->caller);
+    ValueId arg_value = get_mir_tir_value(p->mir, arg);
+
+    if (get_value_tag(ctx, arg_value) != VAL_CONST_INT) {
+        return false;
+    }
+
+    *value = get_value_int(ctx, arg_value);
+    return true;
+}
+
+// True if every call passes the same constant. A recursive call that passes
+// the param on unchanged does not count.
+static bool find_uniform_arg(Propagation *p, int32_t function, int32_t param, int64_t *value) {
+    int32_t call_count = 0;
+
+    for (int32_t i = 0; i < p->calls.len; i++) {
+        DirectCall *call = &p->calls.ptr[i];
+        int64_t arg;
+
+        if (call->callee != function) {
+            continue;
+        }
+
+        if (call->caller == function && get_call_arg(p, call, param).private_field_id == p->functions[function].start + param) {
+            continue;
+        }
+
+        if (!get_constant_arg(p, call, param, &arg) || (call_count && arg != *value)) {
+            return false;
+        }
+
+        *value = arg;
+        call_count++;
+    }
+
+    return call_count > 0;
+}
+
+static bool propagate_constants(Propagation *p, Arena scratch) {
+    bool changed = false;
+
+    for (int32_t f = 0; f < p->function_count; f++) {
+        if (has_unknown_callers(p, f)) {
+            continue;
+        }
+
+        bool function_changed = false;
+        int32_t param_count = get_param_count(p, f);
+
+        for (int32_t i = 0; i < param_count; i++) {
+            ConstantArg *arg = &p->constant_args[f][i];
+
+            if (!arg->known && is_propagated_param(p, f, i) && find_uniform_arg(p, f, i, &arg->value)) {
+                arg->known = true;
+                function_changed = true;
+            }
+        }
+
+        if (function_changed) {
+            p->functions[f] = lower_function(p->input, p->mir, p->functions[f].tir, p->constant_args[f], scratch);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+// The constant passed most often to a param by calls from other functions.
+static int32_t find_common_arg(Propagation *p, int32_t function, int32_t param, int64_t *value) {
+    int32_t best_count = 0;
+
+    for (int32_t i = 0; i < p->calls.len; i++) {
+        DirectCall *call = &p->calls.ptr[i];
+        int64_t arg;
+
+        if (call->callee != function || call->caller == function || !get_constant_arg(p, call, param, &arg)) {
+            continue;
+        }
+
+        int32_t count = 0;
+
+        for (int32_t j = i; j < p->calls.len; j++) {
+            DirectCall *other = &p->calls.ptr[j];
+            int64_t other_arg;
+
+            if (other->callee == function && other->caller != function && get_constant_arg(p, other, param, &other_arg)
+                && other_arg == arg) {
+                count++;
+            }
+        }
+
+        if (count > best_count) {
+            best_count = count;
+            *value = arg;
+        }
+    }
+
+    return best_count;
+}
+
+static void clone_functions(Propagation *p, Arena scratch) {
+    int32_t function_count = p->function_count;
+    int32_t total_size = 0;
+
+    for (int32_t f = 0; f < function_count; f++) {
+        total_size += p->functions[f].end - p->functions[f].start;
+    }
+
+    int32_t budget = total_size / 100 * CLONE_BUDGET;
+
+    for (int32_t f = 0; f < function_count; f++) {
+        int32_t size = p->functions[f].end - p->functions[f].start;
+
+        if (has_unknown_callers(p, f) || size > MAX_CLONED_SIZE || size > budget) {
+            continue;
+        }
+
+        int32_t call_count = 0;
+
+        for (int32_t i = 0; i < p->calls.len; i++) {
+            if (p->calls.ptr[i].callee == f && p->calls.ptr[i].caller != f) {
+                call_count++;
+            }
+        }
+
+        int32_t param_count = get_param_count(p, f);
+        int32_t best_param = -1;
+        int32_t best_count = 1;
+        int64_t best_value = 0;
+
+        for (int32_t i = 0; i < param_count; i++) {
+            int64_t value;
+
+            if (p->constant_args[f][i].known || !is_propagated_param(p, f, i)) {
+                continue;
+            }
+
+            int32_t count = find_common_arg(p, f, i, &value);
+
+            if (count > best_count && count * 2 >= call_count) {
+                best_param = i;
+                best_count = count;
+                best_value = value;
+            }
+        }
+
+        if (best_param < 0) {
+            continue;
+        }
+
+        ConstantArg *constant_args = arena_alloc(&scratch, ConstantArg, param_count);
+        memcpy(constant_args, p->constant_args[f], param_count * sizeof(ConstantArg));
+        constant_args[best_param] = (ConstantArg) {true, best_value};
+
+        MirFunction clone = lower_function(p->input, p->mir, p->functions[f].tir, constant_args, scratch);
+        clone.clone = 1;
+        p->functions[p->function_count++] = clone;
+        budget -= clone.end - clone.start;
+
+        for (int32_t i = 0; i < p->calls.len; i++) {
+            DirectCall *call = &p->calls.ptr[i];
+            int64_t arg;
+
+            if (call->callee == f && call->caller != f && get_constant_arg(p, call, best_param, &arg) && arg == best_value) {
+                MirId operand = get_mir_access(p->mir, call->call).operand;
+                p->mir->mir.tags[operand.private_field_id] = MIR_CLONE;
+                p->mir->mir.datas[operand.private_field_id].raw.right = clone.clone;
+            }
+        }
+    }
+}
+
+static int32_t propagate_interprocedural_constants(Propagation *p, Arena scratch) {
+    for (int32_t i = 0; i < p->input->function_count; i++) {
+        p->positions[i] = -1;
+    }
+
+    for (int32_t f = 0; f < p->function_count; f++) {
+        p->positions[p->functions[f].tir] = f;
+        p->constant_args[f] = arena_alloc(&scratch, ConstantArg, get_param_count(p, f));
+    }
+
+    for (int32_t round = 0; round < PROPAGATION_ROUNDS; round++) {
+        find_direct_calls(p, scratch);
+
+        if (!propagate_constants(p, scratch)) {
+            break;
+        }
+    }
+
+    find_direct_calls(p, scratch);
+    clone_functions(p, scratch);
+    free(p->calls.ptr);
+    return p->function_count;
+}
+
 MirResult tir_to_mir(MirAnalysisInput *input, Arena *permanent, Arena scratch) {
     Mir mir = {0};
-    int32_t *ends = arena_alloc(permanent, int32_t, input->function_count + 1);
+    int32_t value_count = input->global_deps->values.values.len;
+    int32_t type_count = TYPE_COUNT + input->global_deps->types.types.len;
+
+    Reachability r = {0};
+    r.ctx.global = input->global_deps;
+    r.values = arena_alloc(permanent, bool, value_count);
+    r.types = arena_alloc(permanent, bool, type_count);
+    r.function_indices = arena_alloc(&scratch, int32_t, value_count);
+    r.enqueued = arena_alloc(&scratch, bool, input->function_count);
+
+    for (int32_t i = 0; i < value_count; i++) {
+        r.function_indices[i] = -1;
+    }
 
     for (int32_t i = 0; i < input->function_count; i++) {
-        Context c = {0};
-        c.mir = mir;
-        c.tir.ctx.global = input->global_deps;
-        c.tir.ctx.thread = &input->insts[i];
-        c.tir.insts = input->insts[i].insts;
-        c.scratch = scratch;
-        c.variable_to_mir_map = arena_alloc(&c.scratch, MirId, input->insts[i].local_count);
-        ends[i] = c.mir.mir.len;
-        transform_function(&c, input->insts[i].first, input->functions[i]);
-        free(c.break_instructions.ptr);
-        free(c.continue_instructions.ptr);
-        mir = c.mir;
-        ends[i + 1] = c.mir.mir.len;
+        r.function_indices[input->functions[i].id] = i;
+    }
+
+    if (input->shard_count) {
+        // A shard cannot see what the functions of other shards reference, so
+        // every function that was type checked is kept.
+        for (int32_t i = 0; i < input->function_count; i++) {
+            if (input->insts[i].first.id) {
+                mark_value(&r, input->functions[i]);
+            }
+        }
+    } else if (input->main.id) {
+        mark_value(&r, input->main);
+    } else {
+        for (int32_t i = 0; i < input->function_count; i++) {
+            mark_value(&r, input->functions[i]);
+        }
+    }
+
+    // Every function may get one specialized copy.
+    MirFunction *functions = arena_alloc(permanent, MirFunction, input->function_count * 2);
+    int32_t function_count = 0;
+
+    for (int32_t next = 0; next < r.worklist.len; next++) {
+        int32_t i = r.worklist.ptr[next];
+        int32_t start = mir.mir.len;
+
+        if (input->shard_count && i % input->shard_count != input->shard) {
+            functions[function_count++] = (MirFunction) {i, start, start, false, false, true, 0};
+            continue;
+        }
+
+        functions[function_count++] = lower_function(input, &mir, i, NULL, scratch);
+
+        Arena function_scratch = scratch;
+        r.ctx.thread = &input->insts[i];
+        r.thread_types = arena_alloc(&function_scratch, bool, input->insts[i].deps.types.types.len);
+        mark_type(&r, get_value_type(r.ctx, input->functions[i]));
+        mark_function_references(&r, &mir, start, mir.mir.len);
+    }
+
+    free(r.worklist.ptr);
+
+    // With no main, every function can be called from outside. Shards only
+    // have the MIR of their own functions, so they cannot specialize or fold
+    // functions across shards.
+    if (input->main.id && !input->shard_count) {
+        Propagation p = {
+            .input = input,
+            .mir = &mir,
+            .functions = functions,
+            .function_count = function_count,
+            .function_indices = r.function_indices,
+            .positions = arena_alloc(&scratch, int32_t, input->function_count),
+            .address_taken = arena_alloc(&scratch, bool, input->function_count),
+            .constant_args = arena_alloc(&scratch, ConstantArg *, input->function_count),
+        };
+        function_count = propagate_interprocedural_constants(&p, scratch);
+    }
+
+    qsort(functions, function_count, sizeof(MirFunction), compare_mir_functions);
+    if (!input->shard_count) {
+        function_count = fold_identical_functions(input, &mir, functions, function_count, scratch);
     }
 
     return (MirResult) {
         .mir = mir,
-        .ends = ends,
+        .functions = functions,
+        .function_count = function_count,
+        .reachable_values = r.values,
+        .reachable_types = r.types,
     };
 }
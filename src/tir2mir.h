@@ -6,19 +6,42 @@
 #include "data/tir.h"
 
 typedef struct {
-    char **paths;
-    String *sources;
-    Ast *asts;
-    AstRef *ast_refs;
     ValueId *functions;
+    ValueId main;
     TirDependencies *global_deps;
     LocalTir *insts;
     int32_t function_count;
+    Target target;
+    bool bounds_check;
+    // With a shard count, only the functions whose index is `shard` modulo the
+    // count are lowered.
+    int32_t shard;
+    int32_t shard_count;
 } MirAnalysisInput;
 
+typedef struct {
+    // Index into the TIR function list, i.e. `Declarations.functions` and `insts`.
+    int32_t tir;
+    int32_t start;
+    int32_t end;
+    bool is_cold;
+    // Whether the function is used other than by direct calls.
+    bool is_address_taken;
+    // Lowered and emitted by another shard, so only declared.
+    bool in_other_shard;
+    // 0 for the function itself, otherwise the number of a copy specialized
+    // for constant arguments.
+    int32_t clone;
+} MirFunction;
+
 typedef struct {
     Mir mir;
-    int32_t *ends;
+    // Only the functions reachable from `main`, in the order they are emitted.
+    MirFunction *functions;
+    int32_t function_count;
+    // Indexed by global value and type id, true if referenced by a reachable function.
+    bool *reachable_values;
+    bool *reachable_types;
 } MirResult;
 
 MirResult tir_to_mir(MirAnalysisInput *input, Arena *permanent, Arena scratch);
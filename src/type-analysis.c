@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "type-analysis.h"
 
 #include "adt.h"
@@ -18,6 +20,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 typedef struct {
     AstId ast_id;
@@ -38,6 +41,8 @@ typedef struct {
     bool *notes_shown;  // Weather a note to fix an error has been shown already.
 } LocalData;
 
+typedef Vec(ValueId) ValueVec;
+
 typedef struct {
     Options *options;
     char **paths;
@@ -62,6 +67,8 @@ typedef struct {
     TirContext tir;
     TypeId current_function_type;
     int32_t loop_depth;
+    // Functions referenced by the body being analyzed, only collected in lazy mode.
+    ValueVec *referenced_functions;
 } TypeContext;
 
 static int32_t push_extra(TypeContext *c, int32_t *values, int32_t count) {
@@ -748,6 +755,9 @@ static ValueId analyze_value_id(TypeContext *c, AstId node, SymbolKind kind) {
         case SYM_LOCAL: info = c->local->tir_refs[id]; break;
         default: return null_value;
     }
+    if (c->referenced_functions && info.value.id && get_value_tag(c->tir, info.value) == VAL_FUNCTION) {
+        vec_push(c->referenced_functions, info.value);
+    }
     return info.value;
 }
 
@@ -2169,6 +2179,143 @@ static void analyze_def(TypeContext *c, DefId def) {
     c->tir_refs[def.id] = ref;
 }
 
+// Diagnostics are buffered per function and printed in the order of `pending`,
+// so that they do not depend on how the functions were scheduled.
+static int analyze_bodies(TypeContext *global_tc, TirInput *input, LocalData *local_data, LocalTir *tirs, int32_t *pending, int32_t count, ValueVec *referenced) {
+    int err = 0;
+    char **diagnostics = calloc(count, sizeof(char *));
+    size_t *diagnostic_sizes = calloc(count, sizeof(size_t));
+
+    #pragma omp parallel
+    {
+        Arena thread_base_scratch = new_arena(64 << 20);
+        Arena thread_scratch = thread_base_scratch;
+        TypeContext local_tc = {0};
+        local_tc.options = global_tc->options;
+        local_tc.paths = global_tc->paths;
+        local_tc.sources = global_tc->sources;
+        local_tc.asts = global_tc->asts;
+        local_tc.permanent = global_tc->permanent;
+        local_tc.scratch = &thread_scratch;
+        local_tc.ast_refs = global_tc->ast_refs;
+        local_tc.tir_refs = global_tc->tir_refs;
+        local_tc.global = global_tc->global;
+        local_tc.tir.global = global_tc->tir.global;
+
+        #pragma omp for reduction (||:err)
+        for (int32_t j = 0; j < count; j++) {
+            int32_t i = pending[j];
+            DefId def = input->functions[i];
+            ValueId value = global_tc->tir_refs[def.id].value;
+            AstRef ref = input->ast_refs[def.id];
+
+            local_tc.local = &local_data[def.id];
+
+            local_tc.file = ref.file;
+            local_tc.local_ast_refs = &input->local_ast_refs[ref.file],
+            local_tc.ast = &input->asts[ref.file];
+            local_tc.rir = &input->rirs[ref.file];
+            local_tc.tir.thread = &tirs[i];
+            local_tc.referenced_functions = referenced ? &referenced[j] : NULL;
+
+            FILE *stream = open_memstream(&diagnostics[j], &diagnostic_sizes[j]);
+            redirect_diagnostics(stream);
+
+            // Add null tir
+            new_inst_impl(&local_tc, TIR_NOP, null_ast, 0, 0);
+
+            tirs[i].first = analyze_function(&local_tc, ref.node, value);
+
+            redirect_diagnostics(NULL);
+            if (stream) {
+                fclose(stream);
+            }
+
+            if (local_tc.error) {
+                err = 1;
+            }
+        }
+
+        delete_arena(&thread_base_scratch);
+    }
+
+    for (int32_t j = 0; j < count; j++) {
+        if (diagnostics[j]) {
+            fwrite(diagnostics[j], 1, diagnostic_sizes[j], stderr);
+            free(diagnostics[j]);
+        }
+    }
+    free(diagnostics);
+    free(diagnostic_sizes);
+
+    return err;
+}
+
+// Only analyzes the bodies of functions reachable from main, in waves: every
+// wave is analyzed in parallel and the functions it references form the next.
+// Bodies that are never reached are left empty and are not checked at all.
+static int analyze_reachable_bodies(TypeContext *global_tc, TirInput *input, LocalData *local_data, LocalTir *tirs, Arena scratch) {
+    int32_t value_count = global_tc->tir.global->values.values.len;
+    int32_t *function_indices = arena_alloc(&scratch, int32_t, value_count);
+    bool *enqueued = arena_alloc(&scratch, bool, input->function_count);
+    int32_t *pending = arena_alloc(&scratch, int32_t, input->function_count);
+    int32_t *next = arena_alloc(&scratch, int32_t, input->function_count);
+    ValueVec *referenced = arena_alloc(&scratch, ValueVec, input->function_count);
+    int32_t count = 0;
+
+    for (int32_t i = 0; i < value_count; i++) {
+        function_indices[i] = -1;
+    }
+
+    for (int32_t i = 0; i < input->function_count; i++) {
+        ValueId value = global_tc->tir_refs[input->functions[i].id].value;
+        if (value.id) {
+            function_indices[value.id] = i;
+        }
+    }
+
+    ValueId main = global_tc->global->declarations.main;
+
+    if (main.id) {
+        pending[count++] = function_indices[main.id];
+        enqueued[function_indices[main.id]] = true;
+    } else {
+        for (int32_t i = 0; i < input->function_count; i++) {
+            pending[count++] = i;
+            enqueued[i] = true;
+        }
+    }
+
+    int err = 0;
+
+    while (count) {
+        if (analyze_bodies(global_tc, input, local_data, tirs, pending, count, referenced)) {
+            err = 1;
+        }
+
+        int32_t next_count = 0;
+
+        for (int32_t j = 0; j < count; j++) {
+            for (int32_t k = 0; k < referenced[j].len; k++) {
+                int32_t function = function_indices[referenced[j].ptr[k].id];
+                if (function >= 0 && !enqueued[function]) {
+                    enqueued[function] = true;
+                    next[next_count++] = function;
+                }
+            }
+            free(referenced[j].ptr);
+            referenced[j] = (ValueVec) {0};
+        }
+
+        int32_t *tmp = pending;
+        pending = next;
+        next = tmp;
+        count = next_count;
+    }
+
+    return err;
+}
+
 TirOutput analyze_types(TirInput *input, Arena *permanent, Arena scratch) {
     GlobalData global = {0};
     TirDependencies global_tir = {0};
@@ -2181,10 +2328,12 @@ TirOutput analyze_types(TirInput *input, Arena *permanent, Arena scratch) {
     global_tc.permanent = permanent;
     global_tc.scratch = &scratch;
     global_tc.ast_refs = input->ast_refs;
-    global_tc.tir_refs = arena_alloc(&scratch, TirRef, input->def_count);
+    global_tc.tir_refs = arena_alloc(permanent, TirRef, input->def_count);
     global_tc.global = &global;
     global_tc.tir.global = &global_tir;
     LocalData *local_data = arena_alloc(&scratch, LocalData, input->def_count);
+    // The language server looks up the types of locals after analysis.
+    Arena *local_refs_arena = input->options->language_server ? permanent : &scratch;
 
     for (int32_t i = 0; i < input->order_count; i++) {
         DefId def = input->order[i];
@@ -2193,7 +2342,7 @@ TirOutput analyze_types(TirInput *input, Arena *permanent, Arena scratch) {
         global_tc.ast = &input->asts[global_tc.file];
         global_tc.rir = &input->rirs[global_tc.file];
 
-        local_data[def.id].tir_refs = arena_alloc(&scratch, TirRef, input->local_ast_refs[global_tc.file].len);
+        local_data[def.id].tir_refs = arena_alloc(local_refs_arena, TirRef, input->local_ast_refs[global_tc.file].len);
         local_data[def.id].notes_shown = arena_alloc(&scratch, bool, input->local_ast_refs[global_tc.file].len);
         global_tc.local = &local_data[def.id];
         analyze_def(&global_tc, def);
@@ -2202,53 +2351,40 @@ TirOutput analyze_types(TirInput *input, Arena *permanent, Arena scratch) {
     LocalTir *tirs = arena_alloc(permanent, LocalTir, input->function_count);
     int err = global_tc.error;
 
-    #pragma omp parallel
-    {
-        Arena thread_base_scratch = new_arena(64 << 20);
-        Arena thread_scratch = thread_base_scratch;
-        TypeContext local_tc = {0};
-        local_tc.options = global_tc.options;
-        local_tc.paths = global_tc.paths;
-        local_tc.sources = global_tc.sources;
-        local_tc.asts = global_tc.asts;
-        local_tc.permanent = permanent;
-        local_tc.scratch = &thread_scratch;
-        local_tc.ast_refs = global_tc.ast_refs;
-        local_tc.tir_refs = global_tc.tir_refs;
-        local_tc.global = &global;
-        local_tc.tir.global = &global_tir;
-
-        #pragma omp for reduction (||:err)
+    if (input->options->lazy) {
+        if (analyze_reachable_bodies(&global_tc, input, local_data, tirs, scratch)) {
+            err = 1;
+        }
+    } else {
+        int32_t *pending = arena_alloc(&scratch, int32_t, input->function_count);
         for (int32_t i = 0; i < input->function_count; i++) {
-            DefId def = input->functions[i];
-            ValueId value = global_tc.tir_refs[def.id].value;
-            AstRef ref = input->ast_refs[def.id];
-
-            local_tc.local = &local_data[def.id];
-
-            local_tc.file = ref.file;
-            local_tc.local_ast_refs = &input->local_ast_refs[ref.file],
-            local_tc.ast = &input->asts[ref.file];
-            local_tc.rir = &input->rirs[ref.file];
-            local_tc.tir.thread = &tirs[i];
-
-            // Add null tir
-            new_inst_impl(&local_tc, TIR_NOP, null_ast, 0, 0);
+            pending[i] = i;
+        }
+        if (analyze_bodies(&global_tc, input, local_data, tirs, pending, input->function_count, NULL)) {
+            err = 1;
+        }
+    }
 
-            tirs[i].first = analyze_function(&local_tc, ref.node, value);
+    for (int32_t i = 0; i < global.type_scopes.len; i++) {
+        htable_free(&global.type_scopes.ptr[i]);
+    }
+    free(global.type_scopes.ptr);
+    free(global.type_scope_symbols.ptr);
 
-            if (local_tc.error) {
-                err = 1;
-            }
+    TirRef **local_refs = NULL;
+    if (input->options->language_server) {
+        local_refs = arena_alloc(permanent, TirRef *, input->def_count);
+        for (int32_t i = 0; i < input->def_count; i++) {
+            local_refs[i] = local_data[i].tir_refs;
         }
-
-        delete_arena(&thread_base_scratch);
     }
 
     return (TirOutput) {
         .declarations = global.declarations,
         .global_deps = global_tir,
         .insts = tirs,
+        .def_refs = global_tc.tir_refs,
+        .local_refs = local_refs,
         .error = err,
     };
 }
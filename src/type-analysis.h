@@ -42,6 +42,10 @@ typedef struct {
     Declarations declarations;
     TirDependencies global_deps;
     LocalTir *insts;
+    // What each definition resolved to, and for the language server what
+    // each local of a definition's file resolved to within it.
+    TirRef *def_refs;
+    TirRef **local_refs;
     int error;
 } TirOutput;
 
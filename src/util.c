@@ -56,6 +56,35 @@ ptrdiff_t push_str(StringBuffer *buffer, String s) {
     return index;
 }
 
+String read_file(char const *path) {
+    FILE *file = fopen(path, "r");
+    String buffer = {0};
+
+    if (!file) {
+        return buffer;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (length >= 0) {
+        char *data = malloc(length);
+
+        if (data) {
+            if (fread(data, 1, (size_t) length, file) == (size_t) length) {
+                buffer.ptr = data;
+                buffer.len = length;
+            } else {
+                free(data);
+            }
+        }
+    }
+
+    fclose(file);
+    return buffer;
+}
+
 #undef vec_grow
 
 void *vec_grow(void *vec, int32_t count, size_t size) {
@@ -0,0 +1,494 @@
+#include "value-numbering.h"
+
+#include "arena.h"
+#include "data/mir.h"
+#include "data/tir.h"
+#include "fwd.h"
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    MirTag tag;
+    TypeId type;
+    int32_t operands[3];
+} ValueKey;
+
+typedef struct {
+    ValueKey key;
+    MirId value;
+    int32_t next;
+} ValueEntry;
+
+typedef struct {
+    Mir *mir;
+    TirContext ctx;
+    int32_t start;
+    // Indexed by `id - start`, the instruction whose value is used instead.
+    int32_t *replacements;
+    int32_t *block_starts;
+    int32_t *first_child;
+    int32_t *next_sibling;
+    int32_t *buckets;
+    uint32_t bucket_mask;
+    ValueEntry *entries;
+    int32_t entry_count;
+} Numbering;
+
+static MirId resolve(Numbering *n, MirId mir_id) {
+    return (MirId) {n->replacements[mir_id.private_field_id - n->start]};
+}
+
+static void replace_extra(Numbering *n, int32_t index) {
+    int32_t *operand = &n->mir->extra.ptr[index];
+
+    if (*operand >= 0) {
+        *operand = resolve(n, (MirId) {*operand}).private_field_id;
+    }
+}
+
+static void replace_operands(Numbering *n, MirId mir_id) {
+    MirData *data = &n->mir->mir.datas[mir_id.private_field_id];
+
+    switch (get_mir_tag(n->mir, mir_id)) {
+        case MIR_ASSIGN:
+        case MIR_ADD:
+        case MIR_SUB:
+        case MIR_MUL:
+        case MIR_MULHI:
+        case MIR_DIV:
+        case MIR_MOD:
+        case MIR_AND:
+        case MIR_OR:
+        case MIR_XOR:
+        case MIR_SHL:
+        case MIR_SHR:
+        case MIR_EQ:
+        case MIR_NE:
+        case MIR_LT:
+        case MIR_GT:
+        case MIR_LE:
+        case MIR_GE:
+        case MIR_NEW_SLICE:
+        case MIR_INDEX:
+        case MIR_SLICE_INDEX:
+        case MIR_BOUNDS_CHECK: {
+            data->binary.left = resolve(n, data->binary.left);
+            data->binary.right = resolve(n, data->binary.right);
+            break;
+        }
+        case MIR_ADDRESS:
+        case MIR_DEREF:
+        case MIR_LOAD:
+        case MIR_MINUS:
+        case MIR_NOT:
+        case MIR_RET: {
+            data->unary = resolve(n, data->unary);
+            break;
+        }
+        case MIR_ITOF:
+        case MIR_ITRUNC:
+        case MIR_SEXT:
+        case MIR_ZEXT:
+        case MIR_FTOI:
+        case MIR_FTRUNC:
+        case MIR_FEXT:
+        case MIR_PTR_CAST:
+        case MIR_CONST_INDEX:
+        case MIR_ACCESS:
+        case MIR_BR_IF:
+        case MIR_BR_IF_NOT: {
+            data->mir_const.operand = resolve(n, data->mir_const.operand);
+            break;
+        }
+        case MIR_SELECT: {
+            data->mir_const.operand = resolve(n, data->mir_const.operand);
+            replace_extra(n, data->mir_const.index);
+            replace_extra(n, data->mir_const.index + 1);
+            break;
+        }
+        case MIR_CALL: {
+            int32_t arg_count = get_function_type(n->ctx, data->type).param_count;
+            data->mir_const.operand = resolve(n, data->mir_const.operand);
+
+            // The arguments are followed by the destination.
+            for (int32_t i = 0; i <= arg_count; i++) {
+                replace_extra(n, data->mir_const.index + i);
+            }
+            break;
+        }
+        case MIR_NOP:
+        case MIR_PARAM:
+        case MIR_ALLOC:
+        case MIR_RET_SLOT:
+        case MIR_INT:
+        case MIR_FLOAT:
+        case MIR_STRING:
+        case MIR_NULL:
+        case MIR_TIR_VALUE:
+        case MIR_CONSTANT:
+        case MIR_CLONE:
+        case MIR_BR:
+        case MIR_RET_VOID: {
+            break;
+        }
+    }
+}
+
+// Whether an operand is a value that does not change once it was computed, as
+// opposed to a place that is read when it is used.
+static bool is_value(Numbering *n, MirId mir_id) {
+    switch (get_mir_tag(n->mir, mir_id)) {
+        case MIR_TIR_VALUE: {
+            return get_value_tag(n->ctx, get_mir_tir_value(n->mir, mir_id)) != VAL_EXTERN_VAR;
+        }
+        case MIR_PARAM: {
+            return !is_aggregate_type(n->ctx, get_mir_type(n->mir, mir_id));
+        }
+        case MIR_CALL: {
+            TypeId ret = get_function_type(n->ctx, get_mir_type(n->mir, mir_id)).ret;
+            return ret.id != TYPE_VOID && !is_aggregate_type(n->ctx, ret);
+        }
+        case MIR_INT:
+        case MIR_FLOAT:
+        case MIR_STRING:
+        case MIR_NULL:
+        case MIR_CLONE:
+        case MIR_ADDRESS:
+        case MIR_LOAD:
+        case MIR_MINUS:
+        case MIR_ADD:
+        case MIR_SUB:
+        case MIR_MUL:
+        case MIR_MULHI:
+        case MIR_DIV:
+        case MIR_MOD:
+        case MIR_NOT:
+        case MIR_AND:
+        case MIR_OR:
+        case MIR_XOR:
+        case MIR_SHL:
+        case MIR_SHR:
+        case MIR_EQ:
+        case MIR_NE:
+        case MIR_LT:
+        case MIR_GT:
+        case MIR_LE:
+        case MIR_GE:
+        case MIR_SELECT:
+        case MIR_ITOF:
+        case MIR_ITRUNC:
+        case MIR_SEXT:
+        case MIR_ZEXT:
+        case MIR_FTOI:
+        case MIR_FTRUNC:
+        case MIR_FEXT:
+        case MIR_PTR_CAST: {
+            return true;
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+static bool is_array_type(Numbering *n, TypeId type) {
+    return get_type_tag(n->ctx, remove_tags(n->ctx, type)) == TYPE_ARRAY;
+}
+
+// Whether a place always refers to the same storage.
+static bool is_fixed_place(Numbering *n, MirId mir_id) {
+    switch (get_mir_tag(n->mir, mir_id)) {
+        case MIR_ALLOC:
+        case MIR_RET_SLOT:
+        case MIR_CONSTANT: {
+            return true;
+        }
+        case MIR_PARAM: {
+            return is_aggregate_type(n->ctx, get_mir_type(n->mir, mir_id));
+        }
+        case MIR_ACCESS:
+        case MIR_CONST_INDEX: {
+            return is_fixed_place(n, get_mir_access(n->mir, mir_id).operand);
+        }
+        case MIR_INDEX: {
+            MirBinary binary = get_mir_binary(n->mir, mir_id);
+            return is_array_type(n, get_mir_type(n->mir, mir_id)) && is_fixed_place(n, binary.left)
+                && is_value(n, binary.right);
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+static bool is_param_length(Numbering *n, MirId mir_id) {
+    if (get_mir_tag(n->mir, mir_id) != MIR_ACCESS) {
+        return false;
+    }
+
+    MirId operand = get_mir_access(n->mir, mir_id).operand;
+    return get_mir_tag(n->mir, operand) == MIR_PARAM && is_aggregate_type(n->ctx, get_mir_type(n->mir, operand));
+}
+
+static bool is_commutative(MirTag tag) {
+    switch (tag) {
+        case MIR_ADD:
+        case MIR_MUL:
+        case MIR_MULHI:
+        case MIR_AND:
+        case MIR_OR:
+        case MIR_XOR:
+        case MIR_EQ:
+        case MIR_NE: return true;
+
+        default: return false;
+    }
+}
+
+static bool get_value_key(Numbering *n, MirId mir_id, ValueKey *key) {
+    MirTag tag = get_mir_tag(n->mir, mir_id);
+    *key = (ValueKey) {tag, get_mir_type(n->mir, mir_id), {0}};
+
+    switch (tag) {
+        case MIR_ADD:
+        case MIR_SUB:
+        case MIR_MUL:
+        case MIR_MULHI:
+        case MIR_DIV:
+        case MIR_MOD:
+        case MIR_AND:
+        case MIR_OR:
+        case MIR_XOR:
+        case MIR_SHL:
+        case MIR_SHR:
+        case MIR_EQ:
+        case MIR_NE:
+        case MIR_LT:
+        case MIR_GT:
+        case MIR_LE:
+        case MIR_GE: {
+            MirBinary binary = get_mir_binary(n->mir, mir_id);
+
+            if (!is_value(n, binary.left) || !is_value(n, binary.right)) {
+                return false;
+            }
+
+            key->operands[0] = binary.left.private_field_id;
+            key->operands[1] = binary.right.private_field_id;
+
+            if (is_commutative(tag) && key->operands[0] > key->operands[1]) {
+                key->operands[0] = binary.right.private_field_id;
+                key->operands[1] = binary.left.private_field_id;
+            }
+            return true;
+        }
+        case MIR_MINUS:
+        case MIR_NOT: {
+            MirId operand = get_mir_unary(n->mir, mir_id);
+            key->operands[0] = operand.private_field_id;
+            return is_value(n, operand);
+        }
+        case MIR_ADDRESS: {
+            MirId operand = get_mir_unary(n->mir, mir_id);
+            key->operands[0] = operand.private_field_id;
+            return is_fixed_place(n, operand);
+        }
+        case MIR_ITOF:
+        case MIR_ITRUNC:
+        case MIR_SEXT:
+        case MIR_ZEXT:
+        case MIR_FTOI:
+        case MIR_FTRUNC:
+        case MIR_FEXT:
+        case MIR_PTR_CAST: {
+            MirAccess cast = get_mir_access(n->mir, mir_id);
+            key->operands[0] = cast.operand.private_field_id;
+            key->operands[1] = cast.index;
+            return is_value(n, cast.operand);
+        }
+        case MIR_ACCESS:
+        case MIR_CONST_INDEX: {
+            MirAccess access = get_mir_access(n->mir, mir_id);
+            key->operands[0] = access.operand.private_field_id;
+            key->operands[1] = access.index;
+            return is_fixed_place(n, access.operand);
+        }
+        case MIR_INDEX: {
+            MirBinary binary = get_mir_binary(n->mir, mir_id);
+            key->operands[0] = binary.left.private_field_id;
+            key->operands[1] = binary.right.private_field_id;
+
+            if (is_array_type(n, key->type)) {
+                return is_fixed_place(n, binary.left) && is_value(n, binary.right);
+            }
+
+            return is_value(n, binary.left) && is_value(n, binary.right);
+        }
+        case MIR_BOUNDS_CHECK: {
+            // A check is redundant after one of the same index and length. The
+            // length of a slice param cannot change.
+            MirBinary binary = get_mir_binary(n->mir, mir_id);
+            key->operands[0] = binary.left.private_field_id;
+            key->operands[1] = binary.right.private_field_id;
+            return is_value(n, binary.left) && (is_value(n, binary.right) || is_param_length(n, binary.right));
+        }
+        case MIR_SELECT: {
+            MirAccess select = get_mir_access(n->mir, mir_id);
+            key->operands[0] = select.operand.private_field_id;
+            key->operands[1] = get_mir_extra(n->mir, select.index);
+            key->operands[2] = get_mir_extra(n->mir, select.index + 1);
+            return is_value(n, select.operand) && is_value(n, (MirId) {key->operands[1]})
+                && is_value(n, (MirId) {key->operands[2]});
+        }
+        case MIR_INT: {
+            // Constants generate no code, so equal ones can be merged regardless
+            // of where they are.
+            key->operands[0] = n->mir->mir.datas[mir_id.private_field_id].raw.left;
+            key->operands[1] = n->mir->mir.datas[mir_id.private_field_id].raw.right;
+            return true;
+        }
+        case MIR_TIR_VALUE: {
+            ValueId value = get_mir_tir_value(n->mir, mir_id);
+
+            if (get_value_tag(n->ctx, value) != VAL_CONST_INT) {
+                return false;
+            }
+
+            int64_t i = get_value_int(n->ctx, value);
+            key->operands[0] = (int32_t) (uint32_t) i;
+            key->operands[1] = (int32_t) (uint32_t) ((uint64_t) i >> 32);
+            return true;
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+static uint32_t hash_key(ValueKey const *key) {
+    uint32_t hash = 2166136261u;
+    int32_t words[] = {key->tag, key->type.id, key->operands[0], key->operands[1], key->operands[2]};
+
+    for (int32_t i = 0; i < 5; i++) {
+        hash = (hash ^ (uint32_t) words[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static bool keys_equal(ValueKey const *a, ValueKey const *b) {
+    return a->tag == b->tag && a->type.id == b->type.id && a->operands[0] == b->operands[0]
+        && a->operands[1] == b->operands[1] && a->operands[2] == b->operands[2];
+}
+
+// Returns the earlier instruction with the same value, or adds this one.
+static MirId find_or_add_value(Numbering *n, ValueKey const *key, MirId mir_id) {
+    int32_t *bucket = &n->buckets[hash_key(key) & n->bucket_mask];
+
+    for (int32_t i = *bucket; i >= 0; i = n->entries[i].next) {
+        if (keys_equal(&n->entries[i].key, key)) {
+            return n->entries[i].value;
+        }
+    }
+
+    n->entries[n->entry_count] = (ValueEntry) {*key, mir_id, *bucket};
+    *bucket = n->entry_count++;
+    return mir_id;
+}
+
+// Values of a block are visible in the blocks it dominates, which are visited
+// before they are removed again.
+static void number_block(Numbering *n, int32_t block) {
+    int32_t entry_count = n->entry_count;
+
+    for (int32_t i = n->block_starts[block]; i < n->block_starts[block + 1]; i++) {
+        MirId mir_id = {i};
+        ValueKey key;
+        replace_operands(n, mir_id);
+
+        if (get_mir_tag(n->mir, mir_id) == MIR_INT || get_mir_tag(n->mir, mir_id) == MIR_TIR_VALUE
+            || !get_value_key(n, mir_id, &key)) {
+            continue;
+        }
+
+        MirId value = find_or_add_value(n, &key, mir_id);
+
+        if (value.private_field_id != i) {
+            n->replacements[i - n->start] = value.private_field_id;
+            n->mir->mir.tags[i] = MIR_NOP;
+        }
+    }
+
+    for (int32_t child = n->first_child[block]; child >= 0; child = n->next_sibling[child]) {
+        number_block(n, child);
+    }
+
+    while (n->entry_count > entry_count) {
+        ValueEntry *entry = &n->entries[--n->entry_count];
+        n->buckets[hash_key(&entry->key) & n->bucket_mask] = entry->next;
+    }
+}
+
+void number_mir_values(Mir *mir, TirContext ctx, int32_t start, int32_t end, Arena scratch) {
+    if (start == end) {
+        return;
+    }
+
+    int32_t block_count;
+    int32_t *dominators = get_mir_dominators(mir, start, end, &scratch);
+    uint32_t bucket_count = 16;
+
+    while (bucket_count < (uint32_t) (end - start) * 2) {
+        bucket_count *= 2;
+    }
+
+    Numbering n = {
+        .mir = mir,
+        .ctx = ctx,
+        .start = start,
+        .replacements = arena_alloc(&scratch, int32_t, end - start),
+        .block_starts = get_mir_block_starts(mir, start, end, &block_count, &scratch),
+        .buckets = arena_alloc(&scratch, int32_t, bucket_count),
+        .bucket_mask = bucket_count - 1,
+        .entries = arena_alloc(&scratch, ValueEntry, end - start),
+    };
+
+    n.first_child = arena_alloc(&scratch, int32_t, block_count);
+    n.next_sibling = arena_alloc(&scratch, int32_t, block_count);
+    memset(n.buckets, 0xff, bucket_count * sizeof(int32_t));
+
+    for (int32_t i = start; i < end; i++) {
+        n.replacements[i - start] = i;
+    }
+
+    for (int32_t block = 0; block < block_count; block++) {
+        n.first_child[block] = -1;
+        n.next_sibling[block] = -1;
+    }
+
+    for (int32_t block = block_count - 1; block > 0; block--) {
+        if (dominators[block] >= 0) {
+            n.next_sibling[block] = n.first_child[dominators[block]];
+            n.first_child[dominators[block]] = block;
+        }
+    }
+
+    // Constants are merged across the whole function first.
+    for (int32_t i = start; i < end; i++) {
+        MirId mir_id = {i};
+        MirTag tag = get_mir_tag(mir, mir_id);
+        ValueKey key;
+
+        if ((tag == MIR_INT || tag == MIR_TIR_VALUE) && get_value_key(&n, mir_id, &key)) {
+            n.replacements[i - start] = find_or_add_value(&n, &key, mir_id).private_field_id;
+        }
+    }
+
+    number_block(&n, 0);
+
+    // Unreachable blocks are not visited above.
+    for (int32_t i = start; i < end; i++) {
+        replace_operands(&n, (MirId) {i});
+    }
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "arena.h"
+#include "data/mir.h"
+#include "data/tir.h"
+
+// Replaces pure instructions of [start, end) that recompute a value already
+// available in a dominating block by that value. Removed instructions become
+// MIR_NOP.
+void number_mir_values(Mir *mir, TirContext ctx, int32_t start, int32_t end, Arena scratch);
@@ -0,0 +1,35 @@
+# Compiles FILES (separated by '|', relative to SOURCE_DIR) with -ir-stats and
+# the options in FLAGS (also separated by '|'), and compares the report with
+# BASELINE, or replaces BASELINE if UPDATE is set. The target is fixed so that
+# the report does not depend on the host.
+
+string(REPLACE "|" ";" files "${FILES}")
+list(TRANSFORM files PREPEND "${SOURCE_DIR}/")
+string(REPLACE "|" ";" flags "${FLAGS}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+
+execute_process(
+    COMMAND "${JELLYC}" -backend=${BACKEND} -target=x86_64-pc-linux-gnu -ir-stats ${flags} ${files}
+    WORKING_DIRECTORY "${WORK_DIR}"
+    RESULT_VARIABLE result
+    OUTPUT_VARIABLE report
+)
+
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "jellyc failed with ${result}")
+endif()
+
+string(REPLACE "${SOURCE_DIR}/" "" report "${report}")
+
+if (UPDATE)
+    file(WRITE "${BASELINE}" "${report}")
+    return()
+endif()
+
+file(READ "${BASELINE}" baseline)
+
+if (NOT report STREQUAL baseline)
+    file(WRITE "${WORK_DIR}/ir-stats.txt" "${report}")
+    execute_process(COMMAND diff -u "${BASELINE}" "${WORK_DIR}/ir-stats.txt")
+    message(FATAL_ERROR "IR stats differ from ${BASELINE}. Configure with -DUPDATE_IR_STATS=ON and run the tests to accept them.")
+endif()